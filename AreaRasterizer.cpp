@@ -0,0 +1,303 @@
+//! @file AreaRasterizer.cpp
+#include "AreaRasterizer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <utility>
+
+namespace svg
+{
+    AreaRasterizer::AreaRasterizer()
+        : x0_(0), y0_(0), x1_(0), y1_(0), left_(GUARD), top_(GUARD), direct_(false), next_edge_(0), strip_bottom_(0), width_(0), words_(0), word_groups_(0)
+    {
+    }
+
+    void AreaRasterizer::reset(int x0, int y0, int x1, int y1)
+    {
+        x0_ = x0;
+        y0_ = y0;
+        x1_ = std::max(x0, x1);
+        y1_ = std::max(y0, y1);
+        assert(x0_ >= -GUARD && y0_ >= -GUARD && x1_ <= GUARD && y1_ <= GUARD);
+        left_ = x0_ + GUARD;
+        top_ = y0_ + GUARD;
+        edges_.clear();
+        width_ = x1_ - x0_;
+        words_ = (width_ + 63) / 64;
+        word_groups_ = (words_ + 63) / 64;
+        const int height = y1_ - y0_;
+        direct_ = (size_t)width_ * height <= DIRECT_CELLS;
+        // The buffers are all zeros (swept cells are reset), and only grow.
+        const size_t rows = direct_ ? height : STRIP_ROWS;
+        if (cells_.size() < rows * width_)
+        {
+            cells_.resize(rows * width_, Cell{0, 0});
+        }
+        if (touched_.size() < rows * words_)
+        {
+            touched_.resize(rows * words_, 0);
+        }
+        if (touched_words_.size() < rows * word_groups_)
+        {
+            touched_words_.resize(rows * word_groups_, 0);
+        }
+    }
+
+    void AreaRasterizer::add_edge(double xa, double ya, double xb, double yb)
+    {
+        // Cell coordinates on the grid.
+        xa += 0.5 + GUARD;
+        xb += 0.5 + GUARD;
+        ya += 0.5 + GUARD;
+        yb += 0.5 + GUARD;
+        int sign = 1;
+        if (ya > yb)
+        {
+            std::swap(xa, xb);
+            std::swap(ya, yb);
+            sign = -1;
+        }
+        // Rows outside the rectangle are left out once rounded (see
+        // add_clipped_edge()). Horizontal edges cover nothing.
+        const double size = 2.0 * GUARD;
+        if (ya == yb || yb <= 0 || ya >= size)
+        {
+            return;
+        }
+        if (ya >= 0 && yb <= size && std::min(xa, xb) >= 0 && std::max(xa, xb) <= size)
+        {
+            add_clipped_edge(xa, ya, xb, yb, sign);
+            return;
+        }
+        const double slope = (xb - xa) / (yb - ya);
+        if (ya < 0)
+        {
+            xa -= ya * slope;
+            ya = 0;
+        }
+        if (yb > size)
+        {
+            xb = xa + (size - ya) * slope;
+            yb = size;
+        }
+        // Left of the grid, an edge covers all of its rows: that part is
+        // moved onto the left side. Right of it, it covers nothing inside:
+        // that part is moved onto the right side. So the edge is split
+        // where it crosses the sides.
+        double xs[4] = {xa}, ys[4] = {ya};
+        int n = 1;
+        for (double side : {0.0, size})
+        {
+            if ((xa < side) != (xb < side))
+            {
+                xs[n] = side;
+                ys[n] = ya + (side - xa) * (yb - ya) / (xb - xa);
+                n++;
+            }
+        }
+        if (n == 3 && ys[2] < ys[1])
+        {
+            std::swap(xs[1], xs[2]);
+            std::swap(ys[1], ys[2]);
+        }
+        xs[n] = xb;
+        ys[n] = yb;
+        for (int i = 0; i < n; i++)
+        {
+            add_clipped_edge(std::min(std::max(xs[i], 0.0), size), ys[i],
+                             std::min(std::max(xs[i + 1], 0.0), size), ys[i + 1], sign);
+        }
+    }
+
+    void AreaRasterizer::add_clipped_edge(double xa, double ya, double xb, double yb, int sign)
+    {
+        // Positions are not negative: adding a half rounds them.
+        Edge e;
+        e.x_top = (int)(xa * ONE_PIXEL + 0.5);
+        e.y_top = (int)(ya * ONE_PIXEL + 0.5);
+        e.x_bottom = (int)(xb * ONE_PIXEL + 0.5);
+        e.y_bottom = (int)(yb * ONE_PIXEL + 0.5);
+        const int top = top_ << SUBPIXEL_BITS, bottom = (top_ + y1_ - y0_) << SUBPIXEL_BITS;
+        if (e.y_top == e.y_bottom || e.y_bottom <= top || e.y_top >= bottom)
+        {
+            return;
+        }
+        e.sign = sign;
+        const int dx = e.x_bottom - e.x_top, dy = e.y_bottom - e.y_top;
+        e.dx_dy = (double)dx / dy;
+        e.dy_dx = dx != 0 ? (double)dy / std::abs(dx) : 0;
+        // An edge starting above the rectangle starts on its top side,
+        // where walk_edge() would have reached.
+        e.x = e.x_top;
+        e.y = e.y_top;
+        if (e.y < top)
+        {
+            e.x = e.x_top + (int)((top - e.y_top) * e.dx_dy);
+            e.y = top;
+        }
+        if (direct_)
+        {
+            walk_edge(e, top_, std::min(e.y_bottom, bottom));
+        }
+        else
+        {
+            edges_.push_back(e);
+        }
+    }
+
+    void AreaRasterizer::start_sweep()
+    {
+        std::sort(edges_.begin(), edges_.end(),
+                  [](const Edge &a, const Edge &b)
+                  { return a.y < b.y; });
+        active_.clear();
+        next_edge_ = 0;
+        strip_bottom_ = 0;
+    }
+
+    bool AreaRasterizer::next_strip(int &top, int &bottom)
+    {
+        top = strip_bottom_;
+        if (direct_)
+        {
+            // All rows are in one strip, already accumulated.
+            bottom = strip_bottom_ = y1_ - y0_;
+            return top < bottom;
+        }
+        // Rows without edges have no coverage: skip to the next edge.
+        if (active_.empty())
+        {
+            if (next_edge_ == edges_.size())
+            {
+                return false;
+            }
+            top = std::max(top, (edges_[next_edge_].y >> SUBPIXEL_BITS) - top_);
+        }
+        if (top >= y1_ - y0_)
+        {
+            return false;
+        }
+        bottom = std::min(top + STRIP_ROWS, y1_ - y0_);
+        strip_bottom_ = bottom;
+        const int strip_bottom = (top_ + bottom) << SUBPIXEL_BITS;
+        for (; next_edge_ < edges_.size() && edges_[next_edge_].y < strip_bottom; next_edge_++)
+        {
+            active_.push_back(next_edge_);
+        }
+        size_t n = 0;
+        for (size_t i : active_)
+        {
+            Edge &e = edges_[i];
+            walk_edge(e, top_ + top, std::min(e.y_bottom, strip_bottom));
+            if (e.y_bottom > strip_bottom)
+            {
+                active_[n++] = i;
+            }
+        }
+        active_.resize(n);
+        return true;
+    }
+
+    void AreaRasterizer::walk_edge(Edge &e, int top, int y_to)
+    {
+        while (e.y < y_to)
+        {
+            const int row = e.y >> SUBPIXEL_BITS;
+            const int y_next = std::min(y_to, (row + 1) << SUBPIXEL_BITS);
+            // Computed from the top rather than stepped, so that no error
+            // builds up; truncating keeps it between the ends.
+            const int x_next = y_next == e.y_bottom ? e.x_bottom : e.x_top + (int)((y_next - e.y_top) * e.dx_dy);
+            add_row_edge(row - top, e.x, x_next, (y_next - e.y) * e.sign, e.dy_dx);
+            e.x = x_next;
+            e.y = y_next;
+        }
+    }
+
+    void AreaRasterizer::add_row_edge(int row, int xa, int xb, int dy, double dy_dx)
+    {
+        if (xa > xb)
+        {
+            // The cover of each column only depends on the part of the
+            // edge in it, not on the direction.
+            std::swap(xa, xb);
+        }
+        const int left = left_, right = left_ + width_;
+        int first = xa >> SUBPIXEL_BITS;
+        const int last = xb >> SUBPIXEL_BITS;
+        if (first >= right)
+        {
+            // Right of the rectangle, cover flows out of it.
+            return;
+        }
+        Cell *cells = &cells_[(size_t)row * width_];
+        uint64_t *touched = &touched_[(size_t)row * words_];
+        uint64_t *touched_words = &touched_words_[(size_t)row * word_groups_];
+        auto add = [&](int x, int64_t cover, int64_t area)
+        {
+            x -= left;
+            cells[x].cover += cover;
+            cells[x].area += area;
+            touched[x >> 6] |= 1ull << (x & 63);
+            touched_words[x >> 12] |= 1ull << ((x >> 6) & 63);
+        };
+        const int fa = xa & (ONE_PIXEL - 1), fb = xb & (ONE_PIXEL - 1);
+        if (last < left)
+        {
+            // Left of the rectangle, all the cover flows into it.
+            add(left, dy, 0);
+            return;
+        }
+        if (first == last)
+        {
+            add(first, dy, (int64_t)dy * (fa + fb));
+            return;
+        }
+        // The height is split between the columns in proportion to the
+        // width of the edge in each: up to the right side of column x,
+        // it is the width from xa times the slope, truncated, and the
+        // last column gets the rest. So the parts add up whatever the
+        // rounding of xa and xb, and the columns left of the rectangle
+        // add up to their total.
+        const int sign = dy < 0 ? -1 : 1;
+        const int height = dy * sign;
+        auto height_to = [&](int x)
+        {
+            return (int)std::min<double>(height, (((x + 1) << SUBPIXEL_BITS) - xa) * dy_dx);
+        };
+        int done;
+        if (first < left)
+        {
+            first = left - 1;
+            done = height_to(first);
+            if (done != 0)
+            {
+                add(left, sign * done, 0);
+            }
+        }
+        else
+        {
+            done = height_to(first);
+            if (done != 0)
+            {
+                add(first, sign * done, (int64_t)sign * done * (fa + ONE_PIXEL));
+            }
+        }
+        const int end = std::min(last, right);
+        for (int x = first + 1; x < end; x++)
+        {
+            const int next = height_to(x);
+            if (next != done)
+            {
+                add(x, sign * (next - done), (int64_t)sign * (next - done) * ONE_PIXEL);
+                done = next;
+            }
+        }
+        // The last column is only outside (right of the rectangle) if the
+        // edge ends on it, with nothing left.
+        if (done < height && last < right)
+        {
+            add(last, sign * (height - done), (int64_t)sign * (height - done) * fb);
+        }
+    }
+}
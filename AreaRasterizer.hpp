@@ -0,0 +1,260 @@
+//! @file AreaRasterizer.hpp
+#ifndef __svg_AreaRasterizer_hpp__
+#define __svg_AreaRasterizer_hpp__
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace svg
+{
+    //! Anti-aliasing rasterizer: computes the exact area of each pixel
+    //! covered by a shape given by its outline edges, as font rasterizers
+    //! do. Each edge accumulates a signed area and cover into the cells
+    //! (pixels) it crosses, and a sweep along each row turns them into
+    //! coverage. Only the cells crossed by edges are visited: the pixels
+    //! between two of them all have the same coverage, so shape interiors
+    //! come out as solid runs (see PNGImage::set_antialias()).
+    //! Pixel (x, y) is the unit square centered on point (x, y).
+    //! Edges are stored and walked in fixed point (1/256 pixel), on a grid
+    //! fixed to the canvas rather than to the rectangle: only the cells
+    //! inside the rectangle are accumulated, so a shape drawn in tiles is
+    //! covered exactly as when drawn whole.
+    class AreaRasterizer
+    {
+    public:
+        //! Constructor (call reset() before use).
+        AreaRasterizer();
+        //! Start a new shape, clipped to a rectangle (within GUARD of the
+        //! origin).
+        //! @param x0 Left edge.
+        //! @param y0 Top edge.
+        //! @param x1 Right edge (exclusive).
+        //! @param y1 Bottom edge (exclusive).
+        void reset(int x0, int y0, int x1, int y1);
+        //! Add an edge of the shape's outline. The edges must form
+        //! closed contours (in any order).
+        //! @param xa X position of the first point.
+        //! @param ya Y position of the first point.
+        //! @param xb X position of the second point.
+        //! @param yb Y position of the second point.
+        void add_edge(double xa, double ya, double xb, double yb);
+        //! Compute the coverage of the pixels: span(x_from, x_to, y, alpha)
+        //! is called for each run of pixels with the same coverage, from
+        //! 1 to 255 (fully covered), row by row and left to right.
+        //! Coverage is exact (to 1/256 pixel) where edges do not cross
+        //! each other.
+        //! @param even_odd true for the even-odd fill rule, false for
+        //! non-zero.
+        //! @param span Function painting a run (x_to inclusive).
+        template <typename Span>
+        void sweep(bool even_odd, Span span);
+
+    private:
+        //! Edge, in subpixels from the grid's upper-left corner (-GUARD,
+        //! -GUARD), in cell coordinates (pixel (x, y) is the cell
+        //! [x + GUARD, x + GUARD + 1[ x [y + GUARD, y + GUARD + 1[), top
+        //! to bottom.
+        struct Edge
+        {
+            int x_top, y_top;
+            int x_bottom, y_bottom;
+            //! 1 if the edge goes down, -1 if it goes up.
+            int sign;
+            //! Position reached by the sweep (at a row boundary after the
+            //! first row, or the rectangle's top side).
+            int x, y;
+            //! Slope (X per Y), and the absolute value of its inverse.
+            double dx_dy, dy_dx;
+        };
+        //! Accumulated cover (signed height, in subpixels) and area (twice
+        //! the cover times the distance of the edges from the cell's left
+        //! side) of the edges crossing a cell.
+        struct Cell
+        {
+            int64_t cover;
+            int64_t area;
+        };
+
+        //! Subpixels per pixel, in bits.
+        static const int SUBPIXEL_BITS = 8;
+        static const int ONE_PIXEL = 1 << SUBPIXEL_BITS;
+        //! Half-size of the grid, in pixels: its subpixel positions fit in
+        //! an int. Edges are clipped to it in floating point.
+        static const int GUARD = 1 << 21;
+        //! Coverage value of a fully covered pixel (see alpha()).
+        static const int64_t FULL_COVERAGE = (int64_t)ONE_PIXEL * ONE_PIXEL * 2;
+        //! Rows of cells accumulated at once: a strip of cells is small
+        //! enough to stay in cache, whatever the size of the shape.
+        static const int STRIP_ROWS = 16;
+        //! Largest rectangle (in cells) swept as a single strip, its edges
+        //! being accumulated as they are added rather than stored and
+        //! sorted: small shapes are mostly edges.
+        static const size_t DIRECT_CELLS = 1 << 14;
+
+        //! Add a part of an edge that lies inside the grid (in cells).
+        void add_clipped_edge(double xa, double ya, double xb, double yb, int sign);
+        //! Sort the edges for sweep().
+        void start_sweep();
+        //! sweep() for a fill rule.
+        template <bool EvenOdd, typename Span>
+        void sweep_rows(Span span);
+        //! Accumulate the cells of the next strip of rows.
+        //! @param top Set to the first row of the strip.
+        //! @param bottom Set to the row after the last one.
+        //! @return false when all rows are done.
+        bool next_strip(int &top, int &bottom);
+        //! Add the rows of an edge down to a position.
+        //! @param e Edge, whose position is updated.
+        //! @param top First row of the strip (on the grid).
+        //! @param y_to Position (subpixels, at most e.y_bottom).
+        void walk_edge(Edge &e, int top, int y_to);
+        //! Add the part of an edge within a row. Columns left of the
+        //! rectangle add their cover to its first cell.
+        //! @param row Row (from the top of the strip).
+        //! @param xa First X position (subpixels, on the grid).
+        //! @param xb Second X position (subpixels, on the grid).
+        //! @param dy Signed height (subpixels, at most one pixel).
+        //! @param dy_dx Height per width of the edge (unsigned).
+        void add_row_edge(int row, int xa, int xb, int dy, double dy_dx);
+        //! Map accumulated coverage to an alpha value.
+        //! @param coverage Signed coverage, FULL_COVERAGE per winding.
+        //! @tparam EvenOdd Fill rule (see sweep()).
+        template <bool EvenOdd>
+        static int alpha(int64_t coverage);
+
+        int x0_, y0_, x1_, y1_;
+        //! Column and row of the rectangle's upper-left cell, on the grid.
+        int left_, top_;
+        //! Whether the rectangle is swept as a single strip (see
+        //! DIRECT_CELLS).
+        bool direct_;
+        std::vector<Edge> edges_;
+        //! Edges crossing the current strip (indices in edges_), and the
+        //! first edge not reached yet.
+        std::vector<size_t> active_;
+        size_t next_edge_;
+        //! Row after the current strip (from the top of the rectangle).
+        int strip_bottom_;
+        //! Cells per row of the strip, words per row of touched_, and per
+        //! row of touched_words_.
+        int width_;
+        int words_;
+        int word_groups_;
+        //! Cells of the strip, row by row, reset to zero as they are swept.
+        std::vector<Cell> cells_;
+        //! Cells crossed by edges, one bit per cell (bit i of word w being
+        //! cell 64 w + i of the row).
+        std::vector<uint64_t> touched_;
+        //! Words of touched_ that are not zero, one bit per word (likewise):
+        //! the sweep skips the others, between the edges of wide shapes.
+        std::vector<uint64_t> touched_words_;
+    };
+
+    template <bool EvenOdd>
+    inline int AreaRasterizer::alpha(int64_t coverage)
+    {
+        coverage = coverage < 0 ? -coverage : coverage;
+        if (EvenOdd)
+        {
+            // Windings modulo 2, folded: 1.25 covers as much as 0.75.
+            coverage &= 2 * FULL_COVERAGE - 1;
+            coverage = coverage > FULL_COVERAGE ? 2 * FULL_COVERAGE - coverage : coverage;
+        }
+        else if (coverage > FULL_COVERAGE)
+        {
+            coverage = FULL_COVERAGE;
+        }
+        return (int)((coverage * 255 + FULL_COVERAGE / 2) >> (2 * SUBPIXEL_BITS + 1));
+    }
+
+    template <typename Span>
+    void AreaRasterizer::sweep(bool even_odd, Span span)
+    {
+        if (even_odd)
+        {
+            sweep_rows<true>(span);
+        }
+        else
+        {
+            sweep_rows<false>(span);
+        }
+    }
+
+    template <bool EvenOdd, typename Span>
+    void AreaRasterizer::sweep_rows(Span span)
+    {
+        // Partly covered runs are painted as they come, but fully covered
+        // ones are joined, from the edge pixels into the interior: a row is
+        // visited left to right without gaps, so the pending one ends
+        // where the next run starts (none pending at INT_MIN: the
+        // rectangle may start left of the image).
+        int full_from = INT_MIN;
+        auto emit = [&](int from, int to, int y, int a)
+        {
+            if (a == 255)
+            {
+                full_from = full_from == INT_MIN ? from : full_from;
+                return;
+            }
+            if (full_from != INT_MIN)
+            {
+                span(full_from, from - 1, y, 255);
+                full_from = INT_MIN;
+            }
+            if (a != 0 && from <= to)
+            {
+                span(from, to, y, a);
+            }
+        };
+        start_sweep();
+        // Members are reloaded after each (byte) store of span(): the
+        // loop uses copies.
+        const int x0 = x0_, x1 = x1_, y0 = y0_, width = width_, words = words_, groups = word_groups_;
+        int top, bottom;
+        while (next_strip(top, bottom))
+        {
+            for (int row = top; row < bottom; row++)
+            {
+                const int y = y0 + row;
+                Cell *cells = &cells_[(size_t)(row - top) * width];
+                uint64_t *touched = &touched_[(size_t)(row - top) * words];
+                uint64_t *touched_words = &touched_words_[(size_t)(row - top) * groups];
+                // Cover of the cells to the left.
+                int64_t cover = 0;
+                int previous = -1;
+                for (int g = 0; g < groups; g++)
+                {
+                    uint64_t word_bits = touched_words[g];
+                    touched_words[g] = 0;
+                    while (word_bits != 0)
+                    {
+                        const int w = (g << 6) + __builtin_ctzll(word_bits);
+                        word_bits &= word_bits - 1;
+                        uint64_t bits = touched[w];
+                        touched[w] = 0;
+                        while (bits != 0)
+                        {
+                            const int x = (w << 6) + __builtin_ctzll(bits);
+                            bits &= bits - 1;
+                            Cell &cell = cells[x];
+                            if (x > previous + 1)
+                            {
+                                emit(x0 + previous + 1, x0 + x - 1, y, alpha<EvenOdd>(cover * 2 * ONE_PIXEL));
+                            }
+                            cover += cell.cover;
+                            emit(x0 + x, x0 + x, y, alpha<EvenOdd>(cover * 2 * ONE_PIXEL - cell.area));
+                            cell.cover = cell.area = 0;
+                            previous = x;
+                        }
+                    }
+                }
+                emit(x0 + previous + 1, x1 - 1, y, alpha<EvenOdd>(cover * 2 * ONE_PIXEL));
+                // End of the row.
+                emit(x1, x1, y, 0);
+            }
+        }
+    }
+}
+#endif
@@ -0,0 +1,76 @@
+//! @file Arena.cpp
+#include "Arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace svg
+{
+    Arena::Arena(size_t chunk_size)
+        : chunk_size_(chunk_size), current_(0), offset_(0), used_(0), finalizers_(nullptr)
+    {
+    }
+
+    Arena::~Arena()
+    {
+        reset();
+        for (Chunk &c : chunks_)
+        {
+            ::operator delete(c.data);
+        }
+    }
+
+    void *Arena::allocate(size_t bytes, size_t align)
+    {
+        while (current_ < chunks_.size())
+        {
+            Chunk &c = chunks_[current_];
+            uintptr_t base = reinterpret_cast<uintptr_t>(c.data);
+            size_t start = ((base + offset_ + align - 1) & ~(uintptr_t)(align - 1)) - base;
+            if (start + bytes <= c.size)
+            {
+                offset_ = start + bytes;
+                used_ += bytes;
+                return c.data + start;
+            }
+            // Does not fit: move on to the next (previously allocated) chunk.
+            current_++;
+            offset_ = 0;
+        }
+        Chunk c;
+        c.size = std::max(chunk_size_, bytes + align);
+        c.data = static_cast<char *>(::operator new(c.size));
+        chunks_.push_back(c);
+        current_ = chunks_.size() - 1;
+        offset_ = 0;
+        return allocate(bytes, align);
+    }
+
+    void Arena::reset()
+    {
+        while (finalizers_ != nullptr)
+        {
+            Finalizer *f = finalizers_;
+            finalizers_ = f->next;
+            f->destroy(f->object);
+        }
+        current_ = 0;
+        offset_ = 0;
+        used_ = 0;
+    }
+
+    size_t Arena::used() const
+    {
+        return used_;
+    }
+
+    size_t Arena::reserved() const
+    {
+        size_t total = 0;
+        for (const Chunk &c : chunks_)
+        {
+            total += c.size;
+        }
+        return total;
+    }
+}
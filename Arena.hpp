@@ -0,0 +1,142 @@
+//! @file Arena.hpp
+#ifndef __svg_Arena_hpp__
+#define __svg_Arena_hpp__
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace svg
+{
+    //! Monotonic (bump pointer) allocator.
+    //! Memory is handed out from large chunks and only released all at
+    //! once, by reset() or the destructor. Objects created with make()
+    //! have their destructors run at that point, in reverse order.
+    //! After reset() the chunks are kept, so an arena reused across
+    //! documents stops allocating once it has grown to the largest one.
+    class Arena
+    {
+    public:
+        //! Constructor.
+        //! @param chunk_size Minimum size of each memory chunk.
+        explicit Arena(size_t chunk_size = 64 * 1024);
+        //! Destructor: destroys all objects and frees all memory.
+        ~Arena();
+        //! Allocate raw memory.
+        //! @param bytes Number of bytes.
+        //! @param align Alignment (a power of 2).
+        //! @return Pointer to the memory.
+        void *allocate(size_t bytes, size_t align = alignof(std::max_align_t));
+        //! Create an object in the arena.
+        //! @param args Constructor arguments.
+        //! @return Pointer to the object (owned by the arena).
+        template <typename T, typename... Args>
+        T *make(Args &&...args)
+        {
+            Finalizer *f = nullptr;
+            if (!std::is_trivially_destructible<T>::value)
+            {
+                f = static_cast<Finalizer *>(allocate(sizeof(Finalizer), alignof(Finalizer)));
+            }
+            T *obj = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            if (f != nullptr)
+            {
+                f->destroy = &destroy<T>;
+                f->object = obj;
+                f->next = finalizers_;
+                finalizers_ = f;
+            }
+            return obj;
+        }
+        //! Destroy all objects and make all memory available again.
+        void reset();
+        //! Get the number of bytes handed out since the last reset().
+        //! @return Number of bytes in use.
+        size_t used() const;
+        //! Get the total size of the chunks owned by the arena.
+        //! @return Number of bytes reserved.
+        size_t reserved() const;
+
+    private:
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        //! Destructor call for an object created with make().
+        struct Finalizer
+        {
+            void (*destroy)(void *);
+            void *object;
+            Finalizer *next;
+        };
+        template <typename T>
+        static void destroy(void *object)
+        {
+            static_cast<T *>(object)->~T();
+        }
+        //! Memory chunk.
+        struct Chunk
+        {
+            char *data;
+            size_t size;
+        };
+
+        //! Minimum chunk size.
+        size_t chunk_size_;
+        //! Chunks (kept across resets).
+        std::vector<Chunk> chunks_;
+        //! Chunk currently allocated from.
+        size_t current_;
+        //! Offset of the free space in the current chunk.
+        size_t offset_;
+        //! Bytes handed out since the last reset().
+        size_t used_;
+        //! Most recently created object needing destruction.
+        Finalizer *finalizers_;
+    };
+
+    //! Standard library allocator backed by an Arena.
+    //! Without an arena it falls back to the global heap.
+    template <typename T>
+    struct ArenaAllocator
+    {
+        typedef T value_type;
+
+        //! Arena to allocate from (nullptr for the heap).
+        Arena *arena;
+
+        ArenaAllocator(Arena *arena = nullptr) : arena(arena) {}
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+        T *allocate(size_t n)
+        {
+            if (arena != nullptr)
+            {
+                return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+            }
+            return static_cast<T *>(::operator new(n * sizeof(T)));
+        }
+        void deallocate(T *p, size_t)
+        {
+            // Arena memory is only released by Arena::reset().
+            if (arena == nullptr)
+            {
+                ::operator delete(p);
+            }
+        }
+    };
+
+    template <typename T, typename U>
+    bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+    {
+        return a.arena == b.arena;
+    }
+    template <typename T, typename U>
+    bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+    {
+        return a.arena != b.arena;
+    }
+}
+#endif
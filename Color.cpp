@@ -1,34 +1,476 @@
 #include "Color.hpp"
-#include <map>
-#include <iomanip>
-#include <sstream>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
 
 namespace svg
 {
-    const std::map<std::string, Color> NAMES_TO_COLORS = {
-        {"black", {0, 0, 0}},
-        {"white", {255, 255, 255}},
-        {"red", {255, 0, 0}},
-        {"green", {0, 255, 0}},
-        {"blue", {0, 0, 255}},
-        {"yellow", {255, 255, 0}}};
+    namespace
+    {
+        struct NamedColor
+        {
+            const char *name;
+            Color color;
+        };
 
-    Color parse_color(const std::string &str)
+        // The SVG (CSS3) color keywords, in alphabetical order.
+        // 'green' keeps the value this renderer has always given it (that
+        // of 'lime') instead of #008000, as the reference images use it.
+        constexpr NamedColor NAMED_COLORS[] = {
+            {"aliceblue", {0xF0, 0xF8, 0xFF}},
+            {"antiquewhite", {0xFA, 0xEB, 0xD7}},
+            {"aqua", {0x00, 0xFF, 0xFF}},
+            {"aquamarine", {0x7F, 0xFF, 0xD4}},
+            {"azure", {0xF0, 0xFF, 0xFF}},
+            {"beige", {0xF5, 0xF5, 0xDC}},
+            {"bisque", {0xFF, 0xE4, 0xC4}},
+            {"black", {0x00, 0x00, 0x00}},
+            {"blanchedalmond", {0xFF, 0xEB, 0xCD}},
+            {"blue", {0x00, 0x00, 0xFF}},
+            {"blueviolet", {0x8A, 0x2B, 0xE2}},
+            {"brown", {0xA5, 0x2A, 0x2A}},
+            {"burlywood", {0xDE, 0xB8, 0x87}},
+            {"cadetblue", {0x5F, 0x9E, 0xA0}},
+            {"chartreuse", {0x7F, 0xFF, 0x00}},
+            {"chocolate", {0xD2, 0x69, 0x1E}},
+            {"coral", {0xFF, 0x7F, 0x50}},
+            {"cornflowerblue", {0x64, 0x95, 0xED}},
+            {"cornsilk", {0xFF, 0xF8, 0xDC}},
+            {"crimson", {0xDC, 0x14, 0x3C}},
+            {"cyan", {0x00, 0xFF, 0xFF}},
+            {"darkblue", {0x00, 0x00, 0x8B}},
+            {"darkcyan", {0x00, 0x8B, 0x8B}},
+            {"darkgoldenrod", {0xB8, 0x86, 0x0B}},
+            {"darkgray", {0xA9, 0xA9, 0xA9}},
+            {"darkgreen", {0x00, 0x64, 0x00}},
+            {"darkgrey", {0xA9, 0xA9, 0xA9}},
+            {"darkkhaki", {0xBD, 0xB7, 0x6B}},
+            {"darkmagenta", {0x8B, 0x00, 0x8B}},
+            {"darkolivegreen", {0x55, 0x6B, 0x2F}},
+            {"darkorange", {0xFF, 0x8C, 0x00}},
+            {"darkorchid", {0x99, 0x32, 0xCC}},
+            {"darkred", {0x8B, 0x00, 0x00}},
+            {"darksalmon", {0xE9, 0x96, 0x7A}},
+            {"darkseagreen", {0x8F, 0xBC, 0x8F}},
+            {"darkslateblue", {0x48, 0x3D, 0x8B}},
+            {"darkslategray", {0x2F, 0x4F, 0x4F}},
+            {"darkslategrey", {0x2F, 0x4F, 0x4F}},
+            {"darkturquoise", {0x00, 0xCE, 0xD1}},
+            {"darkviolet", {0x94, 0x00, 0xD3}},
+            {"deeppink", {0xFF, 0x14, 0x93}},
+            {"deepskyblue", {0x00, 0xBF, 0xFF}},
+            {"dimgray", {0x69, 0x69, 0x69}},
+            {"dimgrey", {0x69, 0x69, 0x69}},
+            {"dodgerblue", {0x1E, 0x90, 0xFF}},
+            {"firebrick", {0xB2, 0x22, 0x22}},
+            {"floralwhite", {0xFF, 0xFA, 0xF0}},
+            {"forestgreen", {0x22, 0x8B, 0x22}},
+            {"fuchsia", {0xFF, 0x00, 0xFF}},
+            {"gainsboro", {0xDC, 0xDC, 0xDC}},
+            {"ghostwhite", {0xF8, 0xF8, 0xFF}},
+            {"gold", {0xFF, 0xD7, 0x00}},
+            {"goldenrod", {0xDA, 0xA5, 0x20}},
+            {"gray", {0x80, 0x80, 0x80}},
+            {"grey", {0x80, 0x80, 0x80}},
+            {"green", {0x00, 0xFF, 0x00}},
+            {"greenyellow", {0xAD, 0xFF, 0x2F}},
+            {"honeydew", {0xF0, 0xFF, 0xF0}},
+            {"hotpink", {0xFF, 0x69, 0xB4}},
+            {"indianred", {0xCD, 0x5C, 0x5C}},
+            {"indigo", {0x4B, 0x00, 0x82}},
+            {"ivory", {0xFF, 0xFF, 0xF0}},
+            {"khaki", {0xF0, 0xE6, 0x8C}},
+            {"lavender", {0xE6, 0xE6, 0xFA}},
+            {"lavenderblush", {0xFF, 0xF0, 0xF5}},
+            {"lawngreen", {0x7C, 0xFC, 0x00}},
+            {"lemonchiffon", {0xFF, 0xFA, 0xCD}},
+            {"lightblue", {0xAD, 0xD8, 0xE6}},
+            {"lightcoral", {0xF0, 0x80, 0x80}},
+            {"lightcyan", {0xE0, 0xFF, 0xFF}},
+            {"lightgoldenrodyellow", {0xFA, 0xFA, 0xD2}},
+            {"lightgray", {0xD3, 0xD3, 0xD3}},
+            {"lightgreen", {0x90, 0xEE, 0x90}},
+            {"lightgrey", {0xD3, 0xD3, 0xD3}},
+            {"lightpink", {0xFF, 0xB6, 0xC1}},
+            {"lightsalmon", {0xFF, 0xA0, 0x7A}},
+            {"lightseagreen", {0x20, 0xB2, 0xAA}},
+            {"lightskyblue", {0x87, 0xCE, 0xFA}},
+            {"lightslategray", {0x77, 0x88, 0x99}},
+            {"lightslategrey", {0x77, 0x88, 0x99}},
+            {"lightsteelblue", {0xB0, 0xC4, 0xDE}},
+            {"lightyellow", {0xFF, 0xFF, 0xE0}},
+            {"lime", {0x00, 0xFF, 0x00}},
+            {"limegreen", {0x32, 0xCD, 0x32}},
+            {"linen", {0xFA, 0xF0, 0xE6}},
+            {"magenta", {0xFF, 0x00, 0xFF}},
+            {"maroon", {0x80, 0x00, 0x00}},
+            {"mediumaquamarine", {0x66, 0xCD, 0xAA}},
+            {"mediumblue", {0x00, 0x00, 0xCD}},
+            {"mediumorchid", {0xBA, 0x55, 0xD3}},
+            {"mediumpurple", {0x93, 0x70, 0xDB}},
+            {"mediumseagreen", {0x3C, 0xB3, 0x71}},
+            {"mediumslateblue", {0x7B, 0x68, 0xEE}},
+            {"mediumspringgreen", {0x00, 0xFA, 0x9A}},
+            {"mediumturquoise", {0x48, 0xD1, 0xCC}},
+            {"mediumvioletred", {0xC7, 0x15, 0x85}},
+            {"midnightblue", {0x19, 0x19, 0x70}},
+            {"mintcream", {0xF5, 0xFF, 0xFA}},
+            {"mistyrose", {0xFF, 0xE4, 0xE1}},
+            {"moccasin", {0xFF, 0xE4, 0xB5}},
+            {"navajowhite", {0xFF, 0xDE, 0xAD}},
+            {"navy", {0x00, 0x00, 0x80}},
+            {"oldlace", {0xFD, 0xF5, 0xE6}},
+            {"olive", {0x80, 0x80, 0x00}},
+            {"olivedrab", {0x6B, 0x8E, 0x23}},
+            {"orange", {0xFF, 0xA5, 0x00}},
+            {"orangered", {0xFF, 0x45, 0x00}},
+            {"orchid", {0xDA, 0x70, 0xD6}},
+            {"palegoldenrod", {0xEE, 0xE8, 0xAA}},
+            {"palegreen", {0x98, 0xFB, 0x98}},
+            {"paleturquoise", {0xAF, 0xEE, 0xEE}},
+            {"palevioletred", {0xDB, 0x70, 0x93}},
+            {"papayawhip", {0xFF, 0xEF, 0xD5}},
+            {"peachpuff", {0xFF, 0xDA, 0xB9}},
+            {"peru", {0xCD, 0x85, 0x3F}},
+            {"pink", {0xFF, 0xC0, 0xCB}},
+            {"plum", {0xDD, 0xA0, 0xDD}},
+            {"powderblue", {0xB0, 0xE0, 0xE6}},
+            {"purple", {0x80, 0x00, 0x80}},
+            {"red", {0xFF, 0x00, 0x00}},
+            {"rosybrown", {0xBC, 0x8F, 0x8F}},
+            {"royalblue", {0x41, 0x69, 0xE1}},
+            {"saddlebrown", {0x8B, 0x45, 0x13}},
+            {"salmon", {0xFA, 0x80, 0x72}},
+            {"sandybrown", {0xF4, 0xA4, 0x60}},
+            {"seagreen", {0x2E, 0x8B, 0x57}},
+            {"seashell", {0xFF, 0xF5, 0xEE}},
+            {"sienna", {0xA0, 0x52, 0x2D}},
+            {"silver", {0xC0, 0xC0, 0xC0}},
+            {"skyblue", {0x87, 0xCE, 0xEB}},
+            {"slateblue", {0x6A, 0x5A, 0xCD}},
+            {"slategray", {0x70, 0x80, 0x90}},
+            {"slategrey", {0x70, 0x80, 0x90}},
+            {"snow", {0xFF, 0xFA, 0xFA}},
+            {"springgreen", {0x00, 0xFF, 0x7F}},
+            {"steelblue", {0x46, 0x82, 0xB4}},
+            {"tan", {0xD2, 0xB4, 0x8C}},
+            {"teal", {0x00, 0x80, 0x80}},
+            {"thistle", {0xD8, 0xBF, 0xD8}},
+            {"tomato", {0xFF, 0x63, 0x47}},
+            {"turquoise", {0x40, 0xE0, 0xD0}},
+            {"violet", {0xEE, 0x82, 0xEE}},
+            {"wheat", {0xF5, 0xDE, 0xB3}},
+            {"white", {0xFF, 0xFF, 0xFF}},
+            {"whitesmoke", {0xF5, 0xF5, 0xF5}},
+            {"yellow", {0xFF, 0xFF, 0x00}},
+            {"yellowgreen", {0x9A, 0xCD, 0x32}},
+        };
+        constexpr size_t NAMED_COLOR_COUNT = sizeof(NAMED_COLORS) / sizeof(NAMED_COLORS[0]);
+        // Length of the longest name ("lightgoldenrodyellow").
+        const size_t MAX_NAME_LENGTH = 20;
+
+        // Perfect hash of the names, generated offline (hash and displace):
+        // the bucket h1 % BUCKETS of a name selects a displacement d, and
+        // its slot is (h2 + d) % SLOTS, where h1 and h2 are FNV-1a hashes
+        // with different bases. No two names share a slot (this is checked
+        // at compile time below), so a lookup is two hashes of the name and
+        // one string comparison.
+        constexpr uint32_t FNV_BASIS = 2166136261u;
+        constexpr uint32_t SECOND_BASIS = 0x0eefda44u;
+        constexpr size_t BUCKETS = 64;
+        constexpr size_t SLOTS = 256;
+        constexpr unsigned char DISPLACEMENTS[BUCKETS] = {
+              0,   0,   0,   0,   0,   1,   0,   0,   3,   2,   0,   0,   1,   0,   2,   0,
+              9,   1,   0,   7,   1,   5,   0,   0,   2,   2,   0,   0,   1,   0,   1,   1,
+              2,   0,   8,   0,   3,   0,   0,   2,   0,   1,   1,   0,   0,   4,   4,   4,
+              7,   0,   0,  12,   2,   2,   0,   2,   0,   4,   0,   9,   0,   1,   0,   1
+        };
+        // Index in NAMED_COLORS of the name in each slot (EMPTY if none).
+        constexpr unsigned char EMPTY = 255;
+        constexpr unsigned char NAME_INDEX[SLOTS] = {
+             40, 130, 255,  31, 103, 255,  41,  75,   9, 255, 255, 255, 255, 255, 255,  22,
+            138,  88, 135, 144,  11, 106, 255, 255,   0,  66,  60,  25, 255, 110, 139,  36,
+             98,  49, 113, 121, 132,  19,  74,  33,  37,   2,  13,  47,  18,  93, 255,  12,
+              5, 255,  30, 131, 255,  96,  87, 255, 255, 255, 255, 129, 255, 255, 105,  28,
+            255, 255, 255, 255, 255, 255, 145, 118, 255,  58, 102, 255,  14,  35,  76, 141,
+             89, 255, 255,  20, 119, 112,  68,  71,  15, 255,  92,  39, 255, 255, 255, 255,
+            134, 255, 255, 255, 255, 117,  73,  57, 255,  65, 255, 255, 100, 255, 127,  55,
+             34,  42, 146, 255,  77, 255, 255,  24,  23, 136,   7,  72,  78,  67,  86, 107,
+            142, 255, 255,  26, 125, 255, 255, 133,  84,  16,  97, 255,  52,  48,  95, 128,
+             32,  51,  79,  80,  21, 255, 255, 255,  17, 255, 255, 255,  90,  82, 255, 111,
+            255, 255, 255, 255, 255, 255, 255, 255,  29,  38, 255,  56, 255,  43, 255, 255,
+            255, 120, 255, 255, 255,  45,  83,  44, 255, 122, 114, 104,  64, 255,  27,  70,
+            255, 255,   1, 255, 255, 255,  91, 255, 255, 255,  59, 255, 255, 255, 255,   6,
+            255, 143,  62, 137, 255, 140, 116,  63, 124, 255,   3,  10, 255,  50, 255,  54,
+             81, 255, 255, 123, 255, 255, 255, 255, 109, 101, 255,  53, 115,  46, 255, 255,
+             69,  61,  94, 255, 108,   4, 255, 255, 126,  99, 255,  85,   8, 255, 255, 255
+        };
+
+        constexpr uint32_t fnv1a(const char *str, size_t n, uint32_t hash)
+        {
+            return n == 0 ? hash : fnv1a(str + 1, n - 1, (hash ^ (unsigned char)*str) * 16777619u);
+        }
+
+        constexpr size_t slot(const char *name, size_t n)
+        {
+            return (fnv1a(name, n, SECOND_BASIS) + DISPLACEMENTS[fnv1a(name, n, FNV_BASIS) % BUCKETS]) % SLOTS;
+        }
+
+        constexpr size_t length(const char *str)
+        {
+            return *str == 0 ? 0 : 1 + length(str + 1);
+        }
+
+        constexpr bool all_in_place(size_t i)
+        {
+            return i == NAMED_COLOR_COUNT ||
+                   (NAME_INDEX[slot(NAMED_COLORS[i].name, length(NAMED_COLORS[i].name))] == i &&
+                    all_in_place(i + 1));
+        }
+        static_assert(all_in_place(0), "NAME_INDEX is not a perfect hash of NAMED_COLORS");
+
+        [[noreturn]] void invalid_color(const char *str)
+        {
+            throw std::runtime_error(std::string("Invalid color: ") + str);
+        }
+
+        bool is_space(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+
+        int hex_digit(char c)
+        {
+            if (c >= '0' && c <= '9')
+            {
+                return c - '0';
+            }
+            if (c >= 'a' && c <= 'f')
+            {
+                return c - 'a' + 10;
+            }
+            if (c >= 'A' && c <= 'F')
+            {
+                return c - 'A' + 10;
+            }
+            return -1;
+        }
+
+        // '#rrggbb' or '#rgb' (digits in [begin, end[).
+        bool parse_hex(const char *begin, const char *end, Color &c)
+        {
+            const size_t n = end - begin;
+            if (n != 3 && n != 6)
+            {
+                return false;
+            }
+            int digits[6];
+            for (size_t i = 0; i < n; i++)
+            {
+                digits[i] = hex_digit(begin[i]);
+                if (digits[i] < 0)
+                {
+                    return false;
+                }
+            }
+            if (n == 3)
+            {
+                c.red = (rgb_value)(digits[0] * 17);
+                c.green = (rgb_value)(digits[1] * 17);
+                c.blue = (rgb_value)(digits[2] * 17);
+            }
+            else
+            {
+                c.red = (rgb_value)(digits[0] * 16 + digits[1]);
+                c.green = (rgb_value)(digits[2] * 16 + digits[3]);
+                c.blue = (rgb_value)(digits[4] * 16 + digits[5]);
+            }
+            return true;
+        }
+
+        // A CSS number ("-12", "50.5", ".5e1"...), after optional spaces.
+        // Parsed by hand: strtod() depends on the locale, and would also
+        // accept hexadecimal numbers, "nan" and "inf".
+        // Returns false if there is no number, or if it is not finite.
+        bool parse_number(const char *&p, double &value)
+        {
+            const char *q = p;
+            while (is_space(*q))
+            {
+                q++;
+            }
+            bool negative = false;
+            if (*q == '+' || *q == '-')
+            {
+                negative = *q == '-';
+                q++;
+            }
+            double mantissa = 0;
+            int scale = 0;
+            bool digits = false;
+            for (; *q >= '0' && *q <= '9'; q++)
+            {
+                mantissa = mantissa * 10 + (*q - '0');
+                digits = true;
+            }
+            if (*q == '.')
+            {
+                for (q++; *q >= '0' && *q <= '9'; q++)
+                {
+                    mantissa = mantissa * 10 + (*q - '0');
+                    scale--;
+                    digits = true;
+                }
+            }
+            if (!digits)
+            {
+                return false;
+            }
+            // The exponent only counts if it has digits (as for strtod).
+            const char *e = q;
+            if (*e == 'e' || *e == 'E')
+            {
+                e++;
+                bool negative_exponent = false;
+                if (*e == '+' || *e == '-')
+                {
+                    negative_exponent = *e == '-';
+                    e++;
+                }
+                if (*e >= '0' && *e <= '9')
+                {
+                    int exponent = 0;
+                    for (; *e >= '0' && *e <= '9'; e++)
+                    {
+                        // Saturated: way past the range of doubles.
+                        exponent = std::min(exponent * 10 + (*e - '0'), 100000);
+                    }
+                    scale += negative_exponent ? -exponent : exponent;
+                    q = e;
+                }
+            }
+            value = scale < 0 ? mantissa / std::pow(10.0, -scale) : mantissa * std::pow(10.0, scale);
+            value = negative ? -value : value;
+            p = q;
+            return std::isfinite(value);
+        }
+
+        // One component of 'rgb(...)', followed by the separator: a number
+        // (0 to 255) or a percentage, clamped to that range.
+        bool parse_component(const char *&p, char separator, rgb_value &value)
+        {
+            double v;
+            if (!parse_number(p, v))
+            {
+                return false;
+            }
+            if (*p == '%')
+            {
+                v = v * 255 / 100;
+                p++;
+            }
+            v = std::round(v);
+            value = (rgb_value)(v < 0 ? 0 : v > 255 ? 255 : v);
+            while (is_space(*p))
+            {
+                p++;
+            }
+            if (*p != separator)
+            {
+                return false;
+            }
+            p++;
+            return true;
+        }
+
+        // 'rgb(r, g, b)', from after 'rgb(' up to end.
+        bool parse_rgb(const char *p, const char *end, Color &c)
+        {
+            if (!parse_component(p, ',', c.red) ||
+                !parse_component(p, ',', c.green) ||
+                !parse_component(p, ')', c.blue))
+            {
+                return false;
+            }
+            return p == end;
+        }
+
+        // Whether a color starts with 'rgb(', in any case (as CSS
+        // function names).
+        bool is_rgb_function(const char *p)
+        {
+            return (p[0] == 'r' || p[0] == 'R') && (p[1] == 'g' || p[1] == 'G') &&
+                   (p[2] == 'b' || p[2] == 'B') && p[3] == '(';
+        }
+
+        // A color keyword (in [begin, end[, in any case).
+        bool parse_name(const char *begin, const char *end, Color &c)
+        {
+            const size_t n = end - begin;
+            if (n == 0 || n > MAX_NAME_LENGTH)
+            {
+                return false;
+            }
+            char name[MAX_NAME_LENGTH + 1];
+            for (size_t i = 0; i < n; i++)
+            {
+                char ch = begin[i];
+                name[i] = ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch;
+            }
+            name[n] = 0;
+            unsigned char index = NAME_INDEX[slot(name, n)];
+            if (index == EMPTY || ::strcmp(NAMED_COLORS[index].name, name) != 0)
+            {
+                return false;
+            }
+            c = NAMED_COLORS[index].color;
+            return true;
+        }
+    }
+
+    Color parse_color(const char *str)
     {
+        if (str == nullptr)
+        {
+            throw std::runtime_error("Missing color");
+        }
+        const char *begin = str;
+        while (is_space(*begin))
+        {
+            begin++;
+        }
+        const char *end = begin + ::strlen(begin);
+        while (end > begin && is_space(end[-1]))
+        {
+            end--;
+        }
         Color c;
-        if (str.at(0) == '#')
+        bool ok;
+        if (*begin == '#')
         {
-            int v;
-            std::istringstream ss(str.substr(1));
-            ss >> std::hex >> v;
-            c.red = (v >> 16);
-            c.green = (v >> 8) & 0xFF;
-            c.blue = v & 0xFF;
+            ok = parse_hex(begin + 1, end, c);
+        }
+        else if (is_rgb_function(begin))
+        {
+            ok = parse_rgb(begin + 4, end, c);
         }
         else
         {
-            c = NAMES_TO_COLORS.at(str);
+            ok = parse_name(begin, end, c);
+        }
+        if (!ok)
+        {
+            invalid_color(str);
         }
         return c;
     }
-}
\ No newline at end of file
+
+    Color parse_color(const std::string &str)
+    {
+        return parse_color(str.c_str());
+    }
+}
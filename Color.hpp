@@ -17,10 +17,16 @@ namespace svg {
     rgb_value blue;
   };
 
-  //! Parse a color from a string.
-  //! The string may refer to a color name or have a
-  //! '#rrggbb' format where 'rr', 'gg' and 'bb' 
-  //! are hexadecimal values for each RGB component. 
+  //! Parse a color from a string, without allocating memory.
+  //! The string may be one of the 147 SVG color names (in any case),
+  //! or have a '#rrggbb' or '#rgb' format where 'rr', 'gg' and 'bb'
+  //! (or 'r', 'g' and 'b') are hexadecimal values for each RGB component,
+  //! or be 'rgb(r, g, b)' with components from 0 to 255 or percentages.
+  //! Throws std::runtime_error if the string is not a valid color.
+  //! @param str String (nullptr is invalid).
+  //! @return A corresponding color.
+  Color parse_color(const char *str);
+  //! Parse a color from a string (see above).
   //! @param str String.
   //! @return A corresponding color.
   Color parse_color(const std::string& str);
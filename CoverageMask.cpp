@@ -0,0 +1,61 @@
+//! @file CoverageMask.cpp
+#include "CoverageMask.hpp"
+
+#include <algorithm>
+
+namespace svg
+{
+    CoverageMask::CoverageMask()
+        : x0_(0), y0_(0), width_(0), height_(0), words_(0), painted_(0), skipped_(0)
+    {
+    }
+
+    void CoverageMask::reset(int x0, int y0, int x1, int y1)
+    {
+        x0_ = x0;
+        y0_ = y0;
+        width_ = std::max(x1 - x0, 0);
+        height_ = std::max(y1 - y0, 0);
+        words_ = (width_ + 63) / 64;
+        rows_.assign((size_t)words_ * height_, 0);
+        painted_ = 0;
+        skipped_ = 0;
+    }
+
+    bool CoverageMask::covered(int x0, int y0, int x1, int y1) const
+    {
+        x0 = std::max(x0, x0_) - x0_;
+        y0 = std::max(y0, y0_) - y0_;
+        x1 = std::min(x1, x0_ + width_ - 1) - x0_;
+        y1 = std::min(y1, y0_ + height_ - 1) - y0_;
+        if (x0 > x1 || y0 > y1)
+        {
+            return true;
+        }
+        for (int y = y0; y <= y1; y++)
+        {
+            const uint64_t *row = &rows_[(size_t)y * words_];
+            for (int w = x0 >> 6; w <= x1 >> 6; w++)
+            {
+                const int first = w == x0 >> 6 ? x0 & 63 : 0;
+                const int last = w == x1 >> 6 ? x1 & 63 : 63;
+                const uint64_t span = bits(first, last - first + 1);
+                if ((row[w] & span) != span)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool CoverageMask::full() const
+    {
+        return painted_ == (uint64_t)width_ * height_;
+    }
+
+    uint64_t CoverageMask::skipped() const
+    {
+        return skipped_;
+    }
+}
@@ -0,0 +1,112 @@
+//! @file CoverageMask.hpp
+#ifndef __svg_CoverageMask_hpp__
+#define __svg_CoverageMask_hpp__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace svg
+{
+    //! Set of the pixels of a rectangle painted so far, one bit per pixel,
+    //! for drawing opaque shapes front to back (see PNGImage::set_coverage()):
+    //! a pixel painted once is final, and later (i.e. hidden) writes to it
+    //! are skipped.
+    class CoverageMask
+    {
+    public:
+        //! Constructor of an empty mask (call reset() before use).
+        CoverageMask();
+        //! Move the mask to a rectangle, with no pixel painted.
+        //! @param x0 Left edge.
+        //! @param y0 Top edge.
+        //! @param x1 Right edge (exclusive).
+        //! @param y1 Bottom edge (exclusive).
+        void reset(int x0, int y0, int x1, int y1);
+        //! Paint a span of pixels: paint(from, to) is called for each run
+        //! of the span (from and to inclusive) not painted before, and
+        //! the span is marked as painted.
+        //! @param x_from First X position (inside the rectangle).
+        //! @param x_to Last X position (inside the rectangle, >= x_from).
+        //! @param y Y position (inside the rectangle).
+        //! @param paint Function painting a run.
+        template <typename Paint>
+        void cover(int x_from, int x_to, int y, Paint paint);
+        //! Check whether all pixels of a box are painted.
+        //! @param x0 Left edge (inclusive).
+        //! @param y0 Top edge (inclusive).
+        //! @param x1 Right edge (inclusive).
+        //! @param y1 Bottom edge (inclusive).
+        //! @return true if the part of the box inside the rectangle is
+        //! painted (or empty).
+        bool covered(int x0, int y0, int x1, int y1) const;
+        //! Check whether all pixels of the rectangle are painted.
+        //! @return true if so.
+        bool full() const;
+        //! Get the number of pixel writes skipped since the last reset().
+        //! @return Number of pixels of cover() spans painted before.
+        uint64_t skipped() const;
+
+    private:
+        //! Bits first to first + count - 1 of a word.
+        static uint64_t bits(int first, int count);
+
+        int x0_, y0_;
+        int width_, height_;
+        //! Words per row.
+        int words_;
+        //! Rows of bits, bit i of word w being pixel x0_ + 64 w + i.
+        std::vector<uint64_t> rows_;
+        //! Pixels painted.
+        uint64_t painted_;
+        uint64_t skipped_;
+    };
+
+    inline uint64_t CoverageMask::bits(int first, int count)
+    {
+        return (count == 64 ? ~0ull : (1ull << count) - 1) << first;
+    }
+
+    template <typename Paint>
+    void CoverageMask::cover(int x_from, int x_to, int y, Paint paint)
+    {
+        uint64_t *row = &rows_[(size_t)(y - y0_) * words_];
+        const int from = x_from - x0_;
+        const int to = x_to - x0_;
+        // Runs are collected across words, so that a run spanning
+        // several words is painted with one call.
+        int run_from = -1, run_to = 0;
+        for (int w = from >> 6; w <= to >> 6; w++)
+        {
+            const int first = w == from >> 6 ? from & 63 : 0;
+            const int last = w == to >> 6 ? to & 63 : 63;
+            const uint64_t span = bits(first, last - first + 1);
+            uint64_t fresh = span & ~row[w];
+            skipped_ += __builtin_popcountll(span & row[w]);
+            painted_ += __builtin_popcountll(fresh);
+            row[w] |= fresh;
+            while (fresh != 0)
+            {
+                int start = __builtin_ctzll(fresh);
+                uint64_t rest = ~(fresh >> start);
+                int count = rest == 0 ? 64 - start : __builtin_ctzll(rest);
+                fresh &= ~bits(start, count);
+                int a = (w << 6) + start;
+                if (run_from < 0 || a != run_to + 1)
+                {
+                    if (run_from >= 0)
+                    {
+                        paint(x0_ + run_from, x0_ + run_to);
+                    }
+                    run_from = a;
+                }
+                run_to = a + count - 1;
+            }
+        }
+        if (run_from >= 0)
+        {
+            paint(x0_ + run_from, x0_ + run_to);
+        }
+    }
+}
+#endif
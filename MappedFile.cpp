@@ -0,0 +1,61 @@
+//! @file MappedFile.cpp
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace svg
+{
+    MappedFile::MappedFile(const std::string &file_name)
+        : data_(nullptr), size_(0)
+    {
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Unable to load " + file_name);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            ::close(fd);
+            throw std::runtime_error("Unable to load " + file_name);
+        }
+        size_ = st.st_size;
+        if (size_ > 0)
+        {
+            void *p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("Unable to load " + file_name);
+            }
+            // The file is parsed front to back, once.
+            ::madvise(p, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char *>(p);
+        }
+        // The mapping stays valid after closing the descriptor.
+        ::close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (data_ != nullptr)
+        {
+            ::munmap(const_cast<char *>(data_), size_);
+        }
+    }
+
+    const char *MappedFile::data() const
+    {
+        return data_;
+    }
+
+    size_t MappedFile::size() const
+    {
+        return size_;
+    }
+}
@@ -0,0 +1,38 @@
+//! @file MappedFile.hpp
+#ifndef __svg_MappedFile_hpp__
+#define __svg_MappedFile_hpp__
+
+#include <cstddef>
+#include <string>
+
+namespace svg
+{
+    //! Read-only memory mapping of a whole file.
+    //! The pages are loaded (and may be dropped again) by the kernel
+    //! as they are read, so no heap buffer holds the file contents.
+    class MappedFile
+    {
+    public:
+        //! Constructor: maps the file. Throws if it cannot be read.
+        //! @param file_name File name.
+        explicit MappedFile(const std::string &file_name);
+        //! Destructor: unmaps the file.
+        ~MappedFile();
+        //! Get the file contents (not NUL-terminated).
+        //! @return Pointer to the first byte (nullptr for empty files).
+        const char *data() const;
+        //! Get the file size.
+        //! @return Number of bytes.
+        size_t size() const;
+
+    private:
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        //! Mapped contents.
+        const char *data_;
+        //! Size.
+        size_t size_;
+    };
+}
+#endif
@@ -1,19 +1,274 @@
 #include "PNGImage.hpp"
+#include "fill.hpp"
 
 #include <stdexcept>
 #include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <utility>
 
 #define STBI_ONLY_PNG
 #define STB_IMAGE_IMPLEMENTATION
 #include "external/stb/stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "external/stb/stb_image_write.h"
 
 namespace svg
 {
+    namespace
+    {
+        // Polygon edge for the scanline fill in draw_polygon().
+        // The intersection with the current scanline is the exact
+        // fraction num / den (den > 0), updated incrementally.
+        struct PolygonEdge
+        {
+            int y_top;
+            int y_bottom;
+            long long num;
+            long long den;
+            long long step;
+            int x;
+
+            // Intersection rounded half away from zero, like ::round().
+            int rounded_x() const
+            {
+                return num >= 0 ? (int)((2 * num + den) / (2 * den))
+                                : -(int)((-2 * num + den) / (2 * den));
+            }
+        };
+
+        // The channels of a color in the 16-bit lanes of a word.
+        inline uint64_t lanes(const Color &c)
+        {
+            return c.red | (uint64_t)c.green << 16 | (uint64_t)c.blue << 32;
+        }
+
+        // Blend a color (given by its lanes()) over a pixel, with alpha
+        // from 0 to 255 (keep = 255 - alpha): (c alpha + p keep + 127) / 255
+        // for each channel, all three at once. Each lane holds at most
+        // 255 * 255 + 128, and t / 255 rounded is (t + t / 256) / 256 for
+        // t + 128.
+        inline void blend_pixel(Color &p, uint64_t c, unsigned alpha, unsigned keep)
+        {
+            const uint64_t ones = 0x000100010001ull;
+            uint64_t t = c * alpha + lanes(p) * keep + 128 * ones;
+            t = (t + ((t >> 8) & (0xff * ones))) >> 8;
+            p.red = (rgb_value)t;
+            p.green = (rgb_value)(t >> 16);
+            p.blue = (rgb_value)(t >> 32);
+        }
+
+        // Floor of a value in the range of long long, without a call of
+        // ::floor() (x86-64 has no rounding instruction before SSE4.1).
+        inline long long floor_ll(double v)
+        {
+            const long long i = (long long)v;
+            return i - (i > v);
+        }
+
+        // The values of [lo, hi] inside [clip_lo, clip_hi[, or whose mirror
+        // image about 0 is, as a range [from, to]: false if there are none.
+        bool mirrored_range(long long lo, long long hi, long long clip_lo, long long clip_hi,
+                            long long &from, long long &to)
+        {
+            from = hi + 1;
+            to = lo - 1;
+            if (lo < clip_hi && hi >= clip_lo)
+            {
+                from = std::max(lo, clip_lo);
+                to = std::min(hi, clip_hi - 1);
+            }
+            if (lo <= -clip_lo && hi > -clip_hi)
+            {
+                from = std::min(from, std::max(lo, 1 - clip_hi));
+                to = std::max(to, std::min(hi, -clip_lo));
+            }
+            return from <= to;
+        }
+
+        // The pixels of an image, for loops that paint them one by one.
+        // Pixels are bytes, whose stores may alias anything: the members
+        // of the image would be reloaded after each one, where these
+        // copies stay in registers.
+        struct PixelTarget
+        {
+            Color *pixels;
+            ptrdiff_t width;
+            // First row stored.
+            ptrdiff_t top;
+            DrawStats *stats;
+            // Clip rectangle (upper bounds inclusive).
+            long long x0, y0, x1, y1;
+
+            // Fill a run of pixels of a row, clipped.
+            void fill(long long from, long long to, long long y, const Color &c) const
+            {
+                from = std::max(from, x0);
+                to = std::min(to, x1);
+                if (y < y0 || y > y1 || from > to)
+                {
+                    return;
+                }
+                Color *const run = pixels + (y - top) * width + from;
+                const size_t n = (size_t)(to - from + 1);
+                if (n < 32)
+                {
+                    // In place, as fill_pixels() would: the call would
+                    // spill the caller's state.
+                    for (size_t i = 0; i < n; i++)
+                    {
+                        run[i] = c;
+                    }
+                }
+                else
+                {
+                    fill_pixels(run, n, c);
+                }
+                count_span(stats, n);
+            }
+        };
+
+        // Row y >= 0 of an ellipse, from its center, and its image turned
+        // around the center (none for row 0): what is painted at x on the
+        // row is also painted at -x on its image.
+        class MirroredRow
+        {
+        public:
+            MirroredRow(const PixelTarget &target, long long cx, long long cy, long long y,
+                        const Color &paint, uint64_t color)
+                : target_(target), paint_(paint), color_(color), cx_(cx), y_(y),
+                  below_(cy + y), above_(cy - y),
+                  below_visible_(below_ >= target.y0 && below_ <= target.y1),
+                  above_visible_(y != 0 && above_ >= target.y0 && above_ <= target.y1),
+                  row_below_((below_ - target.top) * target.width + cx),
+                  row_above_((above_ - target.top) * target.width + cx),
+                  clip_left_(target.x0 - cx), clip_right_(target.x1 - cx)
+            {
+            }
+
+            // Fill the pixels from x = from to x = to.
+            void fill(long long from, long long to) const
+            {
+                target_.fill(cx_ + from, cx_ + to, below_, paint_);
+                if (y_ != 0)
+                {
+                    target_.fill(cx_ - to, cx_ - from, above_, paint_);
+                }
+            }
+
+            // Blend the pixel at x (alpha from 1 to 255).
+            void blend(long long x, int alpha) const
+            {
+                blend_at(below_visible_ && x >= clip_left_ && x <= clip_right_, row_below_ + x, alpha);
+                blend_at(above_visible_ && -x >= clip_left_ && -x <= clip_right_, row_above_ - x, alpha);
+            }
+
+        private:
+            void blend_at(bool visible, ptrdiff_t i, int alpha) const
+            {
+                if (visible)
+                {
+                    blend_pixel(target_.pixels[i], color_, alpha, 255 - alpha);
+                    count_span(target_.stats, 1);
+                }
+            }
+
+            const PixelTarget target_;
+            const Color paint_;
+            const uint64_t color_;
+            const long long cx_, y_, below_, above_;
+            const bool below_visible_, above_visible_;
+            // Pixel at x on the row is target_.pixels[row_below_ + x], and
+            // at -x on its image, target_.pixels[row_above_ - x].
+            const ptrdiff_t row_below_, row_above_;
+            // Clip rectangle, from the center.
+            const long long clip_left_, clip_right_;
+        };
+
+        // The inside of an ellipse centered on the origin, its radii
+        // rotated (clockwise, in degrees): A x^2 + B xy + C y^2 <= F.
+        // Quarter turns are exact, so that axis-aligned ellipses stay
+        // symmetric (B = 0).
+        struct Quadric
+        {
+            double A, B, C, F;
+        };
+
+        Quadric ellipse_quadric(const Point &radius, double degrees)
+        {
+            double c, s;
+            const double quarter_turns = degrees / 90.0;
+            if (quarter_turns == ::floor(quarter_turns))
+            {
+                const long long k = ((long long)quarter_turns % 4 + 4) % 4;
+                c = k == 0 ? 1 : k == 2 ? -1 : 0;
+                s = k == 1 ? 1 : k == 3 ? -1 : 0;
+            }
+            else
+            {
+                const double angle = degrees * M_PI / 180.0;
+                c = ::cos(angle);
+                s = ::sin(angle);
+            }
+            const double rx2 = (double)radius.x * radius.x;
+            const double ry2 = (double)radius.y * radius.y;
+            return {ry2 * c * c + rx2 * s * s, 2 * c * s * (ry2 - rx2),
+                    ry2 * s * s + rx2 * c * c, rx2 * ry2};
+        }
+
+        // The inside of the lines of one direction across an ellipse (given
+        // by its Quadric, turned around for horizontal lines): the line at
+        // v crosses it over [mid v - h, mid v + h], where
+        // h = sqrt(scale (extent2 - v^2)). Divisions are done once.
+        struct Chords
+        {
+            double mid, scale, extent2;
+
+            // Chords of the vertical lines.
+            static Chords vertical(const Quadric &q)
+            {
+                return {-q.B / (2 * q.C), q.F / (q.C * q.C), q.C};
+            }
+            // Chords of the horizontal lines.
+            static Chords horizontal(const Quadric &q)
+            {
+                return {-q.B / (2 * q.A), q.F / (q.A * q.A), q.A};
+            }
+            // Half-length of the chord at v (0 if the line misses).
+            double half(double v) const
+            {
+                const double d = extent2 - v * v;
+                return d > 0 ? ::sqrt(scale * d) : 0.0;
+            }
+            // Ends of the chord at v (lo > hi if the line misses).
+            void ends(double v, double &lo, double &hi) const
+            {
+                const double d = extent2 - v * v;
+                const double h = d > 0 ? ::sqrt(scale * d) : -INFINITY;
+                lo = mid * v - h;
+                hi = mid * v + h;
+            }
+        };
+
+        // Bytes of the owned pixel buffers, and their peak.
+        std::atomic<uint64_t> held_bytes(0);
+        std::atomic<uint64_t> peak_bytes(0);
+
+        void hold(size_t bytes)
+        {
+            uint64_t now = held_bytes += bytes;
+            uint64_t peak = peak_bytes;
+            while (now > peak && !peak_bytes.compare_exchange_weak(peak, now))
+            {
+            }
+        }
+        void release(size_t bytes)
+        {
+            held_bytes -= bytes;
+        }
+    }
+
     PNGImage::PNGImage(const std::string &png_file_name)
     {
         int dummy;
@@ -24,29 +279,176 @@ namespace svg
         {
             throw std::runtime_error(png_file_name + ": could not load image!");
         }
+        indices_ = nullptr;
+        owner_ = true;
+        coverage_ = nullptr;
+        stats_ = nullptr;
+        rasterizer_ = nullptr;
+        origin_y_ = 0;
+        rows_ = height_;
+        hold(buffer_bytes());
+        clip_x0_ = clip_y0_ = 0;
+        clip_x1_ = width_;
+        clip_y1_ = height_;
     }
     PNGImage::PNGImage(int w, int h)
+        : PNGImage(w, h, 0, h)
     {
-        assert(w > 0 && h > 0);
-        size_t sz = w * h * sizeof(Color);
-        pixels_ = (Color *)::stbi__malloc(sz);
+    }
+    PNGImage::PNGImage(PNGImage &parent, int x0, int y0, int x1, int y1)
+        : width_(parent.width_), height_(parent.height_),
+          pixels_(parent.pixels_), indices_(parent.indices_), palette_(parent.palette_),
+          white_(parent.white_), last_color_(parent.last_color_), last_index_(parent.last_index_),
+          origin_y_(parent.origin_y_), rows_(parent.rows_), owner_(false),
+          coverage_(nullptr), stats_(nullptr), rasterizer_(nullptr),
+          clip_x0_(std::max(x0, parent.clip_x0_)), clip_y0_(std::max(y0, parent.clip_y0_)),
+          clip_x1_(std::min(x1, parent.clip_x1_)), clip_y1_(std::min(y1, parent.clip_y1_))
+    {
+    }
+    PNGImage::PNGImage(int w, int h, int y0, int rows)
+        : width_(0), pixels_(nullptr), indices_(nullptr), rows_(0), owner_(true),
+          coverage_(nullptr), stats_(nullptr), rasterizer_(nullptr)
+    {
+        allocate(w, h, rows, nullptr);
+        move_band(y0);
+    }
+    PNGImage::PNGImage(int w, int h, std::shared_ptr<const Palette> palette)
+        : PNGImage(w, h, 0, h, std::move(palette))
+    {
+    }
+    PNGImage::PNGImage(int w, int h, int y0, int rows, std::shared_ptr<const Palette> palette)
+        : width_(0), pixels_(nullptr), indices_(nullptr), rows_(0), owner_(true),
+          coverage_(nullptr), stats_(nullptr), rasterizer_(nullptr)
+    {
+        allocate(w, h, rows, std::move(palette));
+        move_band(y0);
+    }
+    void PNGImage::allocate(int w, int h, int rows, std::shared_ptr<const Palette> palette)
+    {
+        assert(w > 0 && h > 0 && rows > 0);
+        assert(owner_);
+        unsigned char white = 0;
+        if (palette != nullptr)
+        {
+            int i = palette->index(Color{255, 255, 255});
+            if (i < 0)
+            {
+                throw std::runtime_error("The palette of an image must contain white");
+            }
+            white = (unsigned char)i;
+        }
+        // size_t arithmetic: large images have more than 2^31 bytes.
+        size_t sz = (size_t)w * rows * (palette != nullptr ? 1 : sizeof(Color));
+        void *buffer = pixels_ != nullptr ? (void *)pixels_ : (void *)indices_;
+        if (buffer == nullptr || sz != buffer_bytes())
+        {
+            stbi_image_free(buffer);
+            release(buffer_bytes());
+            pixels_ = nullptr;
+            indices_ = nullptr;
+            width_ = rows_ = 0;
+            buffer = ::stbi__malloc(sz);
+            if (buffer == nullptr)
+            {
+                throw std::runtime_error("Unable to allocate a " + std::to_string(w) + "x" +
+                                         std::to_string(rows) + " image");
+            }
+            hold(sz);
+        }
+        pixels_ = palette == nullptr ? (Color *)buffer : nullptr;
+        indices_ = palette != nullptr ? (unsigned char *)buffer : nullptr;
+        palette_ = std::move(palette);
+        white_ = last_index_ = white;
+        last_color_ = Color{255, 255, 255};
         width_ = w;
         height_ = h;
-        ::memset(pixels_, 0xFF, sz);
+        rows_ = rows;
+    }
+    size_t PNGImage::buffer_bytes() const
+    {
+        return (size_t)width_ * rows_ * (indices_ != nullptr ? 1 : sizeof(Color));
+    }
+    void PNGImage::move_band(int y0)
+    {
+        assert(owner_);
+        origin_y_ = y0;
+        clip_x0_ = 0;
+        clip_x1_ = width_;
+        clip_y0_ = y0;
+        clip_y1_ = std::min(y0 + rows_, height_);
+        if (indices_ != nullptr)
+        {
+            ::memset(indices_, white_, buffer_bytes());
+        }
+        else
+        {
+            ::memset(pixels_, 0xFF, buffer_bytes());
+        }
+    }
+    void PNGImage::reset(int w, int h)
+    {
+        allocate(w, h, h, nullptr);
+        move_band(0);
+    }
+    void PNGImage::reset(int w, int h, std::shared_ptr<const Palette> palette)
+    {
+        allocate(w, h, h, std::move(palette));
+        move_band(0);
+    }
+    void PNGImage::clear(const Color &background)
+    {
+        if (clip_x0_ == 0 && clip_x1_ == width_)
+        {
+            // Whole rows: a single contiguous run.
+            size_t n = (size_t)(clip_y1_ - clip_y0_) * width_;
+            if (indices_ != nullptr)
+            {
+                ::memset(index(0, clip_y0_), index_of(background), n);
+            }
+            else
+            {
+                fill_pixels(pixel(0, clip_y0_), n, background);
+            }
+            return;
+        }
+        for (int y = clip_y0_; y < clip_y1_; y++)
+        {
+            fill_span(clip_x0_, clip_x1_ - 1, y, background);
+        }
     }
     void PNGImage::save(const std::string &png_file_name) const
     {
-        ::stbi_write_png(png_file_name.c_str(),
-                         width_,
-                         height_,
-                         3,
-                         pixels_,
-                         width_ * 3);
+        save(png_file_name, PNGOptions());
+    }
+
+    void PNGImage::save(const std::string &png_file_name, const PNGOptions &options) const
+    {
+        assert(origin_y_ == 0 && rows_ == height_);
+        if (indices_ != nullptr)
+        {
+            write_png(png_file_name, indices_, width_, height_, palette_->colors(), options);
+            return;
+        }
+        write_png(png_file_name,
+                  reinterpret_cast<const unsigned char *>(pixels_),
+                  width_,
+                  height_,
+                  options);
+    }
+
+    void PNGImage::write_rows(PNGWriter &writer) const
+    {
+        writer.write_rows(indices_ != nullptr ? indices_ : reinterpret_cast<const unsigned char *>(pixels_),
+                          band_bottom() - band_top());
     }
 
     PNGImage::~PNGImage()
     {
-        stbi_image_free(pixels_);
+        if (owner_)
+        {
+            stbi_image_free(pixels_ != nullptr ? (void *)pixels_ : (void *)indices_);
+            release(buffer_bytes());
+        }
     }
 
     int PNGImage::width() const
@@ -57,155 +459,925 @@ namespace svg
     {
         return height_;
     }
+    int PNGImage::band_top() const
+    {
+        return origin_y_;
+    }
+    int PNGImage::band_bottom() const
+    {
+        return std::min(origin_y_ + rows_, height_);
+    }
+    const Palette *PNGImage::palette() const
+    {
+        return palette_.get();
+    }
+    Color *PNGImage::pixel(int x, int y) const
+    {
+        return pixels_ + (size_t)(y - origin_y_) * width_ + x;
+    }
+    unsigned char *PNGImage::index(int x, int y) const
+    {
+        return indices_ + (size_t)(y - origin_y_) * width_ + x;
+    }
+    unsigned char PNGImage::index_of(const Color &c)
+    {
+        if (c.red != last_color_.red || c.green != last_color_.green || c.blue != last_color_.blue)
+        {
+            int i = palette_->index(c);
+            // Every color drawn must be in the palette.
+            assert(i >= 0);
+            last_color_ = c;
+            last_index_ = (unsigned char)std::max(i, 0);
+        }
+        return last_index_;
+    }
     Color &PNGImage::at(int x, int y)
     {
+        assert(indices_ == nullptr);
         assert(x >= 0 && x < width_);
-        assert(y >= 0 && y < height_);
-        return pixels_[y * width_ + x];
+        assert(y >= band_top() && y < band_bottom());
+        return *pixel(x, y);
     }
     Color PNGImage::at(int x, int y) const
     {
         assert(x >= 0 && x < width_);
-        assert(y >= 0 && y < height_);
-        return pixels_[y * width_ + x];
+        assert(y >= band_top() && y < band_bottom());
+        if (indices_ != nullptr)
+        {
+            return palette_->colors()[*index(x, y)];
+        }
+        return *pixel(x, y);
+    }
+    const Color *PNGImage::row(int y) const
+    {
+        assert(indices_ == nullptr);
+        assert(y >= band_top() && y < band_bottom());
+        return pixel(0, y);
+    }
+    void PNGImage::set_coverage(CoverageMask *coverage)
+    {
+        coverage_ = coverage;
+    }
+    void PNGImage::set_antialias(AreaRasterizer *rasterizer)
+    {
+        assert(rasterizer == nullptr || (indices_ == nullptr && coverage_ == nullptr));
+        rasterizer_ = rasterizer;
+    }
+    void PNGImage::set_stats(DrawStats *stats)
+    {
+        stats_ = stats;
+    }
+    uint64_t PNGImage::framebuffer_bytes()
+    {
+        return held_bytes;
+    }
+    uint64_t PNGImage::peak_framebuffer_bytes()
+    {
+        return peak_bytes;
+    }
+    void PNGImage::reset_peak_framebuffer_bytes()
+    {
+        peak_bytes = held_bytes.load();
+    }
+    void PNGImage::set_pixels(int x_from, int x_to, int y, const Color &c)
+    {
+        if (indices_ != nullptr)
+        {
+            ::memset(index(x_from, y), index_of(c), x_to - x_from + 1);
+        }
+        else
+        {
+            fill_pixels(pixel(x_from, y), x_to - x_from + 1, c);
+        }
+        count_span(stats_, x_to - x_from + 1);
+    }
+    void PNGImage::set_pixels(int x, int y, const Color *colors, int count)
+    {
+        if (indices_ != nullptr)
+        {
+            unsigned char *out = index(x, y);
+            for (int i = 0; i < count; i++)
+            {
+                out[i] = index_of(colors[i]);
+            }
+        }
+        else
+        {
+            ::memcpy(pixel(x, y), colors, count * sizeof(Color));
+        }
+        count_span(stats_, count);
+    }
+    void PNGImage::blend_pixels(int x_from, int x_to, int y, const Color &c, int alpha)
+    {
+        if (alpha >= 255)
+        {
+            set_pixels(x_from, x_to, y, c);
+            return;
+        }
+        const int keep = 255 - alpha;
+        const uint64_t color = lanes(c);
+        Color *p = pixel(x_from, y);
+        for (int x = x_from; x <= x_to; x++, p++)
+        {
+            blend_pixel(*p, color, alpha, keep);
+        }
+        count_span(stats_, x_to - x_from + 1);
+    }
+    void PNGImage::fill_coverage(const Color &c, bool even_odd)
+    {
+        const uint64_t color = lanes(c);
+        const PixelTarget target = {pixels_, width_, origin_y_, stats_, clip_x0_, clip_y0_, clip_x1_ - 1, clip_y1_ - 1};
+        rasterizer_->sweep(even_odd, [&, color, target](int x_from, int x_to, int y, int alpha)
+                           {
+                               // Most runs are single edge pixels.
+                               if (x_from == x_to && alpha < 255)
+                               {
+                                   blend_pixel(target.pixels[(y - target.top) * target.width + x_from], color, alpha, 255 - alpha);
+                                   count_span(target.stats, 1);
+                                   return;
+                               }
+                               blend_pixels(x_from, x_to, y, c, alpha); });
+    }
+    void PNGImage::plot(int x, int y, const Color &c)
+    {
+        if (x >= clip_x0_ && x < clip_x1_ && y >= clip_y0_ && y < clip_y1_)
+        {
+            if (coverage_ != nullptr)
+            {
+                coverage_->cover(x, x, y, [&](int, int)
+                                 { set_pixels(x, x, y, c); });
+                return;
+            }
+            if (indices_ != nullptr)
+            {
+                *index(x, y) = index_of(c);
+            }
+            else
+            {
+                *pixel(x, y) = c;
+            }
+            count_span(stats_, 1);
+        }
+    }
+    void PNGImage::fill_span(int x_from, int x_to, int y, const Color &c)
+    {
+        if (y < clip_y0_ || y >= clip_y1_)
+        {
+            return;
+        }
+        if (x_from > x_to)
+        {
+            std::swap(x_from, x_to);
+        }
+        x_from = std::max(x_from, clip_x0_);
+        x_to = std::min(x_to, clip_x1_ - 1);
+        if (x_from > x_to)
+        {
+            return;
+        }
+        if (coverage_ != nullptr)
+        {
+            coverage_->cover(x_from, x_to, y, [&](int a, int b)
+                             { set_pixels(a, b, y, c); });
+            return;
+        }
+        set_pixels(x_from, x_to, y, c);
+    }
+    void PNGImage::copy_span(int x, int y, const Color *colors, int count)
+    {
+        if (y < clip_y0_ || y >= clip_y1_)
+        {
+            return;
+        }
+        int x_from = std::max(x, clip_x0_);
+        int x_to = std::min(x + count, clip_x1_);
+        if (x_from >= x_to)
+        {
+            return;
+        }
+        if (coverage_ != nullptr)
+        {
+            coverage_->cover(x_from, x_to - 1, y, [&](int a, int b)
+                             { set_pixels(a, y, colors + (a - x), b - a + 1); });
+            return;
+        }
+        set_pixels(x_from, y, colors + (x_from - x), x_to - x_from);
+    }
+    bool PNGImage::overlaps(const Point &top_left, const Point &bottom_right) const
+    {
+        return top_left.x < clip_x1_ && bottom_right.x >= clip_x0_ &&
+               top_left.y < clip_y1_ && bottom_right.y >= clip_y0_;
     }
     void PNGImage::draw_line(const Point &a, const Point &b, const Color &c)
     {
-        //  Bresenham Algorithm.
-        int x_from = a.x;
-        int y_from = a.y;
-        int x_to = b.x;
-        int y_to = b.y;
-        int dy = y_to - y_from;
-        int dx = x_to - x_from;
-        int step_x = 1, step_y = 1;
-        if (dy < 0)
+        //  Bresenham Algorithm, along the major axis u (x or y) with the
+        //  minor axis v stepping when the error term allows.
+        if (!overlaps({std::min(a.x, b.x), std::min(a.y, b.y)}, {std::max(a.x, b.x), std::max(a.y, b.y)}))
         {
-            dy = -dy;
-            step_y = -1;
+            return;
         }
-        if (dx < 0)
+        if (rasterizer_ != nullptr)
         {
-            dx = -dx;
-            step_x = -1;
+            draw_line_antialiased(a, b, c);
+            return;
         }
-        dy *= 2;
-        dx *= 2;
-        at(x_from, y_from) = c;
-        if (dx > dy)
+        long long dx = (long long)b.x - a.x;
+        long long dy = (long long)b.y - a.y;
+        const int step_x = dx < 0 ? -1 : 1;
+        const int step_y = dy < 0 ? -1 : 1;
+        dx = std::abs(dx) * 2;
+        dy = std::abs(dy) * 2;
+        const bool x_major = dx > dy;
+        const long long du = x_major ? dx : dy;
+        const long long dv = x_major ? dy : dx;
+        const int su = x_major ? step_x : step_y;
+        const int sv = x_major ? step_y : step_x;
+        const long long u0 = x_major ? a.x : a.y;
+        const long long v0 = x_major ? a.y : a.x;
+        // Clip rectangle, in (u, v) coordinates (upper bounds inclusive).
+        const long long u_lo = x_major ? clip_x0_ : clip_y0_;
+        const long long u_hi = (x_major ? clip_x1_ : clip_y1_) - 1;
+        const long long v_lo = x_major ? clip_y0_ : clip_x0_;
+        const long long v_hi = (x_major ? clip_y1_ : clip_x1_) - 1;
+
+        // Step i plots (u0 + su i, v0 + sv k(i)), where k(i), the number of
+        // minor steps so far, has a closed form. Like Liang-Barsky with
+        // the line parameter, the range of steps inside the rectangle is
+        // clipped against each of its edges, and drawing starts there
+        // with the error term the whole line would have at that step.
+        const long long f0 = dv - du / 2;
+        auto minor_steps = [&](long long i) -> long long
         {
-            int fraction = dy - (dx / 2);
-            while (x_from != x_to)
+            if (i == 0)
             {
-                if (fraction >= 0)
+                return 0;
+            }
+            long long t = f0 + (i - 1) * dv;
+            long long q = t / du;
+            return (t % du != 0 && t < 0 ? q - 1 : q) + 1;
+        };
+        long long first = 0, last = du / 2;
+        // Major axis edges.
+        first = std::max(first, su > 0 ? u_lo - u0 : u0 - u_hi);
+        last = std::min(last, su > 0 ? u_hi - u0 : u0 - u_lo);
+        if (first > last)
+        {
+            return;
+        }
+        // Minor axis edges: k(i) is non-decreasing, so the steps with
+        // k_lo <= k(i) <= k_hi are found by binary search.
+        const long long k_lo = sv > 0 ? v_lo - v0 : v0 - v_hi;
+        const long long k_hi = sv > 0 ? v_hi - v0 : v0 - v_lo;
+        if (minor_steps(first) < k_lo)
+        {
+            long long lo = first, hi = last + 1;
+            while (lo < hi)
+            {
+                long long mid = lo + (hi - lo) / 2;
+                if (minor_steps(mid) < k_lo)
+                {
+                    lo = mid + 1;
+                }
+                else
                 {
-                    y_from += step_y;
-                    fraction -= dx;
+                    hi = mid;
                 }
-                x_from += step_x;
-                fraction += dy;
-                at(x_from, y_from) = c;
             }
+            first = lo;
         }
-        else
+        if (first > last)
         {
-            int fraction = dx - (dy >> 1);
-            while (y_from != y_to)
+            return;
+        }
+        if (minor_steps(last) > k_hi)
+        {
+            long long lo = first - 1, hi = last;
+            while (lo < hi)
             {
-                if (fraction >= 0)
+                long long mid = hi - (hi - lo) / 2;
+                if (minor_steps(mid) > k_hi)
                 {
-                    x_from += step_x;
-                    fraction -= dy;
+                    hi = mid - 1;
+                }
+                else
+                {
+                    lo = mid;
                 }
-                y_from += step_y;
-                fraction += dx;
-                at(x_from, y_from) = c;
+            }
+            last = lo;
+        }
+        if (first > last)
+        {
+            return;
+        }
+
+        const long long k = minor_steps(first);
+        int u = (int)(u0 + su * first);
+        int v = (int)(v0 + sv * k);
+        long long fraction = f0 + first * dv - k * du;
+        int &x = x_major ? u : v;
+        int &y = x_major ? v : u;
+        plot(x, y, c);
+        for (long long i = first; i < last; i++)
+        {
+            if (fraction >= 0)
+            {
+                v += sv;
+                fraction -= du;
+            }
+            u += su;
+            fraction += dv;
+            plot(x, y, c);
+        }
+    }
+
+    void PNGImage::draw_line_antialiased(const Point &a, const Point &b, const Color &c)
+    {
+        // Xiaolin Wu's algorithm: at each step along the major axis u,
+        // the line covers a one pixel wide band around its exact v, split
+        // between the two pixels it overlaps. The endpoints lie on pixel
+        // centers, so they are drawn fully, as by Bresenham.
+        const bool x_major = std::abs((long long)b.x - a.x) >= std::abs((long long)b.y - a.y);
+        long long u0 = x_major ? a.x : a.y, v0 = x_major ? a.y : a.x;
+        long long u1 = x_major ? b.x : b.y, v1 = x_major ? b.y : b.x;
+        if (u0 > u1)
+        {
+            std::swap(u0, u1);
+            std::swap(v0, v1);
+        }
+        const double slope = u1 == u0 ? 0 : (double)(v1 - v0) / (u1 - u0);
+        // Steps inside the clip rectangle along u, and within a pixel
+        // of it along v.
+        double first = std::max<double>(u0, x_major ? clip_x0_ : clip_y0_);
+        double last = std::min<double>(u1, (x_major ? clip_x1_ : clip_y1_) - 1);
+        if (slope != 0)
+        {
+            const double v_lo = (x_major ? clip_y0_ : clip_x0_) - 1;
+            const double v_hi = x_major ? clip_y1_ : clip_x1_;
+            double ua = u0 + (v_lo - v0) / slope, ub = u0 + (v_hi - v0) / slope;
+            if (ua > ub)
+            {
+                std::swap(ua, ub);
+            }
+            first = std::max(first, ::floor(ua));
+            last = std::min(last, ::ceil(ub));
+        }
+        if (first > last)
+        {
+            return;
+        }
+        // Steps along u stay inside the clip rectangle: only v is checked.
+        const int v_min = x_major ? clip_y0_ : clip_x0_, v_max = x_major ? clip_y1_ : clip_x1_;
+        if (slope == 0 && (v0 < v_min || v0 >= v_max))
+        {
+            return;
+        }
+        // Pixel (u, v) is pixels[offset + u u_step + v v_step]. The loop
+        // only uses copies of the members (see PixelTarget).
+        const ptrdiff_t u_step = x_major ? 1 : width_, v_step = x_major ? width_ : 1;
+        const ptrdiff_t offset = -(ptrdiff_t)origin_y_ * width_;
+        Color *const pixels = pixels_;
+        const uint64_t color = lanes(c);
+        DrawStats *const stats = stats_;
+        // v + 4, in 32.32 fixed point (v >= v_min - 2 >= -2). It is
+        // computed from the start of the line at each step rather than
+        // stepped from the first one drawn, so that the line comes out
+        // the same whatever the clip rectangle (as in tiles).
+        const double scale = 4294967296.0;
+        for (long long u = (long long)first; u <= (long long)last; u++)
+        {
+            const uint64_t v = (uint64_t)((v0 + (u - u0) * slope + 4) * scale + 0.5);
+            const int vi = (int)(v >> 32) - 4;
+            const int alpha = (int)(((v & 0xffffffff) * 255 + 0x80000000) >> 32);
+            const ptrdiff_t i = offset + u * u_step + vi * v_step;
+            if (vi >= v_min && vi < v_max && alpha < 255)
+            {
+                blend_pixel(pixels[i], color, 255 - alpha, alpha);
+                count_span(stats, 1);
+            }
+            if (vi + 1 >= v_min && vi + 1 < v_max && alpha > 0)
+            {
+                blend_pixel(pixels[i + v_step], color, alpha, 255 - alpha);
+                count_span(stats, 1);
             }
         }
     }
 
     void PNGImage::draw_polygon(const std::vector<Point> &points, const Color &c)
     {
-        int x_min = width(), x_max = 0, y_min = height(), y_max = 0;
-        for (const Point &p : points)
+        draw_polygon(points.data(), points.size(), c);
+    }
+
+    void PNGImage::draw_polygon(const Point *points, size_t count, const Color &c)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        Point top_left = points[0], bottom_right = points[0];
+        for (size_t i = 0; i < count; i++)
+        {
+            const Point &p = points[i];
+            top_left.x = std::min(top_left.x, p.x);
+            top_left.y = std::min(top_left.y, p.y);
+            bottom_right.x = std::max(bottom_right.x, p.x);
+            bottom_right.y = std::max(bottom_right.y, p.y);
+        }
+        if (!overlaps(top_left, bottom_right))
         {
-            x_min = std::min(x_min, p.x);
-            x_max = std::max(x_max, p.x);
-            y_min = std::min(y_min, p.y);
-            y_max = std::max(y_max, p.y);
+            return;
         }
+        if (rasterizer_ != nullptr)
+        {
+            // The exact area of the polygon (even-odd, as below).
+            rasterizer_->reset(std::max(top_left.x, clip_x0_), std::max(top_left.y, clip_y0_),
+                               std::min(bottom_right.x + 1, clip_x1_), std::min(bottom_right.y + 1, clip_y1_));
+            for (size_t i = 0; i < count; i++)
+            {
+                const Point &a = points[i];
+                const Point &b = points[(i + 1) % count];
+                rasterizer_->add_edge(a.x, a.y, b.x, b.y);
+            }
+            fill_coverage(c, true);
+            return;
+        }
+        int y_min = top_left.y, y_max = bottom_right.y;
+        // Only scanlines inside the clip rectangle can produce pixels.
+        y_min = std::max(y_min, clip_y0_);
+        y_max = std::min(y_max, clip_y1_);
 
-        std::vector<double> seg;
+        // Edge table, sorted by the first scanline each edge crosses.
+        // Horizontal edges never intersect a scanline and are left out.
+        std::vector<PolygonEdge> edges;
+        edges.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            Point a = points[i];
+            Point b = points[(i + 1) % count];
+            if (a.y == b.y)
+            {
+                continue;
+            }
+            if (a.y > b.y)
+            {
+                std::swap(a, b);
+            }
+            PolygonEdge e;
+            e.y_top = a.y;
+            e.y_bottom = b.y;
+            e.den = b.y - a.y;
+            e.step = b.x - a.x;
+            e.num = (long long)a.x * e.den;
+            e.x = a.x;
+            edges.push_back(e);
+        }
+        std::sort(edges.begin(), edges.end(),
+                  [](const PolygonEdge &l, const PolygonEdge &r)
+                  { return l.y_top < r.y_top; });
+
+        // Active edge list: edges crossing the current scanline,
+        // kept sorted by their (rounded) intersection.
+        std::vector<PolygonEdge *> active;
+        size_t next_edge = 0;
         for (int y = y_min; y < y_max; y++)
         {
-            for (size_t i = 0; i < points.size(); i++)
+            // Edges cross scanlines y_top to y_bottom, both inclusive.
+            size_t n = 0;
+            for (PolygonEdge *e : active)
             {
-                Point a = points[i];
-                Point b = points[(i + 1) % points.size()];
-                if (y < std::min(a.y, b.y) || y > std::max(a.y, b.y))
+                if (e->y_bottom >= y)
+                {
+                    e->num += e->step;
+                    active[n++] = e;
+                }
+            }
+            active.resize(n);
+            for (; next_edge < edges.size() && edges[next_edge].y_top <= y; next_edge++)
+            {
+                PolygonEdge &e = edges[next_edge];
+                if (e.y_bottom < y)
                 {
                     continue;
                 }
-                if (a.y != b.y)
+                e.num += (long long)(y - e.y_top) * e.step;
+                active.push_back(&e);
+            }
+            for (PolygonEdge *e : active)
+            {
+                e->x = e->rounded_x();
+            }
+            // Insertion sort: the order barely changes between scanlines.
+            for (size_t i = 1; i < active.size(); i++)
+            {
+                PolygonEdge *e = active[i];
+                size_t j = i;
+                for (; j > 0 && active[j - 1]->x > e->x; j--)
                 {
-                    double x_inters = (double)(y - a.y) * (b.x - a.x) / (double)(b.y - a.y) + a.x;
-                    seg.push_back(x_inters);
+                    active[j] = active[j - 1];
                 }
+                active[j] = e;
             }
-            std::sort(seg.begin(), seg.end());
             size_t i_s = 0;
-            while ((i_s + 1) < seg.size())
+            while ((i_s + 1) < active.size())
             {
-                Point a = {(int)round(seg.at(i_s)), y};
-                Point b = {(int)round(seg.at(i_s + 1)), y};
-                if (a.x == b.x)
+                int a = active[i_s]->x;
+                int b = active[i_s + 1]->x;
+                if (a == b)
                 {
                     i_s++;
                 }
                 else
                 {
-                    draw_line(a, b, c);
+                    fill_span(a, b, y, c);
                     i_s += 2;
                 }
             }
-            seg.clear();
         }
-        for (size_t i = 0; i < points.size(); i++)
+        for (size_t i = 0; i < count; i++)
         {
-            draw_line(points[i], points[(i + 1) % points.size()], c);
+            draw_line(points[i], points[(i + 1) % count], c);
         }
     }
 
     void PNGImage::draw_ellipse(const Point &center, const Point &radius, const Color &fill)
     {
-        draw_line(center.translate({-radius.x, 0}),
-                  center.translate({+radius.x, 0}),
-                  fill);
-        int x0 = radius.x;
-        int dx = 0;
-        for (int y = 1; y <= radius.y; y++)
+        // Row y (relative to the center) spans [-x, x], x being the largest
+        // value with x^2 ry^2 + y^2 rx^2 <= rx^2 ry^2, decided exactly with
+        // the integer error term. Only the rows inside the clip rectangle
+        // are visited.
+        if (radius.y < 0)
+        {
+            fill_span(center.x - radius.x, center.x + radius.x, center.y, fill);
+            return;
+        }
+        if (rasterizer_ != nullptr && radius.x > 0 && radius.y > 0)
+        {
+            draw_ellipse_antialiased(center, radius, 0, fill);
+            return;
+        }
+        if (!overlaps({center.x - std::abs(radius.x), center.y - radius.y},
+                      {center.x + std::abs(radius.x), center.y + radius.y}))
+        {
+            return;
+        }
+        const long long rx2 = (long long)radius.x * radius.x;
+        const long long ry2 = (long long)radius.y * radius.y;
+        // x^2 ry^2 + y^2 rx^2 - rx^2 ry^2.
+        auto error = [&](long long x, long long y)
+        { return x * x * ry2 + y * y * rx2 - rx2 * ry2; };
+        auto inside = [&](int x, int y)
+        {
+            long long e = error(x, y);
+            if (e == 0)
+            {
+                // Exactly on the boundary: settle it as the
+                // floating point test (x/rx)^2 + (y/ry)^2 <= 1 did.
+                double vx = (double)x / radius.x;
+                double vy = (double)y / radius.y;
+                return vx * vx + vy * vy <= 1;
+            }
+            return e < 0;
+        };
+        // Rows below (center.y + y) and above (center.y - y) the center
+        // that lie inside the clip rectangle. Both halves share |y|, so
+        // each half-width is found once.
+        const int below_from = std::max(0, clip_y0_ - center.y);
+        const int below_to = std::min(radius.y, clip_y1_ - 1 - center.y);
+        const int above_from = std::max(1, center.y - (clip_y1_ - 1));
+        const int above_to = std::min(radius.y, center.y - clip_y0_);
+        int y_from = radius.y + 1, y_to = -1;
+        if (below_from <= below_to)
+        {
+            y_from = below_from;
+            y_to = below_to;
+        }
+        if (above_from <= above_to)
+        {
+            y_from = std::min(y_from, above_from);
+            y_to = std::max(y_to, above_to);
+        }
+        // The half-width shrinks as |y| grows: the first row is estimated
+        // in floating point and settled exactly, the others step down
+        // from the row before.
+        int x = radius.x;
+        if (y_from > 0 && radius.x > 0)
+        {
+            double t = 1.0 - ((double)y_from / radius.y) * ((double)y_from / radius.y);
+            x = (int)std::min<double>(radius.x, ::floor(radius.x * ::sqrt(std::max(t, 0.0))));
+            x = std::max(x, 0);
+            while (x < radius.x && inside(x + 1, y_from))
+            {
+                x++;
+            }
+        }
+        for (int y = y_from; y <= y_to; y++)
+        {
+            while (y > 0 && x > 0 && !inside(x, y))
+            {
+                x--;
+            }
+            if (y >= below_from && y <= below_to)
+            {
+                fill_span(center.x - x, center.x + x, center.y + y, fill);
+            }
+            if (y >= above_from && y <= above_to)
+            {
+                fill_span(center.x - x, center.x + x, center.y - y, fill);
+            }
+        }
+    }
+
+    void PNGImage::draw_ellipse(const Point &center, const Point &radius, double degrees, const Color &fill)
+    {
+        if (rasterizer_ != nullptr && radius.x > 0 && radius.y > 0)
+        {
+            draw_ellipse_antialiased(center, radius, degrees, fill);
+            return;
+        }
+        double quarter_turns = degrees / 90.0;
+        if (radius.x == radius.y || quarter_turns == ::floor(quarter_turns))
+        {
+            // Rotation by a multiple of 90 degrees (or of a circle)
+            // maps the ellipse onto an axis-aligned one.
+            long long k = ((long long)quarter_turns % 4 + 4) % 4;
+            Point r = k % 2 == 0 || radius.x == radius.y ? radius : Point{radius.y, radius.x};
+            draw_ellipse(center, r, fill);
+            return;
+        }
+        // Point (x, y) relative to the center is inside when
+        // A x^2 + B xy + C y^2 <= F.
+        const Quadric q = ellipse_quadric(radius, degrees);
+        // Rows where the quadratic in x has real roots.
+        int y_ext = (int)::floor(::sqrt(q.A));
+        int y_from = std::max(-y_ext, clip_y0_ - center.y);
+        int y_to = std::min(y_ext, clip_y1_ - 1 - center.y);
+        for (int y = y_from; y <= y_to; y++)
+        {
+            double d = q.B * q.B * y * y - 4 * q.A * (q.C * y * y - q.F);
+            if (d < 0)
+            {
+                continue;
+            }
+            double sq = ::sqrt(d);
+            int x_from = (int)::ceil((-q.B * y - sq) / (2 * q.A));
+            int x_to = (int)::floor((-q.B * y + sq) / (2 * q.A));
+            if (x_from <= x_to)
+            {
+                fill_span(center.x + x_from, center.x + x_to, center.y + y, fill);
+            }
+        }
+    }
+    void PNGImage::draw_ellipse_antialiased(const Point &center, const Point &radius, double degrees, const Color &fill)
+    {
+        const Quadric q = ellipse_quadric(radius, degrees);
+        // Half-size of the ellipse, and height of its leftmost point (the
+        // rightmost one being opposite).
+        const double x_ext = ::sqrt(q.C), y_ext = ::sqrt(q.A), y_left = q.B / (2 * x_ext);
+        const bool aligned = q.B == 0;
+        const Chords columns = Chords::vertical(q), lines = Chords::horizontal(q);
+        // The ellipse is symmetric about its center, the center of a pixel:
+        // the rows from the center down are computed, and painted turned
+        // around the center too (see MirroredRow). Row y spans
+        // [y - 1/2, y + 1/2], and the area of each of its pixels is the
+        // integral of the inside height over its width: exact at the pixel
+        // sides and where the row's sides cross the ellipse, linear in
+        // between (curves are nearly straight across a pixel).
+        long long y_from, y_to, x_from, x_to;
+        if (!mirrored_range(0, -floor_ll(-0.5 - y_ext) - 1, (long long)clip_y0_ - center.y,
+                            (long long)clip_y1_ - center.y, y_from, y_to) ||
+            !mirrored_range(aligned ? 0 : floor_ll(0.5 - x_ext), floor_ll(x_ext + 0.5),
+                            (long long)clip_x0_ - center.x, (long long)clip_x1_ - center.x, x_from, x_to))
+        {
+            return;
+        }
+        const PixelTarget target = {pixels_, width_, origin_y_, stats_, clip_x0_, clip_y0_, clip_x1_ - 1, clip_y1_ - 1};
+        const uint64_t color = lanes(fill);
+        if (aligned)
+        {
+            // Also symmetric about the axes: the quarter right of and below
+            // the center is computed (row 0 and column 0 being cut at the
+            // center), each pixel painted at x and -x. Row y crosses the
+            // ellipse from x_bottom on its bottom side to x_top on its top
+            // one, in between being under the ellipse: each crossing with
+            // the pixel sides is only computed once.
+            double x_top = lines.half(std::max(0.0, y_from - 0.5));
+            for (long long y = y_from; y <= y_to; y++)
+            {
+                const MirroredRow row(target, center.x, center.y, y, fill, color);
+                const double v0 = std::max(0.0, y - 0.5), v1 = y + 0.5, full = v1 - v0;
+                // Height of the ellipse over the top side at x.
+                auto height_at = [&](double x)
+                {
+                    return std::min(full, std::max(0.0, columns.half(x) - v0));
+                };
+                const double x_bottom = lines.half(v1);
+                const long long full_to = floor_ll(x_bottom - 0.5);
+                if (full_to >= 0)
+                {
+                    row.fill(-full_to, full_to);
+                }
+                // Partly covered pixels: their area, scaled to 255.
+                long long x = std::max(full_to + 1, x_from);
+                const long long last = std::min(floor_ll(x_top + 0.5), x_to);
+                const double scale = 255 / full;
+                double h = std::max(0.0, x - 0.5) < x_bottom ? full : height_at(std::max(0.0, x - 0.5));
+                for (; x <= last; x++)
+                {
+                    const double left = std::max(0.0, x - 0.5), right = x + 0.5;
+                    double area = 0, t = left;
+                    if (t < x_bottom)
+                    {
+                        area = (x_bottom - t) * full;
+                        t = x_bottom;
+                    }
+                    const double end = std::min(right, x_top);
+                    const double h_end = right < x_top ? height_at(right) : 0.0;
+                    area += (end - t) * (h + h_end) / 2;
+                    h = h_end;
+                    const int alpha = std::min(255, (int)(area * (x == 0 ? 2 * scale : scale) + 0.5));
+                    if (alpha > 0)
+                    {
+                        row.blend(x, alpha);
+                        if (x != 0)
+                        {
+                            row.blend(-x, alpha);
+                        }
+                    }
+                }
+                x_top = x_bottom;
+            }
+            return;
+        }
+        // The inside of the vertical lines at the pixel sides, from
+        // x_from - 1/2 on, as (bottom, top) pairs, and where the row sides
+        // cross the ellipse, from y_from - 1/2 on, as (left, right) pairs
+        // (the other way round if they do not): each row only reads them.
+        const long long side_count = x_to - x_from + 2, row_count = y_to - y_from + 2;
+        ellipse_sides_.resize(2 * (size_t)(side_count + row_count));
+        double *const sides = &ellipse_sides_[0], *const rows = sides + 2 * side_count;
+        for (long long i = 0; i < side_count; i++)
         {
-            double vy = (double)y / (double)radius.y;
-            vy *= vy;
-            int x1 = x0 - (dx - 1);
-            for (; x1 > 0; x1--)
+            // The inside at -x is the opposite of the inside at x.
+            const long long opposite = 1 - 2 * x_from - i;
+            if (opposite >= 0 && opposite < i)
+            {
+                sides[2 * i] = -sides[2 * opposite + 1];
+                sides[2 * i + 1] = -sides[2 * opposite];
+                continue;
+            }
+            columns.ends(x_from - 0.5 + (double)i, sides[2 * i], sides[2 * i + 1]);
+        }
+        for (long long i = 0; i < row_count; i++)
+        {
+            lines.ends(y_from - 0.5 + (double)i, rows[2 * i], rows[2 * i + 1]);
+        }
+        for (long long y = y_from; y <= y_to; y++)
+        {
+            const double v0 = y - 0.5, v1 = y + 0.5;
+            // Where the row's sides cross the ellipse (its bottom side only
+            // if its top one does, the row being below the center), with
+            // the inside height there: the other end of the inside is the
+            // mirror image of the crossing about its center.
+            const double *const row_sides = rows + 2 * (y - y_from);
+            double x_a = row_sides[0], x_b = row_sides[1], x_c = INFINITY, x_d = INFINITY;
+            if (x_a > x_b)
+            {
+                continue;
+            }
+            const MirroredRow row(target, center.x, center.y, y, fill, color);
+            // At a crossing of the top side, the inside goes down to its
+            // mirror image, and up to it at one of the bottom side.
+            auto top_height = [&](double x)
+            {
+                return std::min(1.0, std::max(0.0, 2 * (columns.mid * x - v0)));
+            };
+            auto bottom_height = [&](double x)
+            {
+                return std::min(1.0, std::max(0.0, 2 * (v1 - columns.mid * x)));
+            };
+            // Height of the inside of a vertical line within the row.
+            auto height = [&](double lo, double hi)
+            {
+                return std::max(0.0, std::min(v1, hi) - std::max(v0, lo));
+            };
+            auto side_height = [&](long long x)
+            {
+                const double *side = sides + 2 * (x - x_from);
+                return height(side[0], side[1]);
+            };
+            // Crossings in order (unused ones at infinity), consumed from
+            // the first on; extent of the ellipse in the row, and of its
+            // full part.
+            double h_a = top_height(x_a), h_b = top_height(x_b), h_c = 0, h_d = 0;
+            double left = x_a, right = x_b, full_left = 1, full_right = 0;
+            if (row_sides[2] <= row_sides[3])
+            {
+                x_c = row_sides[2];
+                x_d = row_sides[3];
+                h_c = bottom_height(x_c);
+                h_d = bottom_height(x_d);
+                // Left crossings (a, c) and right ones (b, d), then the
+                // inner ones (c, b), in order.
+                if (x_c < x_a)
+                {
+                    std::swap(x_a, x_c);
+                    std::swap(h_a, h_c);
+                }
+                if (x_d < x_b)
+                {
+                    std::swap(x_b, x_d);
+                    std::swap(h_b, h_d);
+                }
+                full_left = x_c;
+                full_right = x_b;
+                if (x_c < x_b)
+                {
+                    std::swap(x_b, x_c);
+                    std::swap(h_b, h_c);
+                }
+                left = x_a;
+                right = x_d;
+            }
+            else
+            {
+                // The bottom of the ellipse, between the crossings.
+                x_c = x_b;
+                h_c = h_b;
+                x_b = lines.mid * y_ext;
+                double lo, hi;
+                columns.ends(x_b, lo, hi);
+                h_b = height(lo, hi);
+            }
+            if (v0 <= y_left && y_left <= v1)
             {
-                double vx = (double)x1 / (double)radius.x;
-                vx *= vx;
-                if (vx + vy <= 1)
+                left = -x_ext;
+            }
+            if (v0 <= -y_left && -y_left <= v1)
+            {
+                right = x_ext;
+            }
+            // Pixels wholly inside.
+            const long long full_from = -floor_ll(-0.5 - full_left);
+            const long long full_to = full_left < full_right ? floor_ll(full_right - 0.5) : full_from - 1;
+            long long x = std::max(floor_ll(left + 0.5), x_from);
+            const long long last = std::min(floor_ll(right + 0.5), x_to);
+            double t = std::max(left, x - 0.5), h = t == left ? 0 : side_height(x);
+            for (; x <= last; x++)
+            {
+                if (x >= full_from && x <= full_to)
+                {
+                    // No crossing inside.
+                    const long long from = x;
+                    x = std::min(full_to, last);
+                    row.fill(from, x);
+                    t = x + 0.5;
+                    h = 1;
+                    continue;
+                }
+                const double end = std::min(x + 0.5, right);
+                double area = 0;
+                while (x_a < end)
+                {
+                    if (x_a > t)
+                    {
+                        area += (x_a - t) * (h + h_a) / 2;
+                        t = x_a;
+                        h = h_a;
+                    }
+                    x_a = x_b;
+                    h_a = h_b;
+                    x_b = x_c;
+                    h_b = h_c;
+                    x_c = x_d;
+                    h_c = h_d;
+                    x_d = INFINITY;
+                }
+                const double h_end = end == right ? 0 : side_height(x + 1);
+                area += (end - t) * (h + h_end) / 2;
+                t = end;
+                h = h_end;
+                const int alpha = std::min(255, (int)(area * 255 + 0.5));
+                if (alpha > 0)
                 {
-                    break;
+                    row.blend(x, alpha);
                 }
             }
-            dx = x0 - x1;
-            x0 = x1;
-            draw_line(center.translate({-x0, -y}),
-                      center.translate({+x0, -y}),
-                      fill);
-            draw_line(center.translate({-x0, +y}),
-                      center.translate({+x0, +y}),
-                      fill);
         }
     }
-
+    Point ellipse_extent(const Point &radius, double degrees)
+    {
+        Point r = {std::abs(radius.x), std::abs(radius.y)};
+        double quarter_turns = degrees / 90.0;
+        if (r.x == r.y || quarter_turns == ::floor(quarter_turns))
+        {
+            long long k = ((long long)quarter_turns % 4 + 4) % 4;
+            return k % 2 == 0 ? r : Point{r.y, r.x};
+        }
+        double angle = degrees * M_PI / 180.0;
+        double c = ::cos(angle), s = ::sin(angle);
+        double rx2 = (double)r.x * r.x;
+        double ry2 = (double)r.y * r.y;
+        return {(int)::ceil(::sqrt(rx2 * c * c + ry2 * s * s)),
+                (int)::ceil(::sqrt(rx2 * s * s + ry2 * c * c))};
+    }
 }
@@ -2,15 +2,24 @@
 #ifndef __svg_png_image_hpp__
 #define __svg_png_image_hpp__
 
+#include "AreaRasterizer.hpp"
 #include "Color.hpp"
+#include "CoverageMask.hpp"
+#include "Palette.hpp"
 #include "Point.hpp"
+#include "encode.hpp"
+#include "stats.hpp"
 
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace svg
 {
     //! PNG image.
+    //! Pixels are stored as RGB colors, or for indexed-color images as
+    //! one-byte indices in a palette (a third of the memory, and
+    //! saved as indexed-color PNG files).
     class PNGImage
     {
     public:
@@ -22,15 +31,76 @@ namespace svg
         //! @param w Image width.
         //! @param h Image height.
         PNGImage(int w, int h);
+        //! Constructor of a clipped view over another image.
+        //! The view shares the pixels of the parent image,
+        //! and draw calls on it only affect pixels inside
+        //! the clip rectangle [x0, x1[ x [y0, y1[.
+        //! @param parent Image that owns the pixels.
+        //! @param x0 Left edge of the clip rectangle.
+        //! @param y0 Top edge of the clip rectangle.
+        //! @param x1 Right edge of the clip rectangle (exclusive).
+        //! @param y1 Bottom edge of the clip rectangle (exclusive).
+        PNGImage(PNGImage &parent, int x0, int y0, int x1, int y1);
+        //! Constructor of a blank (white) band of an image.
+        //! Only the given rows of the w x h canvas are stored, and draw
+        //! calls only affect pixels inside them, so that a large image
+        //! can be drawn one band at a time (see move_band()).
+        //! @param w Image width.
+        //! @param h Image height.
+        //! @param y0 First row of the band.
+        //! @param rows Number of rows of the band.
+        PNGImage(int w, int h, int y0, int rows);
+        //! Constructor of a blank (white) indexed-color image.
+        //! @param w Image width.
+        //! @param h Image height.
+        //! @param palette Palette (shared, not copied), which must contain
+        //! white and every color drawn.
+        PNGImage(int w, int h, std::shared_ptr<const Palette> palette);
+        //! Constructor of a blank (white) band of an indexed-color image
+        //! (see the two constructors above).
+        //! @param w Image width.
+        //! @param h Image height.
+        //! @param y0 First row of the band.
+        //! @param rows Number of rows of the band.
+        //! @param palette Palette (see above).
+        PNGImage(int w, int h, int y0, int rows, std::shared_ptr<const Palette> palette);
         //! Destructor.
         ~PNGImage();
+        //! Reset the image to a blank (white) RGB canvas with the given size.
+        //! The pixel buffer is only reallocated if its size changes.
+        //! @param w Image width.
+        //! @param h Image height.
+        void reset(int w, int h);
+        //! Reset the image to a blank (white) indexed-color canvas with
+        //! the given size (see reset() above).
+        //! @param w Image width.
+        //! @param h Image height.
+        //! @param palette Palette (see the indexed-color constructor).
+        void reset(int w, int h, std::shared_ptr<const Palette> palette);
+        //! Move a band to other rows of the image, and clear it to white.
+        //! The band keeps its number of rows (clipped to the image height).
+        //! @param y0 First row of the band.
+        void move_band(int y0);
+        //! Set all pixels (of the clip rectangle, for views) to a color.
+        //! @param background Color.
+        void clear(const Color &background);
         //! Get image width.
         //! @return The image width.
         int width() const;
         //! Get image height.
         //! @return The image height.
         int height() const;
-        //! Get mutable reference to image pixel.
+        //! Get the first row of the band (0 if the whole image is stored).
+        //! @return Row.
+        int band_top() const;
+        //! Get the row after the last one of the band (the image height
+        //! if the whole image is stored).
+        //! @return Row.
+        int band_bottom() const;
+        //! Get the palette of an indexed-color image.
+        //! @return Palette, or nullptr for RGB images.
+        const Palette *palette() const;
+        //! Get mutable reference to image pixel (RGB images only).
         //! @param x X position
         //! @param y Y position.
         //! @return Reference to pixel.
@@ -40,33 +110,201 @@ namespace svg
         //! @param y Y position.
         //! @return Reference to pixel.
         Color at(int x, int y) const;
-        //! Save to output file.
+        //! Get the pixels of a row (of the band, for bands; RGB images only).
+        //! @param y Y position.
+        //! @return Pointer to the first of width() pixels.
+        const Color *row(int y) const;
+        //! Save to output file, with the default encoder settings.
         //! @param png_file_name Output file name.
         void save(const std::string &png_file_name) const;
+        //! Save to output file.
+        //! @param png_file_name Output file name.
+        //! @param options Encoder settings.
+        void save(const std::string &png_file_name, const PNGOptions &options) const;
+        //! Append the rows of the band (or of the whole image) to a PNG
+        //! being written.
+        //! @param writer PNG writer.
+        void write_rows(PNGWriter &writer) const;
+        //! Set a coverage mask, for drawing opaque shapes front to back
+        //! (in reverse order): while it is set, draw calls only paint the
+        //! pixels the mask does not cover yet, and add them to it.
+        //! The clip rectangle must lie inside the mask's rectangle.
+        //! @param coverage Mask (nullptr to draw normally again).
+        void set_coverage(CoverageMask *coverage);
+        //! Draw polygons, ellipses and lines anti-aliased: pixels along
+        //! their edges are blended with the coverage computed by the
+        //! rasterizer (see AreaRasterizer), lines get the coverage of a
+        //! one pixel wide band (as drawn by Xiaolin Wu's algorithm), and
+        //! interiors are filled as solid spans. Sprites are still copied
+        //! as they are. For RGB images, without a coverage mask (drawing
+        //! back to front) only.
+        //! @param rasterizer Rasterizer (nullptr to draw aliased again).
+        void set_antialias(AreaRasterizer *rasterizer);
+        //! Set counters of the pixels written by draw calls.
+        //! @param stats Counters (nullptr to stop counting).
+        void set_stats(DrawStats *stats);
+        //! Get the memory held by the pixels of all images (not views)
+        //! of the process.
+        //! @return Bytes.
+        static uint64_t framebuffer_bytes();
+        //! Get the largest value of framebuffer_bytes() since the last
+        //! call of reset_peak_framebuffer_bytes() (or since startup).
+        //! @return Bytes.
+        static uint64_t peak_framebuffer_bytes();
+        //! Restart peak_framebuffer_bytes() from the current value.
+        static void reset_peak_framebuffer_bytes();
+        //! Check whether a box overlaps the clip rectangle.
+        //! @param top_left Upper-left corner (inclusive).
+        //! @param bottom_right Lower-right corner (inclusive).
+        //! @return true if some pixel of the box may be drawn.
+        bool overlaps(const Point &top_left, const Point &bottom_right) const;
         //! Draw a line defined by 2 points.
+        //! Only the part inside the clip rectangle is walked.
         //! @param a First point.
         //! @param b Second point.
         //! @param c Color to use for the line.
         void draw_line(const Point &a, const Point &b, const Color &c);
+        //! Fill a horizontal span of pixels.
+        //! The span is clipped to the image (or view) bounds.
+        //! @param x_from First X position.
+        //! @param x_to Last X position (inclusive).
+        //! @param y Y position.
+        //! @param c Color to fill the span with.
+        void fill_span(int x_from, int x_to, int y, const Color &c);
+        //! Copy a horizontal span of pixels.
+        //! The span is clipped to the image (or view) bounds.
+        //! @param x First X position.
+        //! @param y Y position.
+        //! @param colors Pixel colors.
+        //! @param count Number of pixels.
+        void copy_span(int x, int y, const Color *colors, int count);
         //! Draw a polygon.
         //! @param points Vector of points defining the polygon.
         //! @param fill Color to use for the polygon fill.
         void draw_polygon(const std::vector<Point> &points, const Color &fill);
+        //! Draw a polygon.
+        //! @param points Array of points defining the polygon.
+        //! @param count Number of points.
+        //! @param fill Color to use for the polygon fill.
+        void draw_polygon(const Point *points, size_t count, const Color &fill);
         //! Draw an ellipse.
         //! @param center Coordinates for the ellipse center.
         //! @param radius Radius in X and Y axis.
         //! @param fill Color to use for the ellipse fill.
-        //! @param orientation ellipse orientation.
         void draw_ellipse(const Point &center, const Point &radius, const Color &fill);
+        //! Draw an ellipse rotated around its center.
+        //! @param center Coordinates for the ellipse center.
+        //! @param radius Radius in X and Y axis (before rotation).
+        //! @param degrees Ellipse orientation (clockwise, in degrees).
+        //! @param fill Color to use for the ellipse fill.
+        void draw_ellipse(const Point &center, const Point &radius, double degrees, const Color &fill);
 
     private:
+        //! Set a pixel, if it lies inside the clip rectangle.
+        //! @param x X position
+        //! @param y Y position.
+        //! @param c Color.
+        void plot(int x, int y, const Color &c);
+        //! Set pixels of a row, inside the clip rectangle.
+        //! @param x_from First X position.
+        //! @param x_to Last X position (inclusive).
+        //! @param y Y position.
+        //! @param c Color.
+        void set_pixels(int x_from, int x_to, int y, const Color &c);
+        //! Copy pixels to a row, inside the clip rectangle.
+        //! @param x First X position.
+        //! @param y Y position.
+        //! @param colors Pixel colors.
+        //! @param count Number of pixels.
+        void set_pixels(int x, int y, const Color *colors, int count);
+        //! Blend a color into pixels of a row, inside the clip rectangle.
+        //! @param x_from First X position.
+        //! @param x_to Last X position (inclusive).
+        //! @param y Y position.
+        //! @param c Color.
+        //! @param alpha Opacity of the color (1 to 255).
+        void blend_pixels(int x_from, int x_to, int y, const Color &c, int alpha);
+        //! Fill the shape added to rasterizer_, anti-aliased.
+        //! @param c Color.
+        //! @param even_odd Fill rule (see AreaRasterizer::sweep()).
+        void fill_coverage(const Color &c, bool even_odd);
+        //! Draw an anti-aliased line (see set_antialias()).
+        //! @param a First point.
+        //! @param b Second point.
+        //! @param c Color.
+        void draw_line_antialiased(const Point &a, const Point &b, const Color &c);
+        //! Draw an anti-aliased, possibly rotated ellipse, row by row, with
+        //! the area of each pixel inside it (radius > 0).
+        //! @param center Ellipse center.
+        //! @param radius Radius in X and Y axis (before rotation).
+        //! @param degrees Orientation (clockwise, in degrees).
+        //! @param fill Color.
+        void draw_ellipse_antialiased(const Point &center, const Point &radius, double degrees, const Color &fill);
+        //! Get the address of a stored pixel (RGB images).
+        //! @param x X position
+        //! @param y Y position.
+        //! @return Pointer into pixels_.
+        Color *pixel(int x, int y) const;
+        //! Get the address of a stored pixel (indexed-color images).
+        //! @param x X position
+        //! @param y Y position.
+        //! @return Pointer into indices_.
+        unsigned char *index(int x, int y) const;
+        //! Get the index of a color of the palette.
+        //! @param c Color.
+        //! @return Index.
+        unsigned char index_of(const Color &c);
+        //! (Re)allocate the pixels of an owned image, unless their size
+        //! does not change (the pixels are not initialized).
+        //! @param w Image width.
+        //! @param h Image height.
+        //! @param rows Number of rows stored.
+        //! @param palette Palette (nullptr for RGB).
+        void allocate(int w, int h, int rows, std::shared_ptr<const Palette> palette);
+        //! Get the size of the pixel buffer.
+        //! @return Bytes.
+        size_t buffer_bytes() const;
         //! Width.
         int width_;
         //! Height.
         int height_;
-        //! Pixels.
+        //! Pixels, from row origin_y_ on (nullptr for indexed-color images).
         Color *pixels_;
+        //! Pixel indices, from row origin_y_ on (nullptr for RGB images).
+        unsigned char *indices_;
+        //! Palette (nullptr for RGB images).
+        std::shared_ptr<const Palette> palette_;
+        //! Index of white, the blank color (indexed-color images).
+        unsigned char white_;
+        //! Last color looked up by index_of(), and its index: the draw
+        //! calls of a shape all use the same color.
+        Color last_color_;
+        unsigned char last_index_;
+        //! First row stored in pixels_ (0 except for bands).
+        int origin_y_;
+        //! Number of rows stored in pixels_.
+        int rows_;
+        //! Whether pixels_ is owned (false for clipped views).
+        bool owner_;
+        //! Pixels painted so far, when drawing front to back.
+        CoverageMask *coverage_;
+        //! Counters of the pixels written (optional).
+        DrawStats *stats_;
+        //! Rasterizer of anti-aliased shapes (nullptr when drawing aliased).
+        AreaRasterizer *rasterizer_;
+        //! Clip rectangle (upper bounds are exclusive).
+        int clip_x0_, clip_y0_, clip_x1_, clip_y1_;
+        //! Scratch buffer of draw_ellipse_antialiased(), kept so that its
+        //! memory is reused.
+        std::vector<double> ellipse_sides_;
     };
+
+    //! Get the half-size of the box covered by a (rotated) ellipse,
+    //! as drawn by PNGImage::draw_ellipse().
+    //! @param radius Radius in X and Y axis (before rotation).
+    //! @param degrees Ellipse orientation (clockwise, in degrees).
+    //! @return Half width and half height.
+    Point ellipse_extent(const Point &radius, double degrees);
 }
 
 #endif
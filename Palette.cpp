@@ -0,0 +1,71 @@
+//! @file Palette.cpp
+#include "Palette.hpp"
+
+#include <cstring>
+
+namespace svg
+{
+    namespace
+    {
+        uint32_t key(const Color &c)
+        {
+            return 1u << 24 | (uint32_t)c.red << 16 | (uint32_t)c.green << 8 | c.blue;
+        }
+    }
+
+    Palette::Palette()
+    {
+        ::memset(keys_, 0, sizeof(keys_));
+    }
+
+    size_t Palette::slot(uint32_t key)
+    {
+        // Fibonacci hashing into 9 bits.
+        return (key * 2654435769u) >> (32 - 9);
+    }
+
+    bool Palette::add(const Color &c)
+    {
+        const uint32_t k = key(c);
+        size_t s = slot(k);
+        while (keys_[s] != 0)
+        {
+            if (keys_[s] == k)
+            {
+                return true;
+            }
+            s = (s + 1) % SLOTS;
+        }
+        if (colors_.size() == MAX_COLORS)
+        {
+            return false;
+        }
+        keys_[s] = k;
+        indices_[s] = (uint8_t)colors_.size();
+        colors_.push_back(c);
+        return true;
+    }
+
+    int Palette::index(const Color &c) const
+    {
+        const uint32_t k = key(c);
+        for (size_t s = slot(k); keys_[s] != 0; s = (s + 1) % SLOTS)
+        {
+            if (keys_[s] == k)
+            {
+                return indices_[s];
+            }
+        }
+        return -1;
+    }
+
+    const std::vector<Color> &Palette::colors() const
+    {
+        return colors_;
+    }
+
+    size_t Palette::size() const
+    {
+        return colors_.size();
+    }
+}
@@ -0,0 +1,53 @@
+//! @file Palette.hpp
+#ifndef __svg_Palette_hpp__
+#define __svg_Palette_hpp__
+
+#include "Color.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace svg
+{
+    //! Set of up to 256 colors, each with a one-byte index, for
+    //! indexed-color images (see PNGImage).
+    class Palette
+    {
+    public:
+        //! Maximum number of colors.
+        static const size_t MAX_COLORS = 256;
+
+        //! Constructor of an empty palette.
+        Palette();
+        //! Add a color, if not there yet.
+        //! @param c Color.
+        //! @return false if the color is not there and the palette is full.
+        bool add(const Color &c);
+        //! Get the index of a color.
+        //! @param c Color.
+        //! @return Index, or -1 if the color is not in the palette.
+        int index(const Color &c) const;
+        //! Get the colors, by index.
+        //! @return Colors.
+        const std::vector<Color> &colors() const;
+        //! Get the number of colors.
+        //! @return Number of colors.
+        size_t size() const;
+
+    private:
+        //! Slot of a color's key in the hash table.
+        static size_t slot(uint32_t key);
+
+        //! Hash table size (twice the maximum number of colors).
+        static const size_t SLOTS = 2 * MAX_COLORS;
+
+        std::vector<Color> colors_;
+        //! Open-addressing hash table: 0 for empty slots, otherwise the
+        //! color packed in 24 bits, plus 1 << 24.
+        uint32_t keys_[SLOTS];
+        //! Index of the color of each slot.
+        uint8_t indices_[SLOTS];
+    };
+}
+#endif
@@ -0,0 +1,223 @@
+//! @file RenderCache.cpp
+#include "RenderCache.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// POSIX headers
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace svg
+{
+    namespace
+    {
+        const char ENTRY_SUFFIX[] = ".png";
+
+        // Fast 64-bit hash, consuming 8 bytes per step.
+        uint64_t hash_bytes(const char *data, size_t size, uint64_t seed)
+        {
+            const uint64_t k = 0x9E3779B97F4A7C15ull;
+            uint64_t h = seed ^ (size * k);
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                uint64_t w;
+                ::memcpy(&w, data + i, 8);
+                w *= k;
+                w ^= w >> 32;
+                h = (h ^ w) * 0xC2B2AE3D27D4EB4Full;
+            }
+            uint64_t tail = 0;
+            if (size > i)
+            {
+                ::memcpy(&tail, data + i, size - i);
+            }
+            h = (h ^ (tail * k)) * 0xC2B2AE3D27D4EB4Full;
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDull;
+            h ^= h >> 29;
+            return h;
+        }
+
+        int64_t now_ns()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                .count();
+        }
+
+        int64_t mtime_ns(const struct stat &st)
+        {
+            return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        }
+
+        bool copy_file(const std::string &from, const std::string &to)
+        {
+            std::ifstream in(from, std::ios::binary);
+            std::ofstream out(to, std::ios::binary);
+            if (!in || !out)
+            {
+                return false;
+            }
+            out << in.rdbuf();
+            out.close();
+            return (bool)out;
+        }
+    }
+
+    RenderCache::RenderCache(const std::string &dir, uint64_t max_bytes)
+        : dir_(dir), max_bytes_(max_bytes), bytes_(0), hits_(0), misses_(0)
+    {
+        ::mkdir(dir.c_str(), 0777);
+        ::DIR *directory = ::opendir(dir.c_str());
+        if (directory == nullptr)
+        {
+            throw std::runtime_error("Unable to open cache directory " + dir);
+        }
+        ::dirent *e;
+        const size_t suffix = ::strlen(ENTRY_SUFFIX);
+        while ((e = ::readdir(directory)) != nullptr)
+        {
+            std::string name = e->d_name;
+            struct stat st;
+            if (name[0] != '.' && name.size() > suffix &&
+                name.compare(name.size() - suffix, suffix, ENTRY_SUFFIX) == 0 &&
+                ::stat((dir + "/" + name).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            {
+                entries_[name.substr(0, name.size() - suffix)] = {(uint64_t)st.st_size, mtime_ns(st)};
+                bytes_ += st.st_size;
+            }
+        }
+        ::closedir(directory);
+        std::lock_guard<std::mutex> lock(mutex_);
+        evict();
+    }
+
+    std::string RenderCache::key(const std::string &input_file, const std::string &options) const
+    {
+        MappedFile input(input_file);
+        uint64_t h = hash_bytes(options.data(), options.size(), 0);
+        h = hash_bytes(input.data(), input.size(), h);
+        char buf[48];
+        ::snprintf(buf, sizeof(buf), "%016llx-%llx",
+                   (unsigned long long)h, (unsigned long long)input.size());
+        return buf;
+    }
+
+    std::string RenderCache::path(const std::string &key) const
+    {
+        return dir_ + "/" + key + ENTRY_SUFFIX;
+    }
+
+    bool RenderCache::fetch(const std::string &key, const std::string &png_file)
+    {
+        const std::string cached = path(key);
+        struct stat st;
+        bool hit = ::stat(cached.c_str(), &st) == 0;
+        if (hit)
+        {
+            // Link to the cached file; copy it if links are not possible
+            // (e.g. across file systems).
+            ::unlink(png_file.c_str());
+            hit = ::link(cached.c_str(), png_file.c_str()) == 0 ||
+                  copy_file(cached, png_file);
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!hit)
+        {
+            misses_++;
+            return false;
+        }
+        hits_++;
+        // Refresh the modification time, which orders the entries
+        // for eviction across runs.
+        ::utimensat(AT_FDCWD, cached.c_str(), nullptr, 0);
+        auto it = entries_.find(key);
+        if (it == entries_.end())
+        {
+            // Added by another process.
+            it = entries_.insert({key, {(uint64_t)st.st_size, 0}}).first;
+            bytes_ += st.st_size;
+        }
+        it->second.used = now_ns();
+        return true;
+    }
+
+    void RenderCache::store(const std::string &key, const std::string &png_file)
+    {
+        // Copy to a temporary file first, so that other readers of
+        // the cache never see a partial entry.
+        const std::string cached = path(key);
+        const std::string temp = dir_ + "/.tmp-" + key + "-" +
+                                 std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+        struct stat st;
+        if (!copy_file(png_file, temp) || ::rename(temp.c_str(), cached.c_str()) != 0 ||
+            ::stat(cached.c_str(), &st) != 0)
+        {
+            ::unlink(temp.c_str());
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it != entries_.end())
+        {
+            bytes_ -= it->second.bytes;
+        }
+        entries_[key] = {(uint64_t)st.st_size, now_ns()};
+        bytes_ += st.st_size;
+        evict();
+    }
+
+    void RenderCache::evict()
+    {
+        if (bytes_ <= max_bytes_)
+        {
+            return;
+        }
+        // Make some room, so that eviction does not run on every store.
+        const uint64_t target = max_bytes_ / 10 * 9;
+        std::vector<std::pair<int64_t, std::string>> by_age;
+        for (const auto &e : entries_)
+        {
+            by_age.push_back({e.second.used, e.first});
+        }
+        std::sort(by_age.begin(), by_age.end());
+        for (size_t i = 0; i < by_age.size() && bytes_ > target; i++)
+        {
+            auto it = entries_.find(by_age[i].second);
+            ::unlink(path(it->first).c_str());
+            bytes_ -= it->second.bytes;
+            entries_.erase(it);
+        }
+    }
+
+    uint64_t RenderCache::hits() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return hits_;
+    }
+
+    uint64_t RenderCache::misses() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return misses_;
+    }
+
+    uint64_t RenderCache::size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+}
@@ -0,0 +1,87 @@
+//! @file RenderCache.hpp
+#ifndef __svg_RenderCache_hpp__
+#define __svg_RenderCache_hpp__
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace svg
+{
+    //! Default size limit of a render cache (256 MB).
+    const uint64_t DEFAULT_CACHE_SIZE = 256ull << 20;
+
+    //! Content-addressed cache of rendered PNG files.
+    //! Entries are files named after a hash of the input bytes and the
+    //! render options, so an unchanged input is never rendered twice.
+    //! The least recently used entries (by file modification time, which
+    //! is refreshed on every hit) are evicted to keep the cache under
+    //! its size limit. The cache can be shared by several threads.
+    class RenderCache
+    {
+    public:
+        //! Constructor: opens (or creates) a cache directory.
+        //! @param dir Cache directory.
+        //! @param max_bytes Size limit.
+        RenderCache(const std::string &dir, uint64_t max_bytes = DEFAULT_CACHE_SIZE);
+        //! Get the key of a conversion.
+        //! @param input_file Input file (hashed byte by byte).
+        //! @param options Description of all the settings that affect the output.
+        //! @return The key.
+        std::string key(const std::string &input_file, const std::string &options) const;
+        //! Look up an entry and, on a hit, hard-link (or copy) it to a file.
+        //! Counts as a hit or a miss.
+        //! @param key Key.
+        //! @param png_file Output file (replaced on a hit).
+        //! @return true on a hit.
+        bool fetch(const std::string &key, const std::string &png_file);
+        //! Add (a copy of) a rendered file to the cache, evicting old
+        //! entries if the size limit is exceeded.
+        //! @param key Key.
+        //! @param png_file Rendered file.
+        void store(const std::string &key, const std::string &png_file);
+        //! Get the number of hits.
+        //! @return Number of successful fetch() calls.
+        uint64_t hits() const;
+        //! Get the number of misses.
+        //! @return Number of unsuccessful fetch() calls.
+        uint64_t misses() const;
+        //! Get the total size of the entries.
+        //! @return Number of bytes.
+        uint64_t size() const;
+
+    private:
+        RenderCache(const RenderCache &) = delete;
+        RenderCache &operator=(const RenderCache &) = delete;
+
+        //! Cache entry.
+        struct Entry
+        {
+            //! File size.
+            uint64_t bytes;
+            //! Last use (nanoseconds since the epoch).
+            int64_t used;
+        };
+
+        //! Get the path of an entry.
+        std::string path(const std::string &key) const;
+        //! Evict the least recently used entries, until the cache is
+        //! comfortably under the size limit. Must hold mutex_.
+        void evict();
+
+        //! Directory.
+        std::string dir_;
+        //! Size limit.
+        uint64_t max_bytes_;
+        //! Guards the members below.
+        mutable std::mutex mutex_;
+        //! Entries, by key.
+        std::map<std::string, Entry> entries_;
+        //! Total size of the entries.
+        uint64_t bytes_;
+        uint64_t hits_;
+        uint64_t misses_;
+    };
+}
+#endif
@@ -1,5 +1,8 @@
 #include "SVGElements.hpp"
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <memory>
 
 #ifndef M_PI
 #define M_PI acos(-1.0)
@@ -8,6 +11,50 @@
 
 namespace svg
 {
+    namespace
+    {
+        // Bounding box of a point sequence.
+        void points_bounds(const PointVector &points, Point &top_left, Point &bottom_right)
+        {
+            top_left = bottom_right = points.empty() ? Point{0, 0} : points[0];
+            for (const Point &p : points)
+            {
+                top_left.x = std::min(top_left.x, p.x);
+                top_left.y = std::min(top_left.y, p.y);
+                bottom_right.x = std::max(bottom_right.x, p.x);
+                bottom_right.y = std::max(bottom_right.y, p.y);
+            }
+        }
+
+        // Snap angles that are integers up to rounding errors.
+        double snap_degrees(double degrees)
+        {
+            double whole = ::round(degrees);
+            return std::fabs(degrees - whole) < 1e-9 ? whole : degrees;
+        }
+
+        // Grow a bounding box to include another one.
+        void merge_bounds(Point &top_left, Point &bottom_right, const Point &tl, const Point &br)
+        {
+            top_left.x = std::min(top_left.x, tl.x);
+            top_left.y = std::min(top_left.y, tl.y);
+            bottom_right.x = std::max(bottom_right.x, br.x);
+            bottom_right.y = std::max(bottom_right.y, br.y);
+        }
+
+        // Call f with a transformed, temporary copy of each element.
+        template <typename F>
+        void for_each_transformed(const std::vector<SVGElement *> &elements, const Transform &t, F f)
+        {
+            for (const SVGElement *e : elements)
+            {
+                std::unique_ptr<SVGElement> copy(e->clone());
+                copy->applyTransform(t);
+                f(*copy);
+            }
+        }
+    }
+
     // These must be defined!
     SVGElement::SVGElement() {}
     SVGElement::~SVGElement() {}
@@ -16,12 +63,49 @@ namespace svg
     Ellipse::Ellipse(const Color &fill,
                      const Point &center,
                      const Point &radius)
-            : fill(fill), center(center), radius(radius)
+            : fill(fill), center(center), radius(radius), angle(0)
     {
     }
     void Ellipse::draw(PNGImage &img) const
     {
-        img.draw_ellipse(center, radius, fill);
+        img.draw_ellipse(center, radius, angle, fill);
+    }
+    void Ellipse::bounds(Point &top_left, Point &bottom_right) const
+    {
+        Point extent = ellipse_extent(radius, angle);
+        top_left = {center.x - extent.x, center.y - extent.y};
+        bottom_right = {center.x + extent.x, center.y + extent.y};
+    }
+    void Ellipse::add_to(Scene &scene) const
+    {
+        scene.add_ellipse(fill, center, radius, angle);
+    }
+    void Ellipse::applyTransform(const Transform &t)
+    {
+        center = t.apply(center);
+        // The axes of the transformed ellipse are the columns of
+        // L = t * rotation(angle) * diag(rx, ry), if orthogonal.
+        Transform l = t * Transform::rotation(angle);
+        double ux = l.a * radius.x, uy = l.b * radius.x;
+        double vx = l.c * radius.y, vy = l.d * radius.y;
+        if (ux * vx + uy * vy == 0)
+        {
+            radius = {round_to_pixel(::hypot(ux, uy)), round_to_pixel(::hypot(vx, vy))};
+            angle = snap_degrees(::atan2(uy, ux) * 180.0 / M_PI);
+            return;
+        }
+        // Otherwise (skewed by non-uniform scaling): singular value
+        // decomposition of L, whose left rotation gives the orientation.
+        double e = (ux + vy) / 2, f = (ux - vy) / 2;
+        double g = (uy + vx) / 2, h = (uy - vx) / 2;
+        double q = ::hypot(e, h), r = ::hypot(f, g);
+        double a1 = ::atan2(g, f), a2 = ::atan2(h, e);
+        radius = {round_to_pixel(q + r), round_to_pixel(std::fabs(q - r))};
+        angle = snap_degrees((a2 + a1) / 2 * 180.0 / M_PI);
+    }
+    SVGElement *Ellipse::clone() const
+    {
+        return new Ellipse(*this);
     }
 
     // Circle
@@ -31,13 +115,17 @@ namespace svg
     }
     void Circle::draw(PNGImage &img) const
     {
-        img.draw_ellipse(center, radius, fill);
+        img.draw_ellipse(center, radius, angle, fill);
+    }
+    SVGElement *Circle::clone() const
+    {
+        return new Circle(*this);
     }
 
 
     // Polyline
-    Polyline::Polyline(const Color &stroke, const std::vector<Point> &points)
-            : stroke(stroke), points(points)
+    Polyline::Polyline(const Color &stroke, const std::vector<Point> &points, const PointAllocator &alloc)
+            : stroke(stroke), points(points.begin(), points.end(), alloc)
     {
     }
     void Polyline::draw(PNGImage &img) const
@@ -48,6 +136,25 @@ namespace svg
             img.draw_line(points[i], points[i + 1], stroke);
         }
     }
+    void Polyline::bounds(Point &top_left, Point &bottom_right) const
+    {
+        points_bounds(points, top_left, bottom_right);
+    }
+    void Polyline::add_to(Scene &scene) const
+    {
+        scene.add_polyline(stroke, points.data(), points.size());
+    }
+    void Polyline::applyTransform(const Transform &t)
+    {
+        for (Point &p : points)
+        {
+            p = t.apply(p);
+        }
+    }
+    SVGElement *Polyline::clone() const
+    {
+        return new Polyline(stroke, std::vector<Point>(points.begin(), points.end()));
+    }
 
 
     //line
@@ -60,20 +167,175 @@ namespace svg
     {
         img.draw_line(start, end, stroke);
     }
+    void Line::bounds(Point &top_left, Point &bottom_right) const
+    {
+        top_left = {std::min(start.x, end.x), std::min(start.y, end.y)};
+        bottom_right = {std::max(start.x, end.x), std::max(start.y, end.y)};
+    }
+    void Line::add_to(Scene &scene) const
+    {
+        scene.add_line(stroke, start, end);
+    }
+    void Line::applyTransform(const Transform &t)
+    {
+        start = t.apply(start);
+        end = t.apply(end);
+    }
+    SVGElement *Line::clone() const
+    {
+        return new Line(*this);
+    }
 
     // Polygon
-    Polygon::Polygon(const Color &fill, const vector<Point> &points)
-            : fill(fill), points(points)
+    Polygon::Polygon(const Color &fill, const vector<Point> &points, const PointAllocator &alloc)
+            : fill(fill), points(points.begin(), points.end(), alloc)
     {
     }
     void Polygon::draw(PNGImage &img) const
     {
-        img.draw_polygon(points, fill);
+        img.draw_polygon(points.data(), points.size(), fill);
+    }
+    void Polygon::bounds(Point &top_left, Point &bottom_right) const
+    {
+        points_bounds(points, top_left, bottom_right);
+    }
+    void Polygon::add_to(Scene &scene) const
+    {
+        scene.add_polygon(fill, points.data(), points.size());
+    }
+    void Polygon::applyTransform(const Transform &t)
+    {
+        for (Point &p : points)
+        {
+            p = t.apply(p);
+        }
+    }
+    SVGElement *Polygon::clone() const
+    {
+        return new Polygon(fill, std::vector<Point>(points.begin(), points.end()));
+    }
+
+    Rect::Rect(const Color &fill, const Point &upper_left, int width, int height, const PointAllocator &alloc)
+            : Polygon(fill, {upper_left, {upper_left.x + width, upper_left.y}, {upper_left.x + width, upper_left.y + height}, {upper_left.x, upper_left.y + height}}, alloc)
+    {
     }
 
-    Rect::Rect(const Color &fill, const Point &upper_left, int width, int height)
-            : Polygon(fill, {upper_left, {upper_left.x + width, upper_left.y}, {upper_left.x + width, upper_left.y + height}, {upper_left.x, upper_left.y + height}})
+    // Symbol
+    Symbol::Symbol(bool owned) : owned_(owned)
+    {
+    }
+    Symbol::~Symbol()
+    {
+        if (owned_)
+        {
+            for (SVGElement *e : elements)
+            {
+                delete e;
+            }
+        }
+    }
+    bool Symbol::bounds(Point &top_left, Point &bottom_right) const
+    {
+        for (size_t i = 0; i < elements.size(); i++)
+        {
+            Point tl, br;
+            elements[i]->bounds(tl, br);
+            if (i == 0)
+            {
+                top_left = tl;
+                bottom_right = br;
+            }
+            merge_bounds(top_left, bottom_right, tl, br);
+        }
+        return !elements.empty();
+    }
+    std::shared_ptr<const Sprite> Symbol::sprite() const
+    {
+        std::call_once(sprite_once_, [this]() {
+            Point tl, br;
+            if (!bounds(tl, br))
+            {
+                return;
+            }
+            Transform to_origin = Transform::translation(-tl.x, -tl.y);
+            sprite_ = std::make_shared<Sprite>(br.x - tl.x + 1, br.y - tl.y + 1, [&](PNGImage &img) {
+                for_each_transformed(elements, to_origin, [&](const SVGElement &e) { e.draw(img); });
+            });
+        });
+        return sprite_;
+    }
+
+    // Use
+    Use::Use(const std::shared_ptr<const Symbol> &symbol)
+            : symbol(symbol), transform(Transform::identity())
+    {
+    }
+    bool Use::sprite_position(Point &at) const
+    {
+        Point tl, br;
+        if (!transform.is_integer_translation() || !symbol->bounds(tl, br))
+        {
+            return false;
+        }
+        at = {tl.x + (int)transform.e, tl.y + (int)transform.f};
+        return at.x >= 0 && at.y >= 0;
+    }
+    void Use::draw(PNGImage &img) const
+    {
+        Point at;
+        if (sprite_position(at))
+        {
+            symbol->sprite()->blit(img, at);
+            return;
+        }
+        for_each_transformed(symbol->elements, transform, [&](const SVGElement &e) { e.draw(img); });
+    }
+    void Use::bounds(Point &top_left, Point &bottom_right) const
+    {
+        // Empty box if there are no elements.
+        top_left = {0, 0};
+        bottom_right = {-1, -1};
+        if (transform.is_integer_translation())
+        {
+            Point tl, br;
+            if (symbol->bounds(tl, br))
+            {
+                int dx = (int)transform.e, dy = (int)transform.f;
+                top_left = {tl.x + dx, tl.y + dy};
+                bottom_right = {br.x + dx, br.y + dy};
+            }
+            return;
+        }
+        bool first = true;
+        for_each_transformed(symbol->elements, transform, [&](const SVGElement &e) {
+            Point tl, br;
+            e.bounds(tl, br);
+            if (first)
+            {
+                top_left = tl;
+                bottom_right = br;
+                first = false;
+            }
+            merge_bounds(top_left, bottom_right, tl, br);
+        });
+    }
+    void Use::add_to(Scene &scene) const
+    {
+        Point at;
+        if (sprite_position(at))
+        {
+            scene.add_sprite(symbol->sprite(), at);
+            return;
+        }
+        for_each_transformed(symbol->elements, transform, [&](const SVGElement &e) { e.add_to(scene); });
+    }
+    void Use::applyTransform(const Transform &t)
+    {
+        transform = t * transform;
+    }
+    SVGElement *Use::clone() const
     {
+        return new Use(*this);
     }
 
 
@@ -5,11 +5,26 @@
 #include "Color.hpp"
 #include "Point.hpp"
 #include "PNGImage.hpp"
+#include "Scene.hpp"
+#include "Arena.hpp"
+#include "Transform.hpp"
+#include "Sprite.hpp"
+#include "RenderCache.hpp"
+#include "tiles.hpp"
+#include "stats.hpp"
+
+#include <memory>
+#include <mutex>
 
 using namespace std;
 
 namespace svg
 {
+    //! Allocator for element point data (an Arena, or the heap).
+    typedef ArenaAllocator<Point> PointAllocator;
+    //! Point data of polylines and polygons.
+    typedef std::vector<Point, PointAllocator> PointVector;
+
     class SVGElement
     {
 
@@ -17,41 +32,104 @@ namespace svg
         SVGElement();
         virtual ~SVGElement();
         virtual void draw(PNGImage &img) const = 0;
+        //! Get the bounding box of the pixels touched by draw().
+        //! @param top_left Upper-left corner (inclusive).
+        //! @param bottom_right Lower-right corner (inclusive).
+        virtual void bounds(Point &top_left, Point &bottom_right) const = 0;
+        //! Append this element to a compact scene.
+        //! @param scene Scene to add to.
+        virtual void add_to(Scene &scene) const = 0;
+
+        //! Transform the element geometry in place.
+        //! readSVG() compiles the 'transform' and 'transform-origin'
+        //! attributes (composed with those of enclosing groups) into
+        //! one matrix, and applies it once when the element is read.
+        //! @param t Transformation.
+        virtual void applyTransform(const Transform &t) = 0;
+        //! Copy the element.
+        //! @return Heap-allocated copy, owned by the caller.
+        virtual SVGElement *clone() const = 0;
 
         // Adicione o atributo ID
         std::string id;
-        
-        // Adicione o atributo transform
-        std::string transform;
-        
-        // Adicione o atributo transform-origin
-        std::string transform_origin;
-
-        virtual void applyTransform(PNGImage &img) const;
-
-        virtual void rotate(int angle);
     };
 
     // Declaration of namespace functions
     // readSVG -> implement it in readSVG.cpp
     // convert -> already given (DO NOT CHANGE) in convert.cpp
 
+    // Parse an SVG 'points' attribute (e.g. "0,0 10,-5.5 20 0")
+    // and append the points to a vector. Throws on malformed input.
+    void parse_points(const char *str, std::vector<Point> &points);
     void readSVG(const std::string &svg_file,
                  Point &dimensions,
                  std::vector<SVGElement *> &svg_elements);
+    // Same as above, but the elements and their points are allocated
+    // in (and owned by) an arena, so they must not be deleted.
+    void readSVG(const std::string &svg_file,
+                 Point &dimensions,
+                 std::vector<SVGElement *> &svg_elements,
+                 Arena &arena);
+    // Same as above, but stores the elements in a compact scene.
+    // The arena is used for temporary elements and reset afterwards.
+    // The time spent loading, parsing and building the scene is added
+    // to *stats, if given.
+    void readSVG(const std::string &svg_file,
+                 Point &dimensions,
+                 Scene &scene,
+                 Arena &arena,
+                 ConvertStats *stats = nullptr);
+    void readSVG(const std::string &svg_file,
+                 Point &dimensions,
+                 Scene &scene);
+    // svg_file may also be a scene precompiled by compile() (.svgb).
     void convert(const std::string &svg_file,
                  const std::string &png_file);
+    // Same as above, with the given PNG encoder settings.
+    // Per-stage times and counters of the conversion are added to
+    // *stats, if given (see ConvertStats).
+    void convert(const std::string &svg_file,
+                 const std::string &png_file,
+                 const PNGOptions &png,
+                 ConvertStats *stats = nullptr);
+    // Same as above, but renders into a caller-owned image
+    // (reused across calls when the canvas size does not change)
+    // and parses with a caller-owned arena (reused across calls).
+    void convert(const std::string &svg_file,
+                 const std::string &png_file,
+                 PNGImage &img,
+                 Arena &arena,
+                 const PNGOptions &png = PNGOptions());
+    // Same as above, but if the input (and the renderer) did not change
+    // since a previous conversion, copies the PNG from the cache instead
+    // of rendering it again. Otherwise the result is added to the cache.
+    void convert(const std::string &svg_file,
+                 const std::string &png_file,
+                 PNGImage &img,
+                 Arena &arena,
+                 RenderCache &cache,
+                 const PNGOptions &png = PNGOptions());
+    // Parse an SVG file and save its scene in the binary format
+    // read by Scene::load() (and by convert(), for .svgb files).
+    void compile(const std::string &svg_file,
+                 const std::string &svgb_file);
     
     class Ellipse : public SVGElement
     {
     public:
         Ellipse(const Color &fill, const Point &center, const Point &radius);
         void draw(PNGImage &img) const override;
+        void bounds(Point &top_left, Point &bottom_right) const override;
+        void add_to(Scene &scene) const override;
+        void applyTransform(const Transform &t) override;
+        SVGElement *clone() const override;
 
     protected:
         Color fill;
         Point center;
         Point radius;
+        //! Orientation (clockwise, in degrees).
+        double angle;
     };
 
      class Circle : public Ellipse
@@ -59,6 +137,7 @@ namespace svg
     public:
         Circle(const Color &fill, const Point &center, int radius);
         void draw(PNGImage &img) const override;
+        SVGElement *clone() const override;
 
        
     };
@@ -67,12 +146,17 @@ namespace svg
     class Polyline : public SVGElement
     {
     public:
-        Polyline(const Color &stroke, const std::vector<Point> &points);
+        Polyline(const Color &stroke, const std::vector<Point> &points,
+                 const PointAllocator &alloc = PointAllocator());
         void draw(PNGImage &img) const override;
+        void bounds(Point &top_left, Point &bottom_right) const override;
+        void add_to(Scene &scene) const override;
+        void applyTransform(const Transform &t) override;
+        SVGElement *clone() const override;
 
     protected:
         Color stroke;
-        std::vector<Point> points;
+        PointVector points;
     };
 
     class Line : public SVGElement
@@ -80,6 +164,10 @@ namespace svg
     public:
         Line(const Color &stroke, const Point &start, const Point &end);
         void draw(PNGImage &img) const override;
+        void bounds(Point &top_left, Point &bottom_right) const override;
+        void add_to(Scene &scene) const override;
+        void applyTransform(const Transform &t) override;
+        SVGElement *clone() const override;
 
     protected:
         Color stroke;
@@ -90,21 +178,88 @@ namespace svg
     class Polygon : public SVGElement
     {   
     public:
-        Polygon(const Color &fill, const vector<Point> &points);
+        Polygon(const Color &fill, const vector<Point> &points,
+                const PointAllocator &alloc = PointAllocator());
         void draw(PNGImage &img) const override;
+        void bounds(Point &top_left, Point &bottom_right) const override;
+        void add_to(Scene &scene) const override;
+        void applyTransform(const Transform &t) override;
+        SVGElement *clone() const override;
 
     private:
         Color fill;
-        vector<Point> points;
+        PointVector points;
     };
 
     class Rect : public Polygon
     {
     public:
-        Rect(const Color &fill, const Point &upper_left, int width, int height);
+        Rect(const Color &fill, const Point &upper_left, int width, int height,
+             const PointAllocator &alloc = PointAllocator());
     };
 
+    //! Geometry shared by all the instances of a referenced element:
+    //! the element (or the shapes of a group) with its own transform
+    //! applied, but not those of its ancestors.
+    class Symbol
+    {
+    public:
+        //! Constructor.
+        //! @param owned Whether the elements are deleted with the symbol
+        //! (false if they are allocated in an arena).
+        explicit Symbol(bool owned);
+        ~Symbol();
+        //! Get the bounding box of the elements.
+        //! @param top_left Upper-left corner (inclusive).
+        //! @param bottom_right Lower-right corner (inclusive).
+        //! @return false if there are no elements.
+        bool bounds(Point &top_left, Point &bottom_right) const;
+        //! Get the elements rasterized with the upper-left corner of their
+        //! bounding box at the origin. The sprite is built on first use.
+        //! @return The sprite (nullptr if there are no elements).
+        std::shared_ptr<const Sprite> sprite() const;
+
+        //! Elements.
+        std::vector<SVGElement *> elements;
+
+    private:
+        Symbol(const Symbol &) = delete;
+        Symbol &operator=(const Symbol &) = delete;
+
+        //! Whether the elements are owned.
+        bool owned_;
+        //! Guards the construction of sprite_.
+        mutable std::once_flag sprite_once_;
+        //! Cached sprite.
+        mutable std::shared_ptr<const Sprite> sprite_;
+    };
 
+    //! Instance of a referenced element (<use href="#id">).
+    //! Instances share the geometry of the symbol instead of copying it.
+    //! An instance placed by a whole-pixel translation is drawn by copying
+    //! the symbol's sprite; otherwise the shapes are transformed on the fly.
+    class Use : public SVGElement
+    {
+    public:
+        Use(const std::shared_ptr<const Symbol> &symbol);
+        void draw(PNGImage &img) const override;
+        void bounds(Point &top_left, Point &bottom_right) const override;
+        void add_to(Scene &scene) const override;
+        void applyTransform(const Transform &t) override;
+        SVGElement *clone() const override;
+
+    private:
+        //! Check if the instance can be drawn from the sprite.
+        //! Sprites match direct drawing for any whole-pixel translation
+        //! that keeps the shapes at non-negative coordinates.
+        //! @param at Set to the position of the sprite.
+        //! @return true if the sprite can be used.
+        bool sprite_position(Point &at) const;
+
+        std::shared_ptr<const Symbol> symbol;
+        //! Placement of the instance.
+        Transform transform;
+    };
 
 }
 #endif
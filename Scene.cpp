@@ -0,0 +1,525 @@
+//! @file Scene.cpp
+#include "Scene.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <map>
+#include <stdexcept>
+#include <type_traits>
+
+namespace svg
+{
+    namespace
+    {
+        // Scene file (.svgb) format: a header, then the arrays of the
+        // scene in a fixed order, each one padded to 8 bytes.
+        const char SCENE_FILE_MAGIC[4] = {'S', 'V', 'G', 'B'};
+        const uint32_t SCENE_FILE_VERSION = 1;
+        const uint32_t SCENE_FILE_BYTE_ORDER = 0x01020304;
+
+        // Sprite placement, by index in the sprite table.
+        struct SpriteRecord
+        {
+            uint32_t sprite;
+            Point at;
+        };
+
+        // Entry in the sprite table: ranges of the run and pixel arrays.
+        struct SpriteInfo
+        {
+            int32_t width;
+            int32_t height;
+            uint64_t first_run;
+            uint64_t runs;
+            uint64_t first_pixel;
+            uint64_t pixels;
+        };
+
+        // Array counts, in file order.
+        enum Section
+        {
+            SHAPES,
+            BOXES,
+            ELLIPSES,
+            LINES,
+            POLYLINES,
+            POLYGONS,
+            POINTS,
+            SPRITE_RECORDS,
+            SPRITE_INFOS,
+            SPRITE_RUNS,
+            SPRITE_PIXELS,
+            SECTIONS
+        };
+
+        struct FileHeader
+        {
+            char magic[4];
+            uint32_t version;
+            uint32_t byte_order;
+            // Element sizes of the arrays, to reject files written
+            // by a build with a different memory layout.
+            uint32_t element_size[SECTIONS];
+            int32_t width;
+            int32_t height;
+            uint64_t count[SECTIONS];
+        };
+
+        size_t padding(size_t bytes)
+        {
+            return (8 - bytes % 8) % 8;
+        }
+
+        template <typename T>
+        void write_array(std::ofstream &out, const T *data, size_t count)
+        {
+            const char zeros[8] = {0};
+            out.write(reinterpret_cast<const char *>(data), count * sizeof(T));
+            out.write(zeros, padding(count * sizeof(T)));
+        }
+
+        // Same as write_array(), for records with padding bytes (which
+        // are unspecified): they are written from zeroed copies, filled
+        // field by field, so that the file does not depend on memory.
+        template <typename T, typename CopyFields>
+        void write_records(std::ofstream &out, const std::vector<T> &records, CopyFields copy_fields)
+        {
+            std::vector<T> zeroed(records.size());
+            if (!zeroed.empty())
+            {
+                ::memset(&zeroed[0], 0, zeroed.size() * sizeof(T));
+            }
+            for (size_t i = 0; i < records.size(); i++)
+            {
+                copy_fields(zeroed[i], records[i]);
+            }
+            write_array(out, zeroed.data(), zeroed.size());
+        }
+
+        // Sequential reader of the arrays of a mapped scene file.
+        class ArrayReader
+        {
+        public:
+            ArrayReader(const MappedFile &file, size_t offset)
+                : file_(file), offset_(offset)
+            {
+            }
+            template <typename T>
+            bool read(std::vector<T> &v, uint64_t count)
+            {
+                size_t left = file_.size() - offset_;
+                if (count > left / sizeof(T))
+                {
+                    return false;
+                }
+                size_t bytes = count * sizeof(T);
+                v.resize(count);
+                if (bytes > 0)
+                {
+                    ::memcpy(&v[0], file_.data() + offset_, bytes);
+                }
+                offset_ += std::min(left, bytes + padding(bytes));
+                return true;
+            }
+
+        private:
+            const MappedFile &file_;
+            size_t offset_;
+        };
+    }
+
+    void Scene::add_ellipse(const Color &fill, const Point &center, const Point &radius, double degrees)
+    {
+        order_.push_back({ELLIPSE, (uint32_t)ellipses_.size()});
+        ellipses_.push_back({fill, center, radius, degrees});
+        Point r = ellipse_extent(radius, degrees);
+        boxes_.push_back({{center.x - r.x, center.y - r.y}, {center.x + r.x, center.y + r.y}});
+    }
+
+    void Scene::add_line(const Color &stroke, const Point &start, const Point &end)
+    {
+        order_.push_back({LINE, (uint32_t)lines_.size()});
+        lines_.push_back({stroke, start, end});
+        boxes_.push_back({{std::min(start.x, end.x), std::min(start.y, end.y)},
+                          {std::max(start.x, end.x), std::max(start.y, end.y)}});
+    }
+
+    void Scene::add_polyline(const Color &stroke, const std::vector<Point> &points)
+    {
+        add_polyline(stroke, points.data(), points.size());
+    }
+
+    void Scene::add_polyline(const Color &stroke, const Point *points, size_t count)
+    {
+        order_.push_back({POLYLINE, add_path(polylines_, stroke, points, count)});
+    }
+
+    void Scene::add_polygon(const Color &fill, const std::vector<Point> &points)
+    {
+        add_polygon(fill, points.data(), points.size());
+    }
+
+    void Scene::add_polygon(const Color &fill, const Point *points, size_t count)
+    {
+        order_.push_back({POLYGON, add_path(polygons_, fill, points, count)});
+    }
+
+    void Scene::add_sprite(const std::shared_ptr<const Sprite> &sprite, const Point &at)
+    {
+        order_.push_back({SPRITE, (uint32_t)sprites_.size()});
+        sprites_.push_back({sprite, at});
+        boxes_.push_back({at, {at.x + sprite->width() - 1, at.y + sprite->height() - 1}});
+    }
+
+    uint32_t Scene::add_path(std::vector<PathShape> &paths, const Color &c, const Point *points, size_t count)
+    {
+        Box box = {{0, 0}, {0, 0}};
+        if (count > 0)
+        {
+            box.top_left = box.bottom_right = points[0];
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            const Point &p = points[i];
+            box.top_left.x = std::min(box.top_left.x, p.x);
+            box.top_left.y = std::min(box.top_left.y, p.y);
+            box.bottom_right.x = std::max(box.bottom_right.x, p.x);
+            box.bottom_right.y = std::max(box.bottom_right.y, p.y);
+        }
+        boxes_.push_back(box);
+        paths.push_back({c, (uint32_t)points_.size(), (uint32_t)count});
+        points_.insert(points_.end(), points, points + count);
+        return paths.size() - 1;
+    }
+
+    void Scene::clear()
+    {
+        order_.clear();
+        boxes_.clear();
+        ellipses_.clear();
+        lines_.clear();
+        polylines_.clear();
+        polygons_.clear();
+        sprites_.clear();
+        points_.clear();
+    }
+
+    size_t Scene::size() const
+    {
+        return order_.size();
+    }
+
+    Scene::ShapeType Scene::type(size_t i) const
+    {
+        return order_[i].type;
+    }
+
+    void Scene::bounds(size_t i, Point &top_left, Point &bottom_right) const
+    {
+        top_left = boxes_[i].top_left;
+        bottom_right = boxes_[i].bottom_right;
+    }
+
+    bool Scene::collect_colors(Palette &palette) const
+    {
+        for (const EllipseShape &e : ellipses_)
+        {
+            if (!palette.add(e.fill))
+            {
+                return false;
+            }
+        }
+        for (const LineShape &l : lines_)
+        {
+            if (!palette.add(l.stroke))
+            {
+                return false;
+            }
+        }
+        for (const std::vector<PathShape> *paths : {&polylines_, &polygons_})
+        {
+            for (const PathShape &p : *paths)
+            {
+                if (!palette.add(p.color))
+                {
+                    return false;
+                }
+            }
+        }
+        // Sprites used several times (<use>) are shared: their pixels
+        // are only scanned once.
+        std::vector<const Sprite *> sprites;
+        for (const SpriteShape &s : sprites_)
+        {
+            sprites.push_back(s.sprite.get());
+        }
+        std::sort(sprites.begin(), sprites.end());
+        sprites.erase(std::unique(sprites.begin(), sprites.end()), sprites.end());
+        for (const Sprite *sprite : sprites)
+        {
+            for (const Color &c : sprite->pixels())
+            {
+                if (!palette.add(c))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void Scene::draw(PNGImage &img, size_t i) const
+    {
+        if (!img.overlaps(boxes_[i].top_left, boxes_[i].bottom_right))
+        {
+            // Entirely off the canvas (or clip rectangle).
+            return;
+        }
+        const Shape &s = order_[i];
+        switch (s.type)
+        {
+        case ELLIPSE:
+        {
+            const EllipseShape &e = ellipses_[s.index];
+            img.draw_ellipse(e.center, e.radius, e.degrees, e.fill);
+            break;
+        }
+        case LINE:
+        {
+            const LineShape &l = lines_[s.index];
+            img.draw_line(l.start, l.end, l.stroke);
+            break;
+        }
+        case POLYLINE:
+        {
+            const PathShape &p = polylines_[s.index];
+            const Point *points = points_.data() + p.first;
+            for (uint32_t j = 1; j < p.count; j++)
+            {
+                img.draw_line(points[j - 1], points[j], p.color);
+            }
+            break;
+        }
+        case POLYGON:
+        {
+            const PathShape &p = polygons_[s.index];
+            img.draw_polygon(points_.data() + p.first, p.count, p.color);
+            break;
+        }
+        case SPRITE:
+        {
+            const SpriteShape &sp = sprites_[s.index];
+            sp.sprite->blit(img, sp.at);
+            break;
+        }
+        }
+    }
+
+    void Scene::draw(PNGImage &img) const
+    {
+        for (size_t i = 0; i < order_.size(); i++)
+        {
+            draw(img, i);
+        }
+    }
+
+    void Scene::save(const std::string &file, const Point &dimensions) const
+    {
+        // Sprites are stored once, however many times they are placed.
+        std::vector<SpriteRecord> records;
+        std::vector<SpriteInfo> infos;
+        std::vector<Sprite::Run> runs;
+        std::vector<Color> pixels;
+        std::map<const Sprite *, uint32_t> sprite_index;
+        for (const SpriteShape &sp : sprites_)
+        {
+            auto it = sprite_index.find(sp.sprite.get());
+            if (it == sprite_index.end())
+            {
+                const Sprite &sprite = *sp.sprite;
+                it = sprite_index.insert({&sprite, (uint32_t)infos.size()}).first;
+                infos.push_back({sprite.width(), sprite.height(),
+                                 runs.size(), sprite.runs().size(),
+                                 pixels.size(), sprite.pixels().size()});
+                runs.insert(runs.end(), sprite.runs().begin(), sprite.runs().end());
+                pixels.insert(pixels.end(), sprite.pixels().begin(), sprite.pixels().end());
+            }
+            records.push_back({it->second, sp.at});
+        }
+
+        FileHeader header;
+        ::memset(&header, 0, sizeof(header));
+        ::memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+        header.version = SCENE_FILE_VERSION;
+        header.byte_order = SCENE_FILE_BYTE_ORDER;
+        const uint32_t element_size[SECTIONS] = {
+            sizeof(Shape), sizeof(Box), sizeof(EllipseShape), sizeof(LineShape),
+            sizeof(PathShape), sizeof(PathShape), sizeof(Point), sizeof(SpriteRecord),
+            sizeof(SpriteInfo), sizeof(Sprite::Run), sizeof(Color)};
+        ::memcpy(header.element_size, element_size, sizeof(element_size));
+        header.width = dimensions.x;
+        header.height = dimensions.y;
+        const uint64_t count[SECTIONS] = {
+            order_.size(), boxes_.size(), ellipses_.size(), lines_.size(),
+            polylines_.size(), polygons_.size(), points_.size(), records.size(),
+            infos.size(), runs.size(), pixels.size()};
+        ::memcpy(header.count, count, sizeof(count));
+
+        std::ofstream out(file, std::ios::binary);
+        write_array(out, &header, 1);
+        write_array(out, order_.data(), order_.size());
+        write_array(out, boxes_.data(), boxes_.size());
+        // Colors are 3 bytes: the following fields are padded.
+        write_records(out, ellipses_, [](EllipseShape &to, const EllipseShape &from)
+                      {
+                          to.fill = from.fill;
+                          to.center = from.center;
+                          to.radius = from.radius;
+                          to.degrees = from.degrees;
+                      });
+        write_records(out, lines_, [](LineShape &to, const LineShape &from)
+                      {
+                          to.stroke = from.stroke;
+                          to.start = from.start;
+                          to.end = from.end;
+                      });
+        auto copy_path = [](PathShape &to, const PathShape &from)
+        {
+            to.color = from.color;
+            to.first = from.first;
+            to.count = from.count;
+        };
+        write_records(out, polylines_, copy_path);
+        write_records(out, polygons_, copy_path);
+        write_array(out, points_.data(), points_.size());
+        write_array(out, records.data(), records.size());
+        write_array(out, infos.data(), infos.size());
+        write_array(out, runs.data(), runs.size());
+        write_array(out, pixels.data(), pixels.size());
+        out.close();
+        if (!out)
+        {
+            throw std::runtime_error("Unable to write " + file);
+        }
+    }
+
+    void Scene::load(const std::string &file, Point &dimensions)
+    {
+        MappedFile mapped(file);
+        const std::runtime_error invalid("Invalid scene file " + file);
+        FileHeader header;
+        if (mapped.size() < sizeof(header))
+        {
+            throw invalid;
+        }
+        ::memcpy(&header, mapped.data(), sizeof(header));
+        const uint32_t element_size[SECTIONS] = {
+            sizeof(Shape), sizeof(Box), sizeof(EllipseShape), sizeof(LineShape),
+            sizeof(PathShape), sizeof(PathShape), sizeof(Point), sizeof(SpriteRecord),
+            sizeof(SpriteInfo), sizeof(Sprite::Run), sizeof(Color)};
+        if (::memcmp(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SCENE_FILE_VERSION ||
+            header.byte_order != SCENE_FILE_BYTE_ORDER ||
+            ::memcmp(header.element_size, element_size, sizeof(element_size)) != 0 ||
+            header.width <= 0 || header.height <= 0)
+        {
+            throw invalid;
+        }
+
+        Scene scene;
+        std::vector<SpriteRecord> records;
+        std::vector<SpriteInfo> infos;
+        std::vector<Sprite::Run> runs;
+        std::vector<Color> pixels;
+        ArrayReader in(mapped, sizeof(header) + padding(sizeof(header)));
+        const uint64_t *count = header.count;
+        if (!in.read(scene.order_, count[SHAPES]) ||
+            !in.read(scene.boxes_, count[BOXES]) ||
+            !in.read(scene.ellipses_, count[ELLIPSES]) ||
+            !in.read(scene.lines_, count[LINES]) ||
+            !in.read(scene.polylines_, count[POLYLINES]) ||
+            !in.read(scene.polygons_, count[POLYGONS]) ||
+            !in.read(scene.points_, count[POINTS]) ||
+            !in.read(records, count[SPRITE_RECORDS]) ||
+            !in.read(infos, count[SPRITE_INFOS]) ||
+            !in.read(runs, count[SPRITE_RUNS]) ||
+            !in.read(pixels, count[SPRITE_PIXELS]))
+        {
+            throw invalid;
+        }
+
+        // Check every index, so that a corrupt file cannot make
+        // drawing read out of bounds.
+        if (scene.boxes_.size() != scene.order_.size())
+        {
+            throw invalid;
+        }
+        for (const Shape &shape : scene.order_)
+        {
+            std::underlying_type<ShapeType>::type type;
+            ::memcpy(&type, &shape.type, sizeof(type));
+            if (type < ELLIPSE || type > SPRITE)
+            {
+                throw invalid;
+            }
+            size_t n = shape.type == ELLIPSE    ? scene.ellipses_.size()
+                       : shape.type == LINE     ? scene.lines_.size()
+                       : shape.type == POLYLINE ? scene.polylines_.size()
+                       : shape.type == POLYGON  ? scene.polygons_.size()
+                       : shape.type == SPRITE   ? records.size()
+                                                : 0;
+            if (shape.index >= n)
+            {
+                throw invalid;
+            }
+        }
+        for (const std::vector<PathShape> *paths : {&scene.polylines_, &scene.polygons_})
+        {
+            for (const PathShape &p : *paths)
+            {
+                if ((uint64_t)p.first + p.count > scene.points_.size())
+                {
+                    throw invalid;
+                }
+            }
+        }
+        std::vector<std::shared_ptr<const Sprite>> sprites;
+        for (const SpriteInfo &info : infos)
+        {
+            if (info.first_run > runs.size() || info.runs > runs.size() - info.first_run ||
+                info.first_pixel > pixels.size() || info.pixels > pixels.size() - info.first_pixel)
+            {
+                throw invalid;
+            }
+            for (uint64_t i = info.first_run; i < info.first_run + info.runs; i++)
+            {
+                const Sprite::Run &run = runs[i];
+                if (run.x < 0 || run.count < 0 || run.x > info.width - run.count ||
+                    run.y < 0 || run.y >= info.height ||
+                    (uint64_t)run.first + run.count > info.pixels)
+                {
+                    throw invalid;
+                }
+            }
+            sprites.push_back(std::make_shared<Sprite>(
+                info.width, info.height,
+                std::vector<Sprite::Run>(runs.begin() + info.first_run, runs.begin() + info.first_run + info.runs),
+                std::vector<Color>(pixels.begin() + info.first_pixel, pixels.begin() + info.first_pixel + info.pixels)));
+        }
+        for (const SpriteRecord &r : records)
+        {
+            if (r.sprite >= sprites.size())
+            {
+                throw invalid;
+            }
+            scene.sprites_.push_back({sprites[r.sprite], r.at});
+        }
+
+        *this = std::move(scene);
+        dimensions = {header.width, header.height};
+    }
+}
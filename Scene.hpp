@@ -0,0 +1,168 @@
+//! @file Scene.hpp
+#ifndef __svg_Scene_hpp__
+#define __svg_Scene_hpp__
+
+#include "Color.hpp"
+#include "Palette.hpp"
+#include "Point.hpp"
+#include "PNGImage.hpp"
+#include "Sprite.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace svg
+{
+    //! Compact, data-oriented representation of the shapes in a document.
+    //! Shapes are kept in per-type arrays, point data in one shared buffer,
+    //! and drawing walks them in document (painter's) order with a switch
+    //! on the shape type instead of virtual calls.
+    class Scene
+    {
+    public:
+        //! Shape types.
+        enum ShapeType
+        {
+            ELLIPSE,
+            LINE,
+            POLYLINE,
+            POLYGON,
+            SPRITE
+        };
+        //! Add a filled ellipse.
+        //! @param fill Fill color.
+        //! @param center Ellipse center.
+        //! @param radius Radius in X and Y axis.
+        //! @param degrees Orientation (clockwise, in degrees).
+        void add_ellipse(const Color &fill, const Point &center, const Point &radius, double degrees = 0);
+        //! Add a line.
+        //! @param stroke Stroke color.
+        //! @param start First point.
+        //! @param end Second point.
+        void add_line(const Color &stroke, const Point &start, const Point &end);
+        //! Add a polyline.
+        //! @param stroke Stroke color.
+        //! @param points Polyline points.
+        void add_polyline(const Color &stroke, const std::vector<Point> &points);
+        //! Add a polyline.
+        //! @param stroke Stroke color.
+        //! @param points Polyline points.
+        //! @param count Number of points.
+        void add_polyline(const Color &stroke, const Point *points, size_t count);
+        //! Add a filled polygon.
+        //! @param fill Fill color.
+        //! @param points Polygon points.
+        void add_polygon(const Color &fill, const std::vector<Point> &points);
+        //! Add a filled polygon.
+        //! @param fill Fill color.
+        //! @param points Polygon points.
+        //! @param count Number of points.
+        void add_polygon(const Color &fill, const Point *points, size_t count);
+        //! Add a pre-rasterized sprite.
+        //! The sprite is shared, not copied.
+        //! @param sprite Sprite.
+        //! @param at Position of the sprite's upper-left corner.
+        void add_sprite(const std::shared_ptr<const Sprite> &sprite, const Point &at);
+        //! Remove all shapes (keeping allocated storage).
+        void clear();
+        //! Get the number of shapes.
+        //! @return Number of shapes.
+        size_t size() const;
+        //! Get the type of a shape.
+        //! @param i Shape index (in document order).
+        //! @return Shape type.
+        ShapeType type(size_t i) const;
+        //! Get the bounding box of a shape.
+        //! @param i Shape index (in document order).
+        //! @param top_left Upper-left corner (inclusive).
+        //! @param bottom_right Lower-right corner (inclusive).
+        void bounds(size_t i, Point &top_left, Point &bottom_right) const;
+        //! Add the colors the shapes draw with to a palette.
+        //! @param palette Palette.
+        //! @return false if the palette became full before all colors
+        //! were added.
+        bool collect_colors(Palette &palette) const;
+        //! Draw one shape.
+        //! @param img Image to draw on.
+        //! @param i Shape index (in document order).
+        void draw(PNGImage &img, size_t i) const;
+        //! Draw all shapes in document order.
+        //! @param img Image to draw on.
+        void draw(PNGImage &img) const;
+        //! Save the scene to a binary (.svgb) file.
+        //! The file holds the shape arrays as they are in memory (with a
+        //! version and layout check), so loading it involves no parsing.
+        //! @param file File name.
+        //! @param dimensions Canvas size.
+        void save(const std::string &file, const Point &dimensions) const;
+        //! Load a scene saved by save(), replacing all shapes.
+        //! The file is memory-mapped and each array is copied in one go.
+        //! Throws if the file is not a valid scene file of this version.
+        //! @param file File name.
+        //! @param dimensions Set to the canvas size.
+        void load(const std::string &file, Point &dimensions);
+
+    private:
+        //! Entry in the document order.
+        struct Shape
+        {
+            //! Shape type.
+            ShapeType type;
+            //! Index in the array for that type.
+            uint32_t index;
+        };
+        //! Ellipse data.
+        struct EllipseShape
+        {
+            Color fill;
+            Point center;
+            Point radius;
+            double degrees;
+        };
+        //! Line data.
+        struct LineShape
+        {
+            Color stroke;
+            Point start;
+            Point end;
+        };
+        //! Polyline / polygon data: a range of the shared point buffer.
+        struct PathShape
+        {
+            Color color;
+            uint32_t first;
+            uint32_t count;
+        };
+        //! Sprite data.
+        struct SpriteShape
+        {
+            std::shared_ptr<const Sprite> sprite;
+            Point at;
+        };
+        //! Axis-aligned bounding box.
+        struct Box
+        {
+            Point top_left;
+            Point bottom_right;
+        };
+
+        //! Append a path and its points.
+        //! @return Index of the path.
+        uint32_t add_path(std::vector<PathShape> &paths, const Color &c, const Point *points, size_t count);
+
+        //! Shapes in document order.
+        std::vector<Shape> order_;
+        //! Bounding boxes, in document order.
+        std::vector<Box> boxes_;
+        std::vector<EllipseShape> ellipses_;
+        std::vector<LineShape> lines_;
+        std::vector<PathShape> polylines_;
+        std::vector<PathShape> polygons_;
+        std::vector<SpriteShape> sprites_;
+        //! Point data of all polylines and polygons.
+        std::vector<Point> points_;
+    };
+}
+#endif
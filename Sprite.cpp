@@ -0,0 +1,77 @@
+//! @file Sprite.cpp
+#include "Sprite.hpp"
+
+#include <utility>
+
+namespace svg
+{
+    namespace
+    {
+        bool same_color(const Color &a, const Color &b)
+        {
+            return a.red == b.red && a.green == b.green && a.blue == b.blue;
+        }
+    }
+
+    Sprite::Sprite(int width, int height, const std::function<void(PNGImage &)> &draw)
+        : width_(width), height_(height)
+    {
+        PNGImage on_white(width, height);
+        PNGImage on_black(width, height);
+        on_black.clear({0, 0, 0});
+        draw(on_white);
+        draw(on_black);
+        for (int y = 0; y < height; y++)
+        {
+            int x = 0;
+            while (x < width)
+            {
+                if (!same_color(on_white.at(x, y), on_black.at(x, y)))
+                {
+                    x++;
+                    continue;
+                }
+                Run run = {x, y, 0, (uint32_t)pixels_.size()};
+                for (; x < width && same_color(on_white.at(x, y), on_black.at(x, y)); x++)
+                {
+                    pixels_.push_back(on_white.at(x, y));
+                }
+                run.count = x - run.x;
+                runs_.push_back(run);
+            }
+        }
+    }
+
+    Sprite::Sprite(int width, int height, std::vector<Run> runs, std::vector<Color> pixels)
+        : width_(width), height_(height), runs_(std::move(runs)), pixels_(std::move(pixels))
+    {
+    }
+
+    int Sprite::width() const
+    {
+        return width_;
+    }
+
+    int Sprite::height() const
+    {
+        return height_;
+    }
+
+    const std::vector<Sprite::Run> &Sprite::runs() const
+    {
+        return runs_;
+    }
+
+    const std::vector<Color> &Sprite::pixels() const
+    {
+        return pixels_;
+    }
+
+    void Sprite::blit(PNGImage &img, const Point &at) const
+    {
+        for (const Run &run : runs_)
+        {
+            img.copy_span(at.x + run.x, at.y + run.y, &pixels_[run.first], run.count);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+//! @file Sprite.hpp
+#ifndef __svg_Sprite_hpp__
+#define __svg_Sprite_hpp__
+
+#include "Color.hpp"
+#include "Point.hpp"
+#include "PNGImage.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace svg
+{
+    //! Pre-rasterized group of shapes.
+    //! Only the pixels covered by the shapes are kept, as horizontal
+    //! runs, so drawing a sprite copies each run with one memcpy and
+    //! leaves the uncovered pixels untouched.
+    class Sprite
+    {
+    public:
+        //! Run of covered pixels in a row.
+        struct Run
+        {
+            int x;
+            int y;
+            int count;
+            //! Index of the first pixel in pixels().
+            uint32_t first;
+        };
+
+        //! Rasterize a sprite.
+        //! The drawing function is called twice, on a white and on a black
+        //! canvas of the given size; the pixels that come out the same on
+        //! both are the ones it covers, the others are transparent.
+        //! @param width Sprite width.
+        //! @param height Sprite height.
+        //! @param draw Function drawing the shapes.
+        Sprite(int width, int height, const std::function<void(PNGImage &)> &draw);
+        //! Constructor from previously rasterized data (see runs() and pixels()).
+        //! @param width Sprite width.
+        //! @param height Sprite height.
+        //! @param runs Runs of covered pixels.
+        //! @param pixels Colors of the covered pixels.
+        Sprite(int width, int height, std::vector<Run> runs, std::vector<Color> pixels);
+        //! Get sprite width.
+        //! @return The sprite width.
+        int width() const;
+        //! Get sprite height.
+        //! @return The sprite height.
+        int height() const;
+        //! Get the runs of covered pixels, in row order.
+        //! @return The runs.
+        const std::vector<Run> &runs() const;
+        //! Get the colors of the covered pixels.
+        //! @return The colors.
+        const std::vector<Color> &pixels() const;
+        //! Copy the covered pixels to an image.
+        //! The sprite is clipped to the image (or view) bounds.
+        //! @param img Image to draw on.
+        //! @param at Position of the sprite's upper-left corner.
+        void blit(PNGImage &img, const Point &at) const;
+
+    private:
+        //! Width.
+        int width_;
+        //! Height.
+        int height_;
+        //! Covered pixels, in row order.
+        std::vector<Run> runs_;
+        //! Colors of the covered pixels.
+        std::vector<Color> pixels_;
+    };
+}
+#endif
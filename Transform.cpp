@@ -0,0 +1,203 @@
+//! @file Transform.cpp
+#include "Transform.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace svg
+{
+    Transform Transform::identity()
+    {
+        return {1, 0, 0, 1, 0, 0};
+    }
+
+    Transform Transform::translation(double tx, double ty)
+    {
+        return {1, 0, 0, 1, tx, ty};
+    }
+
+    Transform Transform::rotation(double degrees)
+    {
+        double s, c;
+        // Reduced first: huge angles have no quarter turns in a long long.
+        degrees = std::fmod(degrees, 360.0);
+        double quarter_turns = degrees / 90.0;
+        if (quarter_turns == ::floor(quarter_turns))
+        {
+            static const double SIN[] = {0, 1, 0, -1};
+            long long k = ((long long)quarter_turns % 4 + 4) % 4;
+            s = SIN[k];
+            c = SIN[(k + 1) % 4];
+        }
+        else
+        {
+            double angle = M_PI * degrees / 180.0;
+            s = ::sin(angle);
+            c = ::cos(angle);
+        }
+        return {c, s, -s, c, 0, 0};
+    }
+
+    Transform Transform::scaling(double sx, double sy)
+    {
+        return {sx, 0, 0, sy, 0, 0};
+    }
+
+    Transform Transform::operator*(const Transform &t) const
+    {
+        return {a * t.a + c * t.b,
+                b * t.a + d * t.b,
+                a * t.c + c * t.d,
+                b * t.c + d * t.d,
+                a * t.e + c * t.f + e,
+                b * t.e + d * t.f + f};
+    }
+
+    bool Transform::is_identity() const
+    {
+        return a == 1 && b == 0 && c == 0 && d == 1 && e == 0 && f == 0;
+    }
+
+    bool Transform::is_integer_translation() const
+    {
+        return a == 1 && b == 0 && c == 0 && d == 1 &&
+               e == ::floor(e) && f == ::floor(f) &&
+               std::fabs(e) <= INT_MAX && std::fabs(f) <= INT_MAX;
+    }
+
+    Point Transform::apply(const Point &p) const
+    {
+        return {round_to_pixel(a * p.x + c * p.y + e),
+                round_to_pixel(b * p.x + d * p.y + f)};
+    }
+
+    int round_to_pixel(double v)
+    {
+        if (std::isnan(v))
+        {
+            return 0;
+        }
+        return (int)::lround(std::max<double>(INT_MIN, std::min<double>(INT_MAX, v)));
+    }
+
+    namespace
+    {
+        bool is_separator(char ch)
+        {
+            return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == ',';
+        }
+
+        // Parse up to max_args numbers from a '(' ... ')' argument list.
+        // Returns the position after ')' and the number of arguments read.
+        const char *parse_args(const char *p, double *args, int max_args, int &n)
+        {
+            while (is_separator(*p))
+            {
+                p++;
+            }
+            if (*p != '(')
+            {
+                throw std::runtime_error("Invalid transform: expected '('");
+            }
+            p++;
+            n = 0;
+            while (true)
+            {
+                while (is_separator(*p))
+                {
+                    p++;
+                }
+                if (*p == ')')
+                {
+                    return p + 1;
+                }
+                char *end;
+                double v = ::strtod(p, &end);
+                // strtod() also reads "inf" and "nan", and overflows to
+                // infinity.
+                if (end == p || n == max_args || !std::isfinite(v))
+                {
+                    throw std::runtime_error("Invalid transform arguments");
+                }
+                args[n++] = v;
+                p = end;
+            }
+        }
+    }
+
+    Transform parse_transform(const char *transform, const char *origin)
+    {
+        Transform t = Transform::identity();
+        const char *p = transform != nullptr ? transform : "";
+        while (true)
+        {
+            while (is_separator(*p))
+            {
+                p++;
+            }
+            if (*p == '\0')
+            {
+                break;
+            }
+            const char *name = p;
+            while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))
+            {
+                p++;
+            }
+            std::string fn(name, p - name);
+            double args[6];
+            int n;
+            p = parse_args(p, args, 6, n);
+            Transform step;
+            if (fn == "translate" && (n == 1 || n == 2))
+            {
+                step = Transform::translation(args[0], n == 2 ? args[1] : 0);
+            }
+            else if (fn == "scale" && (n == 1 || n == 2))
+            {
+                step = Transform::scaling(args[0], n == 2 ? args[1] : args[0]);
+            }
+            else if (fn == "rotate" && (n == 1 || n == 3))
+            {
+                step = Transform::rotation(args[0]);
+                if (n == 3)
+                {
+                    step = Transform::translation(args[1], args[2]) * step *
+                           Transform::translation(-args[1], -args[2]);
+                }
+            }
+            else if (fn == "matrix" && n == 6)
+            {
+                step = {args[0], args[1], args[2], args[3], args[4], args[5]};
+            }
+            else
+            {
+                throw std::runtime_error("Unsupported transform: " + std::string(transform));
+            }
+            // Transforms in a list apply right to left.
+            t = t * step;
+        }
+        if (origin != nullptr && !t.is_identity())
+        {
+            char *end;
+            double ox = ::strtod(origin, &end);
+            const char *q = end;
+            while (is_separator(*q))
+            {
+                q++;
+            }
+            double oy = *q != '\0' ? ::strtod(q, &end) : ox;
+            if (!std::isfinite(ox) || !std::isfinite(oy))
+            {
+                throw std::runtime_error("Invalid transform-origin: " + std::string(origin));
+            }
+            t = Transform::translation(ox, oy) * t * Transform::translation(-ox, -oy);
+        }
+        return t;
+    }
+}
@@ -0,0 +1,67 @@
+//! @file Transform.hpp
+#ifndef __svg_Transform_hpp__
+#define __svg_Transform_hpp__
+
+#include "Point.hpp"
+
+namespace svg
+{
+    //! 2D affine transformation (2x3 matrix), mapping (x, y) to
+    //! (a x + c y + e, b x + d y + f), as in SVG's matrix(a b c d e f).
+    struct Transform
+    {
+        double a, b, c, d, e, f;
+
+        //! Get the identity transformation.
+        //! @return Identity.
+        static Transform identity();
+        //! Get a translation.
+        //! @param tx X offset.
+        //! @param ty Y offset.
+        //! @return Translation.
+        static Transform translation(double tx, double ty);
+        //! Get a rotation around the origin.
+        //! Multiples of 90 degrees are exact.
+        //! @param degrees Clockwise angle (y axis points down).
+        //! @return Rotation.
+        static Transform rotation(double degrees);
+        //! Get a scaling around the origin.
+        //! @param sx X factor.
+        //! @param sy Y factor.
+        //! @return Scaling.
+        static Transform scaling(double sx, double sy);
+
+        //! Compose with another transformation.
+        //! @param t Transformation applied first.
+        //! @return This transformation applied after t.
+        Transform operator*(const Transform &t) const;
+        //! Check for the identity transformation.
+        //! @return true if this is the identity.
+        bool is_identity() const;
+        //! Check whether this is a translation by whole pixels.
+        //! @return true if the linear part is the identity and e, f are
+        //! integers (in the range of int).
+        bool is_integer_translation() const;
+        //! Transform a point, rounding the result to the nearest pixel.
+        //! @param p Point.
+        //! @return Transformed point (see round_to_pixel()).
+        Point apply(const Point &p) const;
+    };
+
+    //! Round a coordinate to the nearest int, saturating rather than
+    //! overflowing (as parse_points() does). Products of huge matrix
+    //! entries may be infinite, or NaN, which gives 0.
+    //! @param v Coordinate.
+    //! @return Rounded coordinate.
+    int round_to_pixel(double v);
+
+    //! Compile SVG transform attributes into a matrix.
+    //! Supports lists of translate, rotate, scale and matrix
+    //! (separated by whitespace or commas), and a transform-origin
+    //! given as "x y" in user units.
+    //! @param transform Value of 'transform' (may be nullptr).
+    //! @param origin Value of 'transform-origin' (may be nullptr).
+    //! @return The transformation.
+    Transform parse_transform(const char *transform, const char *origin);
+}
+#endif
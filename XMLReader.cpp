@@ -0,0 +1,354 @@
+//! @file XMLReader.cpp
+#include "XMLReader.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace svg
+{
+    namespace
+    {
+        bool is_space(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+
+        bool is_name_char(char c)
+        {
+            return !is_space(c) && c != '/' && c != '>' && c != '=';
+        }
+
+        bool starts_with(const char *p, const char *end, const char *prefix)
+        {
+            size_t n = ::strlen(prefix);
+            return (size_t)(end - p) >= n && ::memcmp(p, prefix, n) == 0;
+        }
+
+        // Find a string in [p, end), or return nullptr.
+        const char *find(const char *p, const char *end, const char *s)
+        {
+            size_t n = ::strlen(s);
+            while ((size_t)(end - p) >= n)
+            {
+                const char *q = static_cast<const char *>(::memchr(p, s[0], end - p - n + 1));
+                if (q == nullptr)
+                {
+                    return nullptr;
+                }
+                if (::memcmp(q, s, n) == 0)
+                {
+                    return q;
+                }
+                p = q + 1;
+            }
+            return nullptr;
+        }
+
+        // Append a code point in UTF-8.
+        void append_utf8(std::string &out, unsigned long cp)
+        {
+            if (cp < 0x80)
+            {
+                out += (char)cp;
+            }
+            else if (cp < 0x800)
+            {
+                out += (char)(0xC0 | (cp >> 6));
+                out += (char)(0x80 | (cp & 0x3F));
+            }
+            else if (cp < 0x10000)
+            {
+                out += (char)(0xE0 | (cp >> 12));
+                out += (char)(0x80 | ((cp >> 6) & 0x3F));
+                out += (char)(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                out += (char)(0xF0 | (cp >> 18));
+                out += (char)(0x80 | ((cp >> 12) & 0x3F));
+                out += (char)(0x80 | ((cp >> 6) & 0x3F));
+                out += (char)(0x80 | (cp & 0x3F));
+            }
+        }
+    }
+
+    XMLReader::XMLReader(const char *data, size_t size, size_t offset)
+        : data_(data), end_(data + size), pos_(data + offset),
+          tag_(nullptr), name_(nullptr), name_length_(0), pending_end_(false)
+    {
+    }
+
+    XMLReader::Event XMLReader::next()
+    {
+        attributes_.clear();
+        values_.clear();
+        if (pending_end_)
+        {
+            pending_end_ = false;
+            return END_TAG;
+        }
+        while (true)
+        {
+            // Text is skipped: it cannot contain a raw '<'.
+            const char *lt = pos_ < end_ ? static_cast<const char *>(::memchr(pos_, '<', end_ - pos_)) : nullptr;
+            if (lt == nullptr)
+            {
+                pos_ = end_;
+                if (!open_.empty())
+                {
+                    fail();
+                }
+                return END_OF_DOCUMENT;
+            }
+            pos_ = lt;
+            if (starts_with(pos_, end_, "<!--"))
+            {
+                skip_past("-->");
+            }
+            else if (starts_with(pos_, end_, "<![CDATA["))
+            {
+                skip_past("]]>");
+            }
+            else if (starts_with(pos_, end_, "<?"))
+            {
+                skip_past("?>");
+            }
+            else if (starts_with(pos_, end_, "<!"))
+            {
+                // DOCTYPE (or other declaration), maybe with an internal subset.
+                int depth = 0;
+                char quote = 0;
+                for (pos_ += 2; pos_ < end_; pos_++)
+                {
+                    char c = *pos_;
+                    if (quote != 0)
+                    {
+                        quote = c == quote ? 0 : quote;
+                    }
+                    else if (c == '"' || c == '\'')
+                    {
+                        quote = c;
+                    }
+                    else if (c == '[')
+                    {
+                        depth++;
+                    }
+                    else if (c == ']')
+                    {
+                        depth--;
+                    }
+                    else if (c == '>' && depth <= 0)
+                    {
+                        break;
+                    }
+                }
+                if (pos_ == end_)
+                {
+                    fail();
+                }
+                pos_++;
+            }
+            else
+            {
+                break;
+            }
+        }
+        tag_ = pos_;
+        bool end_tag = pos_ + 1 < end_ && pos_[1] == '/';
+        pos_ += end_tag ? 2 : 1;
+        name_ = pos_;
+        while (pos_ < end_ && is_name_char(*pos_))
+        {
+            pos_++;
+        }
+        name_length_ = pos_ - name_;
+        if (name_length_ == 0)
+        {
+            fail();
+        }
+        if (end_tag)
+        {
+            while (pos_ < end_ && is_space(*pos_))
+            {
+                pos_++;
+            }
+            if (pos_ == end_ || *pos_ != '>' || open_.empty() ||
+                open_.back().second != name_length_ ||
+                ::memcmp(open_.back().first, name_, name_length_) != 0)
+            {
+                fail();
+            }
+            pos_++;
+            open_.pop_back();
+            return END_TAG;
+        }
+        parse_attributes();
+        if (!pending_end_)
+        {
+            open_.push_back({name_, name_length_});
+        }
+        return START_TAG;
+    }
+
+    void XMLReader::parse_attributes()
+    {
+        while (true)
+        {
+            while (pos_ < end_ && is_space(*pos_))
+            {
+                pos_++;
+            }
+            if (pos_ == end_)
+            {
+                fail();
+            }
+            if (*pos_ == '>')
+            {
+                pos_++;
+                return;
+            }
+            if (*pos_ == '/')
+            {
+                if (pos_ + 1 == end_ || pos_[1] != '>')
+                {
+                    fail();
+                }
+                pos_ += 2;
+                pending_end_ = true;
+                return;
+            }
+            Attribute a;
+            a.name = pos_;
+            while (pos_ < end_ && is_name_char(*pos_))
+            {
+                pos_++;
+            }
+            a.name_length = pos_ - a.name;
+            while (pos_ < end_ && is_space(*pos_))
+            {
+                pos_++;
+            }
+            if (a.name_length == 0 || pos_ == end_ || *pos_ != '=')
+            {
+                fail();
+            }
+            for (pos_++; pos_ < end_ && is_space(*pos_); pos_++)
+            {
+            }
+            if (pos_ == end_ || (*pos_ != '"' && *pos_ != '\''))
+            {
+                fail();
+            }
+            const char *close = static_cast<const char *>(::memchr(pos_ + 1, *pos_, end_ - pos_ - 1));
+            if (close == nullptr)
+            {
+                fail();
+            }
+            a.value = values_.size();
+            decode(pos_ + 1, close);
+            values_ += '\0';
+            attributes_.push_back(a);
+            pos_ = close + 1;
+        }
+    }
+
+    void XMLReader::decode(const char *from, const char *to)
+    {
+        while (from < to)
+        {
+            const char *amp = static_cast<const char *>(::memchr(from, '&', to - from));
+            if (amp == nullptr)
+            {
+                values_.append(from, to);
+                return;
+            }
+            values_.append(from, amp);
+            const char *semi = static_cast<const char *>(::memchr(amp, ';', to - amp));
+            std::string entity = semi != nullptr ? std::string(amp + 1, semi) : std::string();
+            if (entity == "lt")
+            {
+                values_ += '<';
+            }
+            else if (entity == "gt")
+            {
+                values_ += '>';
+            }
+            else if (entity == "amp")
+            {
+                values_ += '&';
+            }
+            else if (entity == "quot")
+            {
+                values_ += '"';
+            }
+            else if (entity == "apos")
+            {
+                values_ += '\'';
+            }
+            else if (entity.size() > 1 && entity[0] == '#')
+            {
+                bool hex = entity[1] == 'x' || entity[1] == 'X';
+                append_utf8(values_, ::strtoul(entity.c_str() + (hex ? 2 : 1), nullptr, hex ? 16 : 10));
+            }
+            else
+            {
+                // Unknown entity: keep it as is.
+                values_ += '&';
+                from = amp + 1;
+                continue;
+            }
+            from = semi + 1;
+        }
+    }
+
+    void XMLReader::skip_past(const char *terminator)
+    {
+        const char *p = find(pos_, end_, terminator);
+        if (p == nullptr)
+        {
+            fail();
+        }
+        pos_ = p + ::strlen(terminator);
+    }
+
+    void XMLReader::fail() const
+    {
+        throw std::runtime_error("Malformed XML at offset " + std::to_string(pos_ - data_));
+    }
+
+    bool XMLReader::is(const char *name) const
+    {
+        return ::strlen(name) == name_length_ && ::memcmp(name, name_, name_length_) == 0;
+    }
+
+    size_t XMLReader::offset() const
+    {
+        return tag_ - data_;
+    }
+
+    const char *XMLReader::attribute(const char *name) const
+    {
+        size_t n = ::strlen(name);
+        for (const Attribute &a : attributes_)
+        {
+            if (a.name_length == n && ::memcmp(a.name, name, n) == 0)
+            {
+                return values_.c_str() + a.value;
+            }
+        }
+        return nullptr;
+    }
+
+    float XMLReader::float_attribute(const char *name) const
+    {
+        const char *v = attribute(name);
+        return v != nullptr ? ::strtof(v, nullptr) : 0;
+    }
+
+    int XMLReader::int_attribute(const char *name) const
+    {
+        const char *v = attribute(name);
+        return v != nullptr ? (int)::strtol(v, nullptr, 10) : 0;
+    }
+}
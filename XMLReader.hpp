@@ -0,0 +1,99 @@
+//! @file XMLReader.hpp
+#ifndef __svg_XMLReader_hpp__
+#define __svg_XMLReader_hpp__
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace svg
+{
+    //! Pull (streaming) XML parser over a buffer.
+    //! It reports start and end tags in document order and skips text,
+    //! comments, CDATA sections, processing instructions and DOCTYPE
+    //! declarations, without building a tree. Self-closing tags are
+    //! reported as a start tag followed by an end tag.
+    //! Only the attributes of the current tag are kept, in a buffer that
+    //! is reused, so reading a document does not allocate once warm.
+    class XMLReader
+    {
+    public:
+        //! Parsing events.
+        enum Event
+        {
+            START_TAG,
+            END_TAG,
+            END_OF_DOCUMENT
+        };
+        //! Constructor.
+        //! @param data Document (need not be NUL-terminated).
+        //! @param size Document size.
+        //! @param offset Where to start reading (e.g. a previous offset()).
+        XMLReader(const char *data, size_t size, size_t offset = 0);
+        //! Advance to the next tag. Throws on malformed XML.
+        //! @return The event.
+        Event next();
+        //! Check the name of the current tag.
+        //! @param name Name.
+        //! @return true if the tag has that name.
+        bool is(const char *name) const;
+        //! Get the offset of the current tag in the document.
+        //! @return Offset of its '<'.
+        size_t offset() const;
+        //! Get an attribute of the current start tag (entities decoded).
+        //! The value is only valid until the next call to next().
+        //! @param name Attribute name.
+        //! @return The value, or nullptr if not present.
+        const char *attribute(const char *name) const;
+        //! Get a numeric attribute of the current start tag.
+        //! @param name Attribute name.
+        //! @return The value, or 0 if not present or invalid.
+        float float_attribute(const char *name) const;
+        //! Get an integer attribute of the current start tag.
+        //! @param name Attribute name.
+        //! @return The value, or 0 if not present or invalid.
+        int int_attribute(const char *name) const;
+
+    private:
+        //! Attribute of the current tag.
+        struct Attribute
+        {
+            const char *name;
+            size_t name_length;
+            //! Offset of the (NUL-terminated) value in values_.
+            size_t value;
+        };
+
+        //! Parse a start tag; pos_ is past the name.
+        void parse_attributes();
+        //! Append an attribute value to values_, decoding entities.
+        void decode(const char *from, const char *to);
+        //! Skip to after the given terminator.
+        void skip_past(const char *terminator);
+        //! Throw an exception for malformed input at pos_.
+        [[noreturn]] void fail() const;
+
+        //! Document.
+        const char *data_;
+        //! End of the document.
+        const char *end_;
+        //! Parsing position.
+        const char *pos_;
+        //! Current tag.
+        const char *tag_;
+        //! Name of the current tag.
+        const char *name_;
+        size_t name_length_;
+        //! Whether the current start tag was self-closing
+        //! (its end tag is reported by the next call).
+        bool pending_end_;
+        //! Names of the open elements (to match end tags).
+        std::vector<std::pair<const char *, size_t>> open_;
+        //! Attributes of the current tag.
+        std::vector<Attribute> attributes_;
+        //! Attribute values.
+        std::string values_;
+    };
+}
+#endif
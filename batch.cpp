@@ -0,0 +1,101 @@
+//! @file batch.cpp
+#include "batch.hpp"
+#include "SVGElements.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <thread>
+
+namespace svg
+{
+    namespace
+    {
+        void batch_worker(std::vector<BatchJob> &jobs, std::atomic<size_t> &next, RenderCache *cache,
+                          const PNGOptions &png)
+        {
+            PNGImage img(1, 1);
+            Arena arena;
+            size_t i;
+            while ((i = next++) < jobs.size())
+            {
+                BatchJob &job = jobs[i];
+                try
+                {
+                    if (cache != nullptr)
+                    {
+                        convert(job.svg_file, job.png_file, img, arena, *cache, png);
+                    }
+                    else
+                    {
+                        convert(job.svg_file, job.png_file, img, arena, png);
+                    }
+                    job.success = true;
+                }
+                catch (const std::exception &e)
+                {
+                    job.success = false;
+                    job.error = e.what();
+                }
+            }
+        }
+    }
+
+    void convert_batch(std::vector<BatchJob> &jobs, unsigned workers, RenderCache *cache,
+                       const PNGOptions &png)
+    {
+        PNGOptions options = png;
+        if (options.threads == 0)
+        {
+            options.threads = 1;
+        }
+        if (workers == 0)
+        {
+            workers = std::max(1u, std::thread::hardware_concurrency());
+        }
+        if (workers > jobs.size())
+        {
+            workers = jobs.size();
+        }
+        for (BatchJob &job : jobs)
+        {
+            job.success = false;
+            job.error.clear();
+        }
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < workers; t++)
+        {
+            pool.push_back(std::thread(batch_worker, std::ref(jobs), std::ref(next), cache, std::cref(options)));
+        }
+        // The calling thread also takes part in the work.
+        batch_worker(jobs, next, cache, options);
+        for (std::thread &t : pool)
+        {
+            t.join();
+        }
+    }
+
+    bool parse_workers(const std::string &text, unsigned &workers)
+    {
+        // strtoul() takes leading spaces and signs (wrapping negative
+        // numbers around): only digits are accepted.
+        if (text.empty() || text[0] < '0' || text[0] > '9')
+        {
+            return false;
+        }
+        char *end;
+        errno = 0;
+        const unsigned long value = ::strtoul(text.c_str(), &end, 10);
+        if (*end != '\0' || errno == ERANGE || value == 0 || value > UINT_MAX)
+        {
+            return false;
+        }
+        workers = (unsigned)value;
+        return true;
+    }
+}
@@ -0,0 +1,43 @@
+//! @file batch.hpp
+#ifndef __svg_batch_hpp__
+#define __svg_batch_hpp__
+
+#include "RenderCache.hpp"
+#include "encode.hpp"
+
+#include <string>
+#include <vector>
+
+namespace svg
+{
+    //! A single conversion in a batch.
+    struct BatchJob
+    {
+        //! Input SVG file.
+        std::string svg_file;
+        //! Output PNG file.
+        std::string png_file;
+        //! Set once the job completes without errors.
+        bool success = false;
+        //! Error message when the job fails.
+        std::string error;
+    };
+
+    //! Convert a list of SVG files using a pool of worker threads.
+    //! Each worker keeps its own image buffer, reused across
+    //! consecutive conversions of the same canvas size, and its
+    //! own parsing arena, reused for every document.
+    //! @param jobs Jobs to run (results are stored in place).
+    //! @param workers Number of worker threads (0 means one per core).
+    //! @param cache Cache of rendered files shared by the workers (optional).
+    //! @param png PNG encoder settings. Unless set, each file is encoded
+    //! on a single thread, since the workers already keep all cores busy.
+    void convert_batch(std::vector<BatchJob> &jobs, unsigned workers, RenderCache *cache = nullptr,
+                       const PNGOptions &png = PNGOptions());
+    //! Parse a number of workers (a positive decimal number).
+    //! @param text Number.
+    //! @param workers Parsed number.
+    //! @return false if the text is not such a number.
+    bool parse_workers(const std::string &text, unsigned &workers);
+}
+#endif
@@ -0,0 +1,1183 @@
+// Rasterizer micro-benchmarks, and a benchmark of whole conversions
+// over a corpus of SVG files.
+#include "SVGElements.hpp"
+#include "diff.hpp"
+#include "encode.hpp"
+#include "fill.hpp"
+#include "tiles.hpp"
+#include "external/stb/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "external/stb/stb_image_write.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX headers
+#include <dirent.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace svg;
+
+namespace
+{
+    // A measurement, for the machine-readable output (--json).
+    struct Result
+    {
+        string bench;
+        string name;
+        string metric;
+        double value;
+    };
+    vector<Result> results;
+
+    void report(const string &bench, const string &name, const string &metric, double value)
+    {
+        results.push_back({bench, name, metric, value});
+    }
+
+    string json_string(const string &str)
+    {
+        string out = "\"";
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + "\"";
+    }
+
+    // Write the measurements as JSON lines, one object per measurement.
+    bool write_results(const string &file)
+    {
+        ofstream out(file);
+        for (const Result &r : results)
+        {
+            out << "{\"bench\":" << json_string(r.bench) << ",\"name\":" << json_string(r.name)
+                << ",\"metric\":" << json_string(r.metric) << ",\"value\":" << r.value << "}" << endl;
+        }
+        if (!out)
+        {
+            cerr << "Unable to write " << file << endl;
+        }
+        return (bool)out;
+    }
+
+    // Scanline fill used by PNGImage::draw_polygon before the active edge table:
+    // every edge is tested on every row, and intersections are sorted per row.
+    void legacy_draw_polygon(PNGImage &img, const vector<Point> &points, const Color &c)
+    {
+        int y_min = img.height(), y_max = 0;
+        for (const Point &p : points)
+        {
+            y_min = min(y_min, p.y);
+            y_max = max(y_max, p.y);
+        }
+        vector<double> seg;
+        for (int y = y_min; y < y_max; y++)
+        {
+            for (size_t i = 0; i < points.size(); i++)
+            {
+                Point a = points[i];
+                Point b = points[(i + 1) % points.size()];
+                if (y < min(a.y, b.y) || y > max(a.y, b.y))
+                {
+                    continue;
+                }
+                if (a.y != b.y)
+                {
+                    seg.push_back((double)(y - a.y) * (b.x - a.x) / (double)(b.y - a.y) + a.x);
+                }
+            }
+            sort(seg.begin(), seg.end());
+            size_t i_s = 0;
+            while ((i_s + 1) < seg.size())
+            {
+                Point a = {(int)round(seg.at(i_s)), y};
+                Point b = {(int)round(seg.at(i_s + 1)), y};
+                if (a.x == b.x)
+                {
+                    i_s++;
+                }
+                else
+                {
+                    img.draw_line(a, b, c);
+                    i_s += 2;
+                }
+            }
+            seg.clear();
+        }
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            img.draw_line(points[i], points[(i + 1) % points.size()], c);
+        }
+    }
+
+    // Ellipse fill used by PNGImage::draw_ellipse before the integer scan:
+    // two floating point divisions per candidate x.
+    void legacy_draw_ellipse(PNGImage &img, const Point &center, const Point &radius, const Color &fill)
+    {
+        img.fill_span(center.x - radius.x, center.x + radius.x, center.y, fill);
+        int x0 = radius.x;
+        int dx = 0;
+        for (int y = 1; y <= radius.y; y++)
+        {
+            double vy = (double)y / (double)radius.y;
+            vy *= vy;
+            int x1 = x0 - (dx - 1);
+            for (; x1 > 0; x1--)
+            {
+                double vx = (double)x1 / (double)radius.x;
+                vx *= vx;
+                if (vx + vy <= 1)
+                {
+                    break;
+                }
+            }
+            dx = x0 - x1;
+            x0 = x1;
+            img.fill_span(center.x - x0, center.x + x0, center.y - y, fill);
+            img.fill_span(center.x - x0, center.x + x0, center.y + y, fill);
+        }
+    }
+
+    // Points parser used by readSVG before parse_points(): one stringstream
+    // per attribute, plus one stringstream and two strings per pair.
+    void legacy_parse_points(const char *points_str, vector<Point> &points)
+    {
+        stringstream ss(points_str);
+        string point;
+        while (getline(ss, point, ' '))
+        {
+            stringstream ss_point(point);
+            string x_str, y_str;
+            getline(ss_point, x_str, ',');
+            getline(ss_point, y_str, ',');
+            int x = stoi(x_str);
+            int y = stoi(y_str);
+            points.push_back({x, y});
+        }
+    }
+
+    // Star-shaped polygon with n vertices inside a size x size canvas.
+    vector<Point> star_polygon(int n, int size)
+    {
+        vector<Point> points;
+        for (int i = 0; i < n; i++)
+        {
+            double angle = 2 * M_PI * i / n;
+            double r = (i % 2 == 0 ? 0.48 : 0.30) * size;
+            points.push_back({(int)(size / 2 + r * cos(angle)), (int)(size / 2 + r * sin(angle))});
+        }
+        return points;
+    }
+
+    // Random (self-intersecting) polygon with n vertices.
+    vector<Point> random_polygon(int n, int size)
+    {
+        vector<Point> points;
+        for (int i = 0; i < n; i++)
+        {
+            points.push_back({rand() % size, rand() % size});
+        }
+        return points;
+    }
+
+    bool same_pixels(const PNGImage &a, const PNGImage &b)
+    {
+        for (int y = 0; y < a.height(); y++)
+        {
+            for (int x = 0; x < a.width(); x++)
+            {
+                Color ca = a.at(x, y), cb = b.at(x, y);
+                if (ca.red != cb.red || ca.green != cb.green || ca.blue != cb.blue)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Average time of one call to f, in microseconds.
+    template <typename F>
+    double time_us(F f, int reps)
+    {
+        auto t0 = chrono::steady_clock::now();
+        for (int i = 0; i < reps; i++)
+        {
+            f();
+        }
+        auto t1 = chrono::steady_clock::now();
+        return chrono::duration<double, micro>(t1 - t0).count() / reps;
+    }
+
+    bool bench_fill_kernels()
+    {
+        const Color fill = {200, 100, 50};
+        bool avx2 = avx2_supported();
+        bool ok = true;
+        cout << "== fill kernels (Gpixel/s) ==" << endl
+             << setw(10) << "width" << setw(10) << "scalar" << setw(10) << "sse2"
+             << setw(10) << "avx2" << setw(10) << "auto" << endl;
+        for (int w = 16; w <= 16384; w *= 2)
+        {
+            vector<Color> row(w), expected(w, fill);
+            int reps = max(1, (1 << 24) / w);
+            double t_scalar = time_us([&]() { fill_pixels_scalar(row.data(), w, fill); }, reps);
+            ok = ok && ::memcmp(row.data(), expected.data(), w * sizeof(Color)) == 0;
+            row.assign(w, Color{0, 0, 0});
+            double t_sse2 = time_us([&]() { fill_pixels_sse2(row.data(), w, fill); }, reps);
+            ok = ok && ::memcmp(row.data(), expected.data(), w * sizeof(Color)) == 0;
+            double t_avx2 = 0;
+            if (avx2)
+            {
+                row.assign(w, Color{0, 0, 0});
+                t_avx2 = time_us([&]() { fill_pixels_avx2(row.data(), w, fill); }, reps);
+                ok = ok && ::memcmp(row.data(), expected.data(), w * sizeof(Color)) == 0;
+            }
+            double t_auto = time_us([&]() { fill_pixels(row.data(), w, fill); }, reps);
+            double gpix = w / 1000.0;
+            cout << setw(10) << w << fixed << setprecision(2)
+                 << setw(10) << gpix / t_scalar << setw(10) << gpix / t_sse2;
+            if (avx2)
+            {
+                cout << setw(10) << gpix / t_avx2;
+            }
+            else
+            {
+                cout << setw(10) << "n/a";
+            }
+            cout << setw(10) << gpix / t_auto << endl;
+            report("fill_pixels", to_string(w), "Gpixel/s", gpix / t_auto);
+        }
+        if (!ok)
+        {
+            cout << "FILL KERNELS PRODUCED WRONG PIXELS" << endl;
+        }
+        return ok;
+    }
+
+    void bench_span()
+    {
+        const int height = 64;
+        const Color fill = {200, 100, 50};
+        cout << "== fill_span (" << height << " rows) ==" << endl
+             << setw(10) << "width" << setw(16) << "draw_line(MP/s)"
+             << setw(16) << "fill_span(MP/s)" << setw(10) << "speedup" << endl;
+        for (int w = 16; w <= 16384; w *= 4)
+        {
+            PNGImage img(w, height);
+            int reps = max(1, (1 << 22) / (w * height));
+            double t_line = time_us([&]()
+                                    {
+                for (int y = 0; y < height; y++)
+                {
+                    img.draw_line({0, y}, {w - 1, y}, fill);
+                } }, reps);
+            double t_span = time_us([&]()
+                                    {
+                for (int y = 0; y < height; y++)
+                {
+                    img.fill_span(0, w - 1, y, fill);
+                } }, reps);
+            double pixels = (double)w * height;
+            cout << setw(10) << w << fixed << setprecision(1)
+                 << setw(16) << pixels / t_line << setw(16) << pixels / t_span
+                 << setw(9) << t_line / t_span << "x" << endl;
+            report("fill_span", to_string(w), "Mpixel/s", pixels / t_span);
+        }
+    }
+
+    bool bench_ellipse()
+    {
+        const Color fill = {20, 200, 150};
+        bool ok = true;
+        cout << "== draw_ellipse ==" << endl
+             << setw(12) << "radius" << setw(14) << "legacy(us)" << setw(14) << "int(us)"
+             << setw(10) << "speedup" << setw(16) << "rotated 30(us)" << endl;
+        for (int r = 8; r <= 2048; r *= 4)
+        {
+            int size = 2 * r + 1;
+            Point center = {r, r}, radius = {r, r * 2 / 3};
+            PNGImage legacy(size, size), scan(size, size), rotated(size, size);
+            int reps = max(1, (1 << 16) / r);
+            double t_legacy = time_us([&]() { legacy_draw_ellipse(legacy, center, radius, fill); }, reps);
+            double t_scan = time_us([&]() { scan.draw_ellipse(center, radius, fill); }, reps);
+            double t_rotated = time_us([&]() { rotated.draw_ellipse(center, radius, 30.0, fill); }, reps);
+            bool same = same_pixels(legacy, scan);
+            ok = ok && same;
+            cout << setw(12) << (to_string(radius.x) + "x" + to_string(radius.y))
+                 << fixed << setprecision(1)
+                 << setw(14) << t_legacy << setw(14) << t_scan
+                 << setw(9) << t_legacy / t_scan << "x" << setw(16) << t_rotated
+                 << (same ? "" : "  PIXELS DIFFER") << endl;
+            report("draw_ellipse", to_string(radius.x) + "x" + to_string(radius.y), "us", t_scan);
+            report("draw_ellipse", to_string(radius.x) + "x" + to_string(radius.y) + " rotated", "us", t_rotated);
+        }
+        return ok;
+    }
+
+    bool bench_points()
+    {
+        bool ok = true;
+        cout << "== points parsing ==" << endl
+             << setw(10) << "pairs" << setw(14) << "legacy(us)" << setw(14) << "new(us)"
+             << setw(10) << "speedup" << setw(12) << "MB/s" << endl;
+        for (int n = 16; n <= 262144; n *= 8)
+        {
+            string str;
+            for (int i = 0; i < n; i++)
+            {
+                str += (i > 0 ? " " : "") + to_string(rand() % 2000) + "," + to_string(rand() % 2000);
+            }
+            vector<Point> legacy, fast;
+            int reps = max(1, (1 << 20) / n);
+            double t_legacy = time_us([&]()
+                                      { legacy.clear(); legacy_parse_points(str.c_str(), legacy); }, reps);
+            double t_fast = time_us([&]()
+                                    { vector<Point> points; parse_points(str.c_str(), points); fast.swap(points); }, reps);
+            bool same = legacy.size() == fast.size();
+            for (size_t i = 0; same && i < fast.size(); i++)
+            {
+                same = legacy[i].x == fast[i].x && legacy[i].y == fast[i].y;
+            }
+            ok = ok && same;
+            cout << setw(10) << n << fixed << setprecision(1)
+                 << setw(14) << t_legacy << setw(14) << t_fast
+                 << setw(9) << t_legacy / t_fast << "x" << setw(12) << str.size() / t_fast
+                 << (same ? "" : "  POINTS DIFFER") << endl;
+            report("parse_points", to_string(n), "us", t_fast);
+        }
+        return ok;
+    }
+
+    // Parse-only mode: time readSVG() on the given files.
+    int bench_parse_files(int argc, char **argv)
+    {
+        cout << "== readSVG (parse only) ==" << endl
+             << setw(40) << "file" << setw(10) << "elements" << setw(14) << "time(us)" << endl;
+        for (int i = 0; i < argc; i++)
+        {
+            size_t elements = 0;
+            double t = time_us([&]()
+                               {
+                Point dimensions;
+                vector<SVGElement *> svg_elements;
+                readSVG(argv[i], dimensions, svg_elements);
+                elements = svg_elements.size();
+                for (SVGElement *e : svg_elements)
+                {
+                    delete e;
+                } }, 10);
+            cout << setw(40) << argv[i] << setw(10) << elements
+                 << fixed << setprecision(1) << setw(14) << t << endl;
+        }
+        return 0;
+    }
+
+    bool bench_scene()
+    {
+        const int size = 1024;
+        const int shapes = 200000;
+        vector<SVGElement *> svg_elements;
+        Scene scene;
+        for (int i = 0; i < shapes; i++)
+        {
+            Point p = {rand() % (size - 16), rand() % (size - 16)};
+            Color c = {(rgb_value)(rand() % 256), (rgb_value)(rand() % 256), (rgb_value)(rand() % 256)};
+            SVGElement *e;
+            switch (i % 3)
+            {
+            case 0:
+                e = new Polygon(c, {p, {p.x + 12, p.y + 3}, {p.x + 5, p.y + 14}});
+                break;
+            case 1:
+                e = new Circle(c, {p.x + 6, p.y + 6}, 5);
+                break;
+            default:
+                e = new Polyline(c, {p, {p.x + 9, p.y + 2}, {p.x + 3, p.y + 11}});
+                break;
+            }
+            svg_elements.push_back(e);
+            e->add_to(scene);
+        }
+        PNGImage by_element(size, size), by_scene(size, size);
+        double t_elements = time_us([&]()
+                                    {
+            for (SVGElement *e : svg_elements)
+            {
+                e->draw(by_element);
+            } }, 3);
+        double t_scene = time_us([&]() { scene.draw(by_scene); }, 3);
+        bool same = same_pixels(by_element, by_scene);
+        // Drawing everything once is bound by the rasterizer, so both
+        // stores cost the same. The Scene pays off where every shape is
+        // visited but few are drawn: binning by bounding box, and
+        // drawing into tiles, where most shapes are culled.
+        long sum = 0;
+        double t_bounds_elements = time_us([&]()
+                                           {
+            for (SVGElement *e : svg_elements)
+            {
+                Point top_left, bottom_right;
+                e->bounds(top_left, bottom_right);
+                sum += top_left.x + bottom_right.y;
+            } }, 5);
+        double t_bounds_scene = time_us([&]()
+                                        {
+            for (size_t i = 0; i < scene.size(); i++)
+            {
+                Point top_left, bottom_right;
+                scene.bounds(i, top_left, bottom_right);
+                sum -= top_left.x + bottom_right.y;
+            } }, 5);
+        const int tile = 128;
+        PNGImage tiled_elements(size, size), tiled_scene(size, size);
+        double t_tiles_elements = time_us([&]()
+                                          {
+            for (int y = 0; y < size; y += tile)
+            {
+                for (int x = 0; x < size; x += tile)
+                {
+                    PNGImage view(tiled_elements, x, y, x + tile, y + tile);
+                    for (SVGElement *e : svg_elements)
+                    {
+                        e->draw(view);
+                    }
+                }
+            } }, 2);
+        double t_tiles_scene = time_us([&]()
+                                       {
+            for (int y = 0; y < size; y += tile)
+            {
+                for (int x = 0; x < size; x += tile)
+                {
+                    PNGImage view(tiled_scene, x, y, x + tile, y + tile);
+                    scene.draw(view);
+                }
+            } }, 2);
+        same = same && sum == 0 && same_pixels(tiled_elements, tiled_scene);
+        cout << "== scene (" << shapes << " small shapes) ==" << endl
+             << fixed << setprecision(1)
+             << "draw    vector<SVGElement*>: " << t_elements / 1000 << " ms" << endl
+             << "        Scene:               " << t_scene / 1000 << " ms ("
+             << t_elements / t_scene << "x)" << endl
+             << "bounds  vector<SVGElement*>: " << t_bounds_elements / 1000 << " ms" << endl
+             << "        Scene:               " << t_bounds_scene / 1000 << " ms ("
+             << t_bounds_elements / t_bounds_scene << "x)" << endl
+             << "tiles   vector<SVGElement*>: " << t_tiles_elements / 1000 << " ms" << endl
+             << "        Scene:               " << t_tiles_scene / 1000 << " ms ("
+             << t_tiles_elements / t_tiles_scene << "x)" << (same ? "" : "  PIXELS DIFFER") << endl;
+        report("scene", to_string(shapes) + " shapes", "ms", t_scene / 1000);
+        report("scene", to_string(shapes) + " shapes, bounds", "ms", t_bounds_scene / 1000);
+        report("scene", to_string(shapes) + " shapes, " + to_string(tile) + "px tiles", "ms", t_tiles_scene / 1000);
+        for (SVGElement *e : svg_elements)
+        {
+            delete e;
+        }
+        return same;
+    }
+
+    bool bench_use()
+    {
+        const int size = 1024;
+        const int instances = 1000;
+        shared_ptr<Symbol> symbol = make_shared<Symbol>(true);
+        symbol->elements.push_back(new Circle({200, 0, 0}, {24, 24}, 24));
+        symbol->elements.push_back(new Circle({255, 255, 255}, {24, 24}, 16));
+        symbol->elements.push_back(new Polygon({0, 0, 200}, star_polygon(10, 48)));
+        // Each instance as a Use, and expanded into translated copies.
+        vector<SVGElement *> uses, copies;
+        for (int i = 0; i < instances; i++)
+        {
+            Transform t = Transform::translation(rand() % (size - 48), rand() % (size - 48));
+            uses.push_back(new Use(symbol));
+            uses.back()->applyTransform(t);
+            for (SVGElement *e : symbol->elements)
+            {
+                copies.push_back(e->clone());
+                copies.back()->applyTransform(t);
+            }
+        }
+        PNGImage by_copies(size, size), by_sprite(size, size);
+        double t_copies = time_us([&]()
+                                  {
+            for (SVGElement *e : copies)
+            {
+                e->draw(by_copies);
+            } }, 3);
+        double t_sprite = time_us([&]()
+                                  {
+            for (SVGElement *e : uses)
+            {
+                e->draw(by_sprite);
+            } }, 3);
+        bool same = same_pixels(by_copies, by_sprite);
+        cout << "== use (" << instances << " instances of a 3-shape symbol) ==" << endl
+             << fixed << setprecision(1)
+             << "rasterized copies: " << t_copies / 1000 << " ms" << endl
+             << "sprite blits:      " << t_sprite / 1000 << " ms ("
+             << t_copies / t_sprite << "x)" << (same ? "" : "  PIXELS DIFFER") << endl;
+        report("use", to_string(instances) + " instances", "ms", t_sprite / 1000);
+        for (SVGElement *e : uses)
+        {
+            delete e;
+        }
+        for (SVGElement *e : copies)
+        {
+            delete e;
+        }
+        return same;
+    }
+
+    bool bench_encode()
+    {
+        const int size = 2048;
+        PNGImage img(size, size);
+        // The same drawing on an indexed-color image, as convert() does
+        // for scenes with at most 256 colors.
+        std::shared_ptr<Palette> palette = std::make_shared<Palette>();
+        palette->add(Color{255, 255, 255});
+        vector<vector<Point>> polygons;
+        vector<Color> colors;
+        for (int i = 0; i < 200; i++)
+        {
+            Color c = {(unsigned char)(rand() % 256), (unsigned char)(rand() % 256), (unsigned char)(rand() % 256)};
+            polygons.push_back(random_polygon(6, size));
+            colors.push_back(c);
+            palette->add(c);
+            img.draw_polygon(polygons.back(), c);
+        }
+        PNGImage indexed(size, size, palette);
+        for (size_t i = 0; i < polygons.size(); i++)
+        {
+            indexed.draw_polygon(polygons[i], colors[i]);
+        }
+        const unsigned char *rgb = reinterpret_cast<const unsigned char *>(&img.at(0, 0));
+        bool ok = true;
+        cout << "== PNG encoding (" << size << "x" << size << ", 200 polygons) ==" << endl
+             << setw(22) << "encoder" << setw(12) << "ms" << setw(12) << "KB" << endl;
+        int stb_size = 0;
+        double t_stb = time_us([&]()
+                               { free(stbi_write_png_to_mem(rgb, size * 3, size, size, 3, &stb_size)); }, 2);
+        cout << setw(22) << "stb_image_write" << fixed << setprecision(1)
+             << setw(12) << t_stb / 1000 << setw(12) << stb_size / 1024.0 << endl;
+        for (int level : {0, 1, 6, 9})
+        {
+            for (unsigned threads : {1u, 0u})
+            {
+                PNGOptions options;
+                options.level = level;
+                options.threads = threads;
+                vector<unsigned char> png;
+                double t = time_us([&]()
+                                   { png = encode_png(rgb, size, size, options); }, 2);
+                // Decode the result, to check that it is valid.
+                int w, h, n;
+                unsigned char *decoded = stbi_load_from_memory(png.data(), (int)png.size(), &w, &h, &n, 3);
+                bool same = decoded != nullptr && w == size && h == size &&
+                            memcmp(decoded, rgb, (size_t)size * size * 3) == 0;
+                stbi_image_free(decoded);
+                ok = ok && same;
+                ostringstream name;
+                name << "level " << level << (threads == 1 ? ", 1 thread" : ", all cores");
+                cout << setw(22) << name.str() << setw(12) << t / 1000 << setw(12) << png.size() / 1024.0
+                     << "  (" << t_stb / t << "x)" << (same ? "" : "  DECODING FAILED") << endl;
+                report("encode_png", name.str(), "ms", t / 1000);
+                report("encode_png", name.str(), "KB", png.size() / 1024.0);
+            }
+        }
+        // Through the file, as convert() does.
+        const string file = "bench_save.png";
+        double t_rgb = 0;
+        for (const PNGImage *image : {&img, &indexed})
+        {
+            const bool rgb_image = image->palette() == nullptr;
+            double t_save = time_us([&]() { image->save(file); }, 2);
+            ifstream saved(file, ios::binary | ios::ate);
+            double kb = saved.tellg() / 1024.0;
+            bool same = true;
+            if (!rgb_image)
+            {
+                PNGImage decoded(file);
+                same = diff_images(img, decoded).mismatched == 0;
+                ok = ok && same;
+            }
+            ::remove(file.c_str());
+            const char *name = rgb_image ? "default" : "indexed";
+            cout << setw(22) << (string("PNGImage::save ") + name) << setw(12) << t_save / 1000 << setw(12) << kb;
+            if (rgb_image)
+            {
+                t_rgb = t_save;
+            }
+            else
+            {
+                cout << "  (" << t_rgb / t_save << "x)" << (same ? "" : "  DECODING FAILED");
+            }
+            cout << endl;
+            report("PNGImage::save", name, "ms", t_save / 1000);
+            report("PNGImage::save", name, "KB", kb);
+        }
+        return ok;
+    }
+
+    bool bench_diff()
+    {
+        const int size = 2048;
+        const size_t n = (size_t)size * size;
+        vector<Color> a(n), b;
+        for (Color &c : a)
+        {
+            c = {(rgb_value)(rand() % 256), (rgb_value)(rand() % 256), (rgb_value)(rand() % 256)};
+        }
+        b = a;
+        // A few scattered mismatches, as in a nearly passing test.
+        for (int i = 0; i < 100; i++)
+        {
+            b[rand() % n].green ^= 1 + rand() % 255;
+        }
+        int error_scalar = 0, error_sse2 = 0;
+        uint64_t count_scalar = 0, count_sse2 = 0;
+        double t_scalar = time_us([&]() { count_scalar = diff_pixels_scalar(a.data(), b.data(), n, error_scalar); }, 4);
+        double t_sse2 = time_us([&]() { count_sse2 = diff_pixels_sse2(a.data(), b.data(), n, error_sse2); }, 4);
+        bool ok = count_scalar == count_sse2 && error_scalar == error_sse2;
+        // Identical images only take the memcmp() of diff_images().
+        vector<Color> copy = a;
+        int same = 0;
+        double t_memcmp = time_us([&]() { same += ::memcmp(a.data(), copy.data(), n * sizeof(Color)) == 0; }, 4);
+        ok = ok && same == 4;
+        double mb = n * sizeof(Color) * 2 / 1e6;
+        cout << "== diff_pixels (" << size << "x" << size << ", " << count_scalar << " mismatches) ==" << endl
+             << fixed << setprecision(1)
+             << "scalar: " << mb / t_scalar * 1e6 << " MB/s" << endl
+             << "sse2:   " << mb / t_sse2 * 1e6 << " MB/s (" << t_scalar / t_sse2 << "x)"
+             << (ok ? "" : "  RESULTS DIFFER") << endl
+             << "memcmp: " << mb / t_memcmp * 1e6 << " MB/s" << endl;
+        report("diff_pixels", "scalar", "MB/s", mb / t_scalar * 1e6);
+        report("diff_pixels", "sse2", "MB/s", mb / t_sse2 * 1e6);
+        report("diff_pixels", "memcmp", "MB/s", mb / t_memcmp * 1e6);
+        return ok;
+    }
+
+    bool bench_polygon()
+    {
+        const int size = 1024;
+        const Color fill = {200, 100, 50};
+        bool ok = true;
+        cout << "== draw_polygon (" << size << "x" << size << ") ==" << endl
+             << setw(10) << "vertices" << setw(10) << "shape"
+             << setw(14) << "legacy(us)" << setw(14) << "aet(us)" << setw(10) << "speedup" << endl;
+        for (int n = 4; n <= 4096; n *= 4)
+        {
+            for (int shape = 0; shape < 2; shape++)
+            {
+                vector<Point> points = shape == 0 ? star_polygon(n, size) : random_polygon(n, size);
+                PNGImage legacy(size, size), aet(size, size);
+                int reps = max(1, 2048 / n);
+                double t_legacy = time_us([&]() { legacy_draw_polygon(legacy, points, fill); }, reps);
+                double t_aet = time_us([&]() { aet.draw_polygon(points, fill); }, reps);
+                bool same = same_pixels(legacy, aet);
+                ok = ok && same;
+                cout << setw(10) << n << setw(10) << (shape == 0 ? "star" : "random")
+                     << fixed << setprecision(1)
+                     << setw(14) << t_legacy << setw(14) << t_aet
+                     << setw(9) << t_legacy / t_aet << "x"
+                     << (same ? "" : "  PIXELS DIFFER") << endl;
+                report("draw_polygon", to_string(n) + (shape == 0 ? " star" : " random"), "us", t_aet);
+            }
+        }
+        return ok;
+    }
+
+    void bench_line()
+    {
+        const int size = 1024;
+        const Color stroke = {10, 20, 30};
+        struct Case
+        {
+            const char *name;
+            Point a, b;
+        };
+        const Case cases[] = {
+            {"short", {500, 500}, {507, 503}},
+            {"horizontal", {0, 512}, {size - 1, 512}},
+            {"vertical", {512, 0}, {512, size - 1}},
+            {"diagonal", {0, 0}, {size - 1, size - 1}},
+            {"shallow", {0, 100}, {size - 1, 400}},
+            {"clipped", {-100000, -3000}, {100000, 5000}},
+        };
+        PNGImage img(size, size);
+        cout << "== draw_line (" << size << "x" << size << ") ==" << endl
+             << setw(12) << "line" << setw(14) << "us/line" << endl;
+        for (const Case &c : cases)
+        {
+            const int length = max(abs(c.b.x - c.a.x), abs(c.b.y - c.a.y));
+            const int reps = length < 16 ? 1 << 20 : 1 << 14;
+            double t = time_us([&]() { img.draw_line(c.a, c.b, stroke); }, reps);
+            cout << setw(12) << c.name << fixed << setprecision(3) << setw(14) << t << endl;
+            report("draw_line", c.name, "us", t);
+        }
+    }
+
+    void bench_color()
+    {
+        const char *cases[] = {"red", "lightgoldenrodyellow", "#FADFAA", "#0d436f", "#abc",
+                               "rgb(250, 223, 170)", "rgb(100%, 50%, 0%)"};
+        cout << "== parse_color ==" << endl
+             << setw(22) << "color" << setw(14) << "ns/call" << endl;
+        unsigned sum = 0;
+        for (const char *str : cases)
+        {
+            const int reps = 1 << 20;
+            double t = time_us([&]() { sum += parse_color(str).red; }, reps);
+            cout << setw(22) << str << fixed << setprecision(1) << setw(14) << t * 1000 << endl;
+            report("parse_color", str, "ns", t * 1000);
+        }
+        // Keep the calls from being optimized away.
+        if (sum == 1)
+        {
+            cout << endl;
+        }
+    }
+
+    // Write a copy of an SVG file scaled up k times (canvas and shapes).
+    bool write_scaled(const string &src, const string &dst, int k)
+    {
+        ifstream in(src);
+        stringstream buffer;
+        buffer << in.rdbuf();
+        string svg = buffer.str();
+        size_t open = svg.find("<svg");
+        size_t close = svg.find('>', open);
+        size_t end = svg.rfind("</svg>");
+        if (open == string::npos || close == string::npos || end == string::npos || end < close)
+        {
+            return false;
+        }
+        string root = svg.substr(open, close - open);
+        for (const string attr : {"width", "height"})
+        {
+            size_t a = root.find(" " + attr + "=\"");
+            if (a == string::npos)
+            {
+                return false;
+            }
+            a += attr.size() + 3;
+            size_t b = root.find('"', a);
+            root.replace(a, b - a, to_string(atoi(root.c_str() + a) * k));
+        }
+        ofstream out(dst);
+        out << svg.substr(0, open) << root << "><g transform=\"scale(" << k << ")\">"
+            << svg.substr(close + 1, end - close - 1) << "</g>" << svg.substr(end);
+        return (bool)out;
+    }
+
+    // Time anti-aliased drawing against aliased drawing, shape by shape
+    // and for whole scenes (the latter with occlusion culling when
+    // aliased, as convert() draws them).
+    // Largest difference between the coverage of the pixels of an image
+    // with a shape drawn white on black, anti-aliased, and the fraction
+    // of a 16 x 16 grid of samples of each pixel inside the shape (pixel
+    // (x, y) being the unit square centered on point (x, y)).
+    double coverage_error(const PNGImage &img, const function<bool(double, double)> &inside)
+    {
+        const int grid = 16;
+        double worst = 0;
+        for (int y = 0; y < img.height(); y++)
+        {
+            for (int x = 0; x < img.width(); x++)
+            {
+                int count = 0;
+                for (int j = 0; j < grid; j++)
+                {
+                    for (int i = 0; i < grid; i++)
+                    {
+                        count += inside(x - 0.5 + (i + 0.5) / grid, y - 0.5 + (j + 0.5) / grid) ? 1 : 0;
+                    }
+                }
+                worst = max(worst, fabs(img.at(x, y).red / 255.0 - (double)count / (grid * grid)));
+            }
+        }
+        return worst;
+    }
+
+    bool bench_antialias(const string &dir)
+    {
+        const int size = 1024;
+        const Color color = {200, 100, 50};
+        // The cost of anti-aliasing (times the aliased time) is reported,
+        // not checked: wall-clock ratios vary with the machine's load.
+        AreaRasterizer rasterizer;
+        double worst = 0;
+        bool ok = true;
+        cout << "== anti-aliasing (" << size << "x" << size << ") ==" << endl
+             << setw(24) << "shape" << setw(14) << "aliased(us)" << setw(14) << "aa(us)" << setw(10) << "cost" << endl;
+        auto row = [&](const string &name, double t_aliased, double t_aa)
+        {
+            const double cost = t_aa / t_aliased;
+            worst = max(worst, cost);
+            cout << setw(24) << name << fixed << setprecision(1) << setw(14) << t_aliased << setw(14) << t_aa
+                 << setw(9) << setprecision(2) << cost << "x" << endl;
+            report("antialias", name, "us", t_aa);
+            report("antialias", name, "cost", cost);
+        };
+        // Both times are the best of a few rounds, taken in turns, so that
+        // a hiccup of the machine does not count against either.
+        auto compare = [&](const string &name, int reps, const function<void(PNGImage &)> &draw)
+        {
+            PNGImage aliased(size, size), smooth(size, size);
+            smooth.set_antialias(&rasterizer);
+            double t_aliased = 0, t_aa = 0;
+            for (int round = 0; round < 15; round++)
+            {
+                double t = time_us([&]() { draw(aliased); }, reps);
+                t_aliased = round == 0 ? t : min(t_aliased, t);
+                t = time_us([&]() { draw(smooth); }, reps);
+                t_aa = round == 0 ? t : min(t_aa, t);
+            }
+            row(name, t_aliased, t_aa);
+        };
+        for (int n = 4; n <= 256; n *= 4)
+        {
+            const vector<Point> star = star_polygon(n, size), polygon = random_polygon(n, size);
+            compare("polygon " + to_string(n) + " star", max(1, 512 / n),
+                    [&](PNGImage &img) { img.draw_polygon(star, color); });
+            compare("polygon " + to_string(n) + " random", max(1, 512 / n),
+                    [&](PNGImage &img) { img.draw_polygon(polygon, color); });
+        }
+        for (int r = 8; r <= 512; r *= 4)
+        {
+            const Point center = {size / 2, size / 2}, radius = {r, r * 2 / 3};
+            compare("ellipse " + to_string(r), max(1, (1 << 16) / r),
+                    [&](PNGImage &img) { img.draw_ellipse(center, radius, color); });
+            compare("ellipse " + to_string(r) + " rotated", max(1, (1 << 16) / r),
+                    [&](PNGImage &img) { img.draw_ellipse(center, radius, 30.0, color); });
+        }
+        compare("line shallow", 1 << 12, [&](PNGImage &img) { img.draw_line({0, 100}, {size - 1, 400}, color); });
+        compare("line diagonal", 1 << 12, [&](PNGImage &img) { img.draw_line({0, 0}, {size - 1, size - 1}, color); });
+        // Small shapes, where edges are most of the pixels.
+        Scene small;
+        for (int i = 0; i < 20000; i++)
+        {
+            Point p = {rand() % (size - 16), rand() % (size - 16)};
+            Color c = {(rgb_value)(rand() % 256), (rgb_value)(rand() % 256), (rgb_value)(rand() % 256)};
+            if (i % 2 == 0)
+            {
+                small.add_polygon(c, {p, {p.x + 12, p.y + 3}, {p.x + 5, p.y + 14}});
+            }
+            else
+            {
+                small.add_ellipse(c, {p.x + 6, p.y + 6}, {5, 5});
+            }
+        }
+        compare("20000 small shapes", 3, [&](PNGImage &img) { small.draw(img); });
+        // Whole documents, rendered on one thread.
+        for (const string name : {"lion", "batman"})
+        {
+            char tmp[] = "/tmp/svgbench.XXXXXX.svg";
+            int fd = ::mkstemps(tmp, 4);
+            if (fd < 0)
+            {
+                continue;
+            }
+            ::close(fd);
+            Point dimensions;
+            Scene scene;
+            if (write_scaled(dir + "/" + name + ".svg", tmp, 4))
+            {
+                readSVG(tmp, dimensions, scene);
+                PNGImage aliased(dimensions.x, dimensions.y), smooth(dimensions.x, dimensions.y);
+                double t_aliased = 0, t_aa = 0;
+                for (int round = 0; round < 3; round++)
+                {
+                    double t = time_us([&]() { render_tiled(scene, aliased, DEFAULT_TILE_SIZE, 1); }, 1);
+                    t_aliased = round == 0 ? t : min(t_aliased, t);
+                    t = time_us([&]() { render_tiled(scene, smooth, DEFAULT_TILE_SIZE, 1, nullptr, true); }, 1);
+                    t_aa = round == 0 ? t : min(t_aa, t);
+                }
+                row(name + "_x4.svg", t_aliased, t_aa);
+            }
+            ::remove(tmp);
+        }
+        cout << "Highest cost: " << fixed << setprecision(2) << worst << "x the aliased time" << endl;
+
+        // Coverage, against supersampling.
+        struct Check
+        {
+            string name;
+            double tolerance;
+            function<void(PNGImage &)> draw;
+            function<bool(double, double)> inside;
+        };
+        const Color white = {255, 255, 255};
+        const vector<Point> star = star_polygon(10, 64);
+        const Point center = {32, 32}, radius = {27, 11};
+        const double angle = 30 * M_PI / 180;
+        const Point start = {3, 9}, end = {60, 41};
+        const vector<Check> checks = {
+            {"polygon 10 star", 0.07,
+             [&](PNGImage &img) { img.draw_polygon(star, white); },
+             [&](double x, double y)
+             {
+                 // Even-odd, as drawn.
+                 bool in = false;
+                 for (size_t i = 0, j = star.size() - 1; i < star.size(); j = i++)
+                 {
+                     const Point &a = star[i], &b = star[j];
+                     if ((a.y > y) != (b.y > y) && x < a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y))
+                     {
+                         in = !in;
+                     }
+                 }
+                 return in;
+             }},
+            {"ellipse rotated 30", 0.15,
+             [&](PNGImage &img) { img.draw_ellipse(center, radius, 30.0, white); },
+             [&](double x, double y)
+             {
+                 const double u = ((x - center.x) * cos(angle) + (y - center.y) * sin(angle)) / radius.x;
+                 const double v = ((y - center.y) * cos(angle) - (x - center.x) * sin(angle)) / radius.y;
+                 return u * u + v * v <= 1;
+             }},
+            {"line", 0.15,
+             // One pixel thick vertically (Wu's line), ends included. Wu
+             // takes the coverage at the middle of each column, not over
+             // its width, hence the looser tolerance.
+             [&](PNGImage &img) { img.draw_line(start, end, white); },
+             [&](double x, double y)
+             {
+                 const double line_y = start.y + (x - start.x) * (end.y - start.y) / (end.x - start.x);
+                 return x >= start.x - 0.5 && x <= end.x + 0.5 && fabs(y - line_y) <= 0.5;
+             }},
+        };
+        cout << setw(24) << "coverage" << setw(14) << "max error" << endl;
+        for (const Check &check : checks)
+        {
+            PNGImage img(64, 64);
+            img.clear({0, 0, 0});
+            img.set_antialias(&rasterizer);
+            check.draw(img);
+            const double error = coverage_error(img, check.inside);
+            ok = ok && error <= check.tolerance;
+            cout << setw(24) << check.name << setw(14) << setprecision(3) << error
+                 << (error <= check.tolerance ? "" : "  COVERAGE DIFFERS") << endl;
+            report("antialias", check.name, "coverage error", error);
+        }
+
+        // Tiles (a shape may be clipped by several) against one drawing.
+        Scene shapes;
+        for (int i = 0; i < 200; i++)
+        {
+            Color c = {(rgb_value)(rand() % 256), (rgb_value)(rand() % 256), (rgb_value)(rand() % 256)};
+            Point p = {rand() % 256, rand() % 256};
+            switch (i % 3)
+            {
+            case 0:
+                shapes.add_polygon(c, random_polygon(5, 256));
+                break;
+            case 1:
+                shapes.add_ellipse(c, p, {1 + rand() % 40, 1 + rand() % 40}, rand() % 180);
+                break;
+            default:
+                shapes.add_line(c, p, {rand() % 256, rand() % 256});
+                break;
+            }
+        }
+        PNGImage whole(256, 256), tiled(256, 256);
+        whole.set_antialias(&rasterizer);
+        shapes.draw(whole);
+        render_tiled(shapes, tiled, 32, 0, nullptr, true);
+        int difference = 0;
+        for (int y = 0; y < 256; y++)
+        {
+            for (int x = 0; x < 256; x++)
+            {
+                const Color a = whole.at(x, y), b = tiled.at(x, y);
+                difference = max({difference, abs(a.red - b.red), abs(a.green - b.green), abs(a.blue - b.blue)});
+            }
+        }
+        // Coverage does not depend on the tile.
+        ok = ok && difference <= 1;
+        cout << setw(24) << "tiled vs whole" << setw(14) << difference
+             << (difference <= 1 ? "" : "  PIXELS DIFFER") << endl;
+        return ok;
+    }
+
+
+    // Convert every SVG file of a directory (plus copies of lion.svg and
+    // batman.svg scaled up 4 and 8 times) and time the stages.
+    bool bench_corpus(const string &dir)
+    {
+        vector<string> files;
+        ::DIR *directory = ::opendir(dir.c_str());
+        if (directory == nullptr)
+        {
+            cerr << "Unable to open " << dir << endl;
+            return false;
+        }
+        ::dirent *entry;
+        while ((entry = ::readdir(directory)) != nullptr)
+        {
+            string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".svg") == 0)
+            {
+                files.push_back(name);
+            }
+        }
+        ::closedir(directory);
+        sort(files.begin(), files.end());
+
+        char tmp_template[] = "/tmp/svgbench.XXXXXX";
+        const char *tmp = ::mkdtemp(tmp_template);
+        if (tmp == nullptr)
+        {
+            cerr << "Unable to create a temporary directory" << endl;
+            return false;
+        }
+        const string png = string(tmp) + "/out.png";
+        struct Input
+        {
+            string name;
+            string file;
+            int reps;
+        };
+        vector<Input> inputs;
+        for (const string &name : files)
+        {
+            inputs.push_back({name, dir + "/" + name, 3});
+        }
+        vector<string> scaled;
+        for (const string name : {"lion", "batman"})
+        {
+            for (int k : {4, 8})
+            {
+                string file = string(tmp) + "/" + name + "_x" + to_string(k) + ".svg";
+                if (write_scaled(dir + "/" + name + ".svg", file, k))
+                {
+                    inputs.push_back({name + "_x" + to_string(k) + ".svg", file, 1});
+                    scaled.push_back(file);
+                }
+            }
+        }
+
+        cout << "== corpus (" << dir << ") ==" << endl
+             << setw(34) << "file" << setw(12) << "pixels" << setw(10) << "shapes"
+             << setw(11) << "total(ms)" << setw(11) << "parse(ms)" << setw(11) << "raster(ms)"
+             << setw(11) << "encode(ms)" << endl;
+        bool ok = true;
+        double sum = 0;
+        for (const Input &input : inputs)
+        {
+            // Best of reps runs.
+            ConvertStats best;
+            for (int r = 0; r < input.reps; r++)
+            {
+                ConvertStats stats;
+                try
+                {
+                    convert(input.file, png, PNGOptions(), &stats);
+                }
+                catch (const exception &e)
+                {
+                    cout << setw(34) << input.name << "  FAILED: " << e.what() << endl;
+                    ok = false;
+                    break;
+                }
+                if (r == 0 || stats.total_ns < best.total_ns)
+                {
+                    best = stats;
+                }
+            }
+            if (best.total_ns == 0)
+            {
+                continue;
+            }
+            const uint64_t shapes = best.ellipses + best.lines + best.polylines + best.polygons + best.sprites;
+            const double total = best.total_ns / 1e6;
+            const double parse = (best.load_ns + best.parse_ns + best.build_ns) / 1e6;
+            const double raster = best.raster_ns / 1e6;
+            const double encode = best.encode_ns / 1e6;
+            sum += total;
+            cout << setw(34) << input.name << setw(12) << (uint64_t)best.width * best.height
+                 << setw(10) << shapes << fixed << setprecision(2)
+                 << setw(11) << total << setw(11) << parse << setw(11) << raster << setw(11) << encode << endl;
+            report("corpus", input.name, "total_ms", total);
+            report("corpus", input.name, "parse_ms", parse);
+            report("corpus", input.name, "raster_ms", raster);
+            report("corpus", input.name, "encode_ms", encode);
+        }
+        cout << setw(34) << "all" << setw(43) << sum << endl;
+        report("corpus", "all", "total_ms", sum);
+
+        for (const string &file : scaled)
+        {
+            ::remove(file.c_str());
+        }
+        ::remove(png.c_str());
+        ::rmdir(tmp);
+        return ok;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    srand(42);
+    // bench [--json file] [micro | corpus [dir] | parse file...]
+    string json;
+    int arg = 1;
+    if (argc >= 3 && string(argv[1]) == "--json")
+    {
+        json = argv[2];
+        arg = 3;
+    }
+    const string mode = arg < argc ? argv[arg] : "all";
+    if (mode == "parse")
+    {
+        return bench_parse_files(argc - arg - 1, argv + arg + 1);
+    }
+    if (mode != "all" && mode != "micro" && mode != "corpus")
+    {
+        cerr << "Usage: bench [--json file] [micro | corpus [dir] | parse file...]" << endl;
+        return 1;
+    }
+    bool ok = true;
+    if (mode != "corpus")
+    {
+        ok = bench_fill_kernels();
+        bench_span();
+        bench_line();
+        ok = bench_ellipse() && ok;
+        ok = bench_polygon() && ok;
+        bench_color();
+        ok = bench_antialias("input") && ok;
+        ok = bench_points() && ok;
+        ok = bench_scene() && ok;
+        ok = bench_use() && ok;
+        ok = bench_encode() && ok;
+        ok = bench_diff() && ok;
+    }
+    if (mode != "micro")
+    {
+        ok = bench_corpus(mode == "corpus" && arg + 1 < argc ? argv[arg + 1] : "input") && ok;
+    }
+    if (!json.empty())
+    {
+        ok = write_results(json) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -1,23 +1,212 @@
+
+#include <memory>
 #include <string>
-#include <vector>
 #include "SVGElements.hpp"
+#include "tiles.hpp"
+#include "RenderCache.hpp"
 
 namespace svg
 {
-    void convert(const std::string &svg_file, const std::string &png_file)
+    namespace
     {
-        Point dimensions;
-        std::vector<SVGElement *> svg_elements;
-        readSVG(svg_file, dimensions, svg_elements);
-        PNGImage img(dimensions.x, dimensions.y);
-        for (SVGElement* e : svg_elements)
+        // Everything besides the input that the rendered file depends on,
+        // for RenderCache keys. Change it whenever the output changes.
+        const char RENDER_OPTIONS[] = "svgtopng/3";
+
+        // Canvases with a larger framebuffer are rendered in bands
+        // (see render_banded()), never being in memory as a whole.
+        const uint64_t MAX_FRAMEBUFFER_BYTES = 256ull << 20;
+
+        // Scenes with at most 256 colors (most documents) are drawn on an
+        // indexed-color framebuffer, a third of the size of an RGB one,
+        // and saved as indexed-color PNG files, smaller and faster to
+        // encode. The palette has white (the background) first.
+        // Returns nullptr if the scene has more colors, or if it is drawn
+        // anti-aliased (blending makes new colors).
+        std::shared_ptr<const Palette> scene_palette(const Scene &scene, const PNGOptions &png)
         {
-            e->draw(img);
+            if (png.antialias)
+            {
+                return nullptr;
+            }
+            std::shared_ptr<Palette> palette = std::make_shared<Palette>();
+            palette->add(Color{255, 255, 255});
+            if (!scene.collect_colors(*palette))
+            {
+                return nullptr;
+            }
+            return palette;
         }
-        img.save(png_file);
-        for (SVGElement* e  : svg_elements)
+
+        bool needs_bands(const Point &dimensions, const std::shared_ptr<const Palette> &palette)
         {
-            delete e;
+            const size_t bytes_per_pixel = palette != nullptr ? 1 : sizeof(Color);
+            return (uint64_t)dimensions.x * dimensions.y * bytes_per_pixel > MAX_FRAMEBUFFER_BYTES;
         }
+
+        void render_bands(const Scene &scene, const Point &dimensions,
+                          const std::shared_ptr<const Palette> &palette,
+                          const std::string &png_file, const PNGOptions &png, unsigned workers,
+                          RenderStats *stats = nullptr)
+        {
+            if (palette != nullptr)
+            {
+                PNGWriter writer(png_file, dimensions.x, dimensions.y, palette->colors(), png);
+                render_banded(scene, writer, dimensions.x, dimensions.y,
+                              DEFAULT_BAND_HEIGHT, workers, stats, palette);
+                return;
+            }
+            PNGWriter writer(png_file, dimensions.x, dimensions.y, png);
+            render_banded(scene, writer, dimensions.x, dimensions.y,
+                          DEFAULT_BAND_HEIGHT, workers, stats, nullptr, png.antialias);
+        }
+
+        void count_shapes(const Scene &scene, ConvertStats &stats)
+        {
+            for (size_t i = 0; i < scene.size(); i++)
+            {
+                switch (scene.type(i))
+                {
+                case Scene::ELLIPSE:
+                    stats.ellipses++;
+                    break;
+                case Scene::LINE:
+                    stats.lines++;
+                    break;
+                case Scene::POLYLINE:
+                    stats.polylines++;
+                    break;
+                case Scene::POLYGON:
+                    stats.polygons++;
+                    break;
+                case Scene::SPRITE:
+                    stats.sprites++;
+                    break;
+                }
+            }
+        }
+
+        // Precompiled scenes (see compile()) are recognized by extension.
+        bool is_svgb(const std::string &file)
+        {
+            const std::string ext = ".svgb";
+            return file.size() >= ext.size() &&
+                   file.compare(file.size() - ext.size(), ext.size(), ext) == 0;
+        }
+
+        // Read a file and render it into img (resized as needed), or in
+        // bands, with the given number of workers (see render_tiled() and
+        // render_banded()), then save it.
+        void convert_into(const std::string &svg_file, const std::string &png_file, PNGImage &img, Arena &arena,
+                          const PNGOptions &png, unsigned workers, ConvertStats *stats)
+        {
+            if (stats != nullptr)
+            {
+                PNGImage::reset_peak_framebuffer_bytes();
+            }
+            StageTimer total(stats != nullptr ? &stats->total_ns : nullptr);
+            Point dimensions;
+            Scene scene;
+            if (is_svgb(svg_file))
+            {
+                StageTimer load(stats != nullptr ? &stats->load_ns : nullptr);
+                scene.load(svg_file, dimensions);
+            }
+            else
+            {
+                readSVG(svg_file, dimensions, scene, arena, stats);
+            }
+            RenderStats *render_stats = nullptr;
+            if (stats != nullptr)
+            {
+                stats->width = dimensions.x;
+                stats->height = dimensions.y;
+                count_shapes(scene, *stats);
+                render_stats = &stats->render;
+            }
+            std::shared_ptr<const Palette> palette = scene_palette(scene, png);
+            if (stats != nullptr && palette != nullptr)
+            {
+                stats->palette_colors = palette->size();
+            }
+            if (needs_bands(dimensions, palette))
+            {
+                // Drawing and encoding are interleaved, band by band.
+                const uint64_t write_before = stats != nullptr ? stats->render.write_ns : 0;
+                uint64_t render_ns = 0;
+                {
+                    StageTimer timer(stats != nullptr ? &render_ns : nullptr);
+                    render_bands(scene, dimensions, palette, png_file, png, workers, render_stats);
+                }
+                if (stats != nullptr)
+                {
+                    const uint64_t write_ns = stats->render.write_ns - write_before;
+                    stats->encode_ns += write_ns;
+                    stats->raster_ns += render_ns - write_ns;
+                }
+            }
+            else
+            {
+                if (palette != nullptr)
+                {
+                    img.reset(dimensions.x, dimensions.y, palette);
+                }
+                else
+                {
+                    img.reset(dimensions.x, dimensions.y);
+                }
+                {
+                    StageTimer timer(stats != nullptr ? &stats->raster_ns : nullptr);
+                    render_tiled(scene, img, DEFAULT_TILE_SIZE, workers, render_stats, png.antialias);
+                }
+                StageTimer timer(stats != nullptr ? &stats->encode_ns : nullptr);
+                img.save(png_file, png);
+            }
+            if (stats != nullptr)
+            {
+                stats->peak_framebuffer_bytes = PNGImage::peak_framebuffer_bytes();
+            }
+        }
+    }
+
+    void convert(const std::string &svg_file, const std::string &png_file)
+    {
+        convert(svg_file, png_file, PNGOptions());
+    }
+
+    void convert(const std::string &svg_file, const std::string &png_file, const PNGOptions &png,
+                 ConvertStats *stats)
+    {
+        // Resized to the canvas by convert_into(), as in the batch workers.
+        PNGImage img(1, 1);
+        Arena arena;
+        convert_into(svg_file, png_file, img, arena, png, 0, stats);
+    }
+
+    void convert(const std::string &svg_file, const std::string &png_file, PNGImage &img, Arena &arena,
+                 const PNGOptions &png)
+    {
+        // Tiled (for occlusion culling) but on this thread only: the
+        // callers convert several files in parallel.
+        convert_into(svg_file, png_file, img, arena, png, 1, nullptr);
+    }
+
+    void convert(const std::string &svg_file, const std::string &png_file, PNGImage &img, Arena &arena,
+                 RenderCache &cache, const PNGOptions &png)
+    {
+        std::string key = cache.key(svg_file, std::string(RENDER_OPTIONS) + "," + to_string(png));
+        if (!cache.fetch(key, png_file))
+        {
+            convert(svg_file, png_file, img, arena, png);
+            cache.store(key, png_file);
+        }
+    }
+
+    void compile(const std::string &svg_file, const std::string &svgb_file)
+    {
+        Point dimensions;
+        Scene scene;
+        readSVG(svg_file, dimensions, scene);
+        scene.save(svgb_file, dimensions);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,153 @@
+//! @file diff.cpp
+#include "diff.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__)
+// SSE2 is part of the x86-64 baseline.
+#define SVG_DIFF_X86 1
+#include <immintrin.h>
+#endif
+
+namespace svg
+{
+    namespace
+    {
+        // Largest difference of a channel between two pixels.
+        int channel_error(const Color &a, const Color &b)
+        {
+            return std::max(std::abs(a.red - b.red),
+                            std::max(std::abs(a.green - b.green), std::abs(a.blue - b.blue)));
+        }
+    }
+
+    uint64_t diff_pixels(const Color *a, const Color *b, size_t n, int &max_error)
+    {
+        return diff_pixels_sse2(a, b, n, max_error);
+    }
+
+    uint64_t diff_pixels_scalar(const Color *a, const Color *b, size_t n, int &max_error)
+    {
+        uint64_t mismatched = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            int error = channel_error(a[i], b[i]);
+            if (error != 0)
+            {
+                mismatched++;
+                max_error = std::max(max_error, error);
+            }
+        }
+        return mismatched;
+    }
+
+#ifdef SVG_DIFF_X86
+    uint64_t diff_pixels_sse2(const Color *a, const Color *b, size_t n, int &max_error)
+    {
+        // Bits 0, 3, 6, ... 45: the first byte of each of 16 pixels.
+        const uint64_t FIRST_BYTES = 0x249249249249ull;
+        const uint64_t ALL_BYTES = 0xFFFFFFFFFFFFull;
+        const unsigned char *pa = (const unsigned char *)a;
+        const unsigned char *pb = (const unsigned char *)b;
+        __m128i max = _mm_setzero_si128();
+        uint64_t mismatched = 0;
+        size_t blocks = n / 16;
+        for (size_t i = 0; i < blocks; i++, pa += 48, pb += 48)
+        {
+            __m128i a0 = _mm_loadu_si128((const __m128i *)pa);
+            __m128i a1 = _mm_loadu_si128((const __m128i *)(pa + 16));
+            __m128i a2 = _mm_loadu_si128((const __m128i *)(pa + 32));
+            __m128i b0 = _mm_loadu_si128((const __m128i *)pb);
+            __m128i b1 = _mm_loadu_si128((const __m128i *)(pb + 16));
+            __m128i b2 = _mm_loadu_si128((const __m128i *)(pb + 32));
+            uint64_t equal = (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a0, b0)) |
+                             (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a1, b1)) << 16 |
+                             (uint64_t)_mm_movemask_epi8(_mm_cmpeq_epi8(a2, b2)) << 32;
+            if (equal == ALL_BYTES)
+            {
+                continue;
+            }
+            // A pixel differs if any of its 3 bytes does.
+            uint64_t differ = ~equal & ALL_BYTES;
+            mismatched += __builtin_popcountll((differ | differ >> 1 | differ >> 2) & FIRST_BYTES);
+            max = _mm_max_epu8(max, _mm_or_si128(_mm_subs_epu8(a0, b0), _mm_subs_epu8(b0, a0)));
+            max = _mm_max_epu8(max, _mm_or_si128(_mm_subs_epu8(a1, b1), _mm_subs_epu8(b1, a1)));
+            max = _mm_max_epu8(max, _mm_or_si128(_mm_subs_epu8(a2, b2), _mm_subs_epu8(b2, a2)));
+        }
+        unsigned char bytes[16];
+        _mm_storeu_si128((__m128i *)bytes, max);
+        for (unsigned char e : bytes)
+        {
+            max_error = std::max(max_error, (int)e);
+        }
+        return mismatched + diff_pixels_scalar(a + blocks * 16, b + blocks * 16, n % 16, max_error);
+    }
+#else
+    uint64_t diff_pixels_sse2(const Color *a, const Color *b, size_t n, int &max_error)
+    {
+        return diff_pixels_scalar(a, b, n, max_error);
+    }
+#endif
+
+    ImageDiff diff_images(const PNGImage &a, const PNGImage &b)
+    {
+        ImageDiff diff;
+        if (a.width() != b.width() || a.height() != b.height())
+        {
+            diff.same_size = false;
+            return diff;
+        }
+        assert(a.band_top() == 0 && a.band_bottom() == a.height());
+        assert(b.band_top() == 0 && b.band_bottom() == b.height());
+        const int w = a.width(), h = a.height();
+        if (::memcmp(a.row(0), b.row(0), (size_t)w * h * sizeof(Color)) == 0)
+        {
+            return diff;
+        }
+        for (int y = 0; y < h; y++)
+        {
+            const Color *row_a = a.row(y), *row_b = b.row(y);
+            uint64_t mismatched = diff_pixels(row_a, row_b, w, diff.max_error);
+            if (mismatched != 0 && diff.mismatched == 0)
+            {
+                int x = 0;
+                while (channel_error(row_a[x], row_b[x]) == 0)
+                {
+                    x++;
+                }
+                diff.first = {x, y};
+            }
+            diff.mismatched += mismatched;
+        }
+        return diff;
+    }
+
+    void draw_diff(const PNGImage &a, const PNGImage &b, PNGImage &out)
+    {
+        assert(a.width() == b.width() && a.height() == b.height());
+        const int w = a.width(), h = a.height();
+        out.reset(w, h);
+        for (int y = 0; y < h; y++)
+        {
+            const Color *row_a = a.row(y), *row_b = b.row(y);
+            Color *dst = &out.at(0, y);
+            for (int x = 0; x < w; x++)
+            {
+                if (channel_error(row_a[x], row_b[x]) != 0)
+                {
+                    dst[x] = {255, 0, 0};
+                }
+                else
+                {
+                    // Light gray levels, so that red stands out.
+                    int luma = (row_a[x].red * 77 + row_a[x].green * 150 + row_a[x].blue * 29) >> 8;
+                    rgb_value gray = (rgb_value)(192 + luma / 4);
+                    dst[x] = {gray, gray, gray};
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,57 @@
+//! @file diff.hpp
+#ifndef __svg_diff_hpp__
+#define __svg_diff_hpp__
+
+#include "Color.hpp"
+#include "PNGImage.hpp"
+#include "Point.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace svg
+{
+    //! Differences between two images (see diff_images()).
+    struct ImageDiff
+    {
+        //! Whether both images have the same size (if not, nothing
+        //! else is compared).
+        bool same_size = true;
+        //! Pixels that differ in at least one channel.
+        uint64_t mismatched = 0;
+        //! Largest difference of a channel, over all pixels (0 to 255).
+        int max_error = 0;
+        //! First pixel that differs, in row-major order (if any).
+        Point first = {-1, -1};
+    };
+
+    //! Compare two runs of packed RGB pixels.
+    //! Uses the SSE2 kernel where available.
+    //! @param a First run.
+    //! @param b Second run.
+    //! @param n Number of pixels.
+    //! @param max_error Raised to the largest difference of a channel.
+    //! @return Number of pixels that differ.
+    uint64_t diff_pixels(const Color *a, const Color *b, size_t n, int &max_error);
+    //! Portable diff kernel, one pixel at a time.
+    uint64_t diff_pixels_scalar(const Color *a, const Color *b, size_t n, int &max_error);
+    //! SSE2 diff kernel (16 pixels / 48 bytes at a time).
+    //! Falls back to diff_pixels_scalar() on other architectures.
+    uint64_t diff_pixels_sse2(const Color *a, const Color *b, size_t n, int &max_error);
+
+    //! Compare two images. Identical images are detected with one
+    //! memcmp() of their pixels; otherwise they are compared row by
+    //! row with diff_pixels().
+    //! @param a First image (e.g. the expected one).
+    //! @param b Second image.
+    //! @return Differences.
+    ImageDiff diff_images(const PNGImage &a, const PNGImage &b);
+    //! Draw the differences between two images of the same size:
+    //! pixels that differ are red, the others a faded gray version
+    //! of the first image.
+    //! @param a First image.
+    //! @param b Second image.
+    //! @param out Image to draw on (reset to the size of a).
+    void draw_diff(const PNGImage &a, const PNGImage &b, PNGImage &out);
+}
+#endif
@@ -0,0 +1,1161 @@
+//! @file encode.cpp
+#include "encode.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace svg
+{
+    namespace
+    {
+        const char *const FILTER_NAMES[] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+
+        // Bands hold about this many filtered bytes (a whole number of rows).
+        // The split only depends on the image size, never on the number of
+        // threads, so the output is the same for any number of threads.
+        const size_t BAND_BYTES = 256 << 10;
+
+        const size_t WINDOW = 32768;
+        const int MIN_MATCH = 3;
+        const int MAX_MATCH = 258;
+        const int HASH_BITS = 15;
+        // Tokens per compressed block.
+        const size_t BLOCK_TOKENS = 1 << 14;
+        const size_t MAX_STORED = 65535;
+
+        // Match finder settings of each level, as in zlib.
+        struct Level
+        {
+            //! Hash chain entries examined per search.
+            int chain;
+            //! Stop searching at matches this long.
+            int nice;
+            //! Whether a match may be deferred if the next one is longer.
+            bool lazy;
+            //! Longer matches are skipped over without indexing the
+            //! positions they cover (which long runs of one color make
+            //! the bulk of the work otherwise).
+            int max_insert;
+        };
+        const Level LEVELS[10] = {
+            {0, 0, false, 0},
+            {4, 8, false, 4},
+            {8, 16, false, 5},
+            {16, 32, false, 6},
+            {16, 32, true, MAX_MATCH},
+            {32, 64, true, MAX_MATCH},
+            {128, 128, true, MAX_MATCH},
+            {256, 128, true, MAX_MATCH},
+            {1024, 258, true, MAX_MATCH},
+            {4096, 258, true, MAX_MATCH}};
+
+        // Deflate alphabets (RFC 1951, section 3.2.5).
+        const int LITERALS = 286;
+        // The fixed code also assigns codes to two unused symbols.
+        const int LITERAL_CODES = 288;
+        const int DISTANCES = 30;
+        const int END_OF_BLOCK = 256;
+        const int LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                     35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        const int LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        const int DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                   257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                   8193, 12289, 16385, 24577};
+        const int DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        // Order of the code length code lengths in a dynamic block header.
+        const int CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+        // Tables for computing the CRC 8 bytes at a time ("slicing by 8").
+        struct CRCTable
+        {
+            uint32_t entries[8][256];
+            CRCTable()
+            {
+                for (uint32_t n = 0; n < 256; n++)
+                {
+                    uint32_t c = n;
+                    for (int k = 0; k < 8; k++)
+                    {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    entries[0][n] = c;
+                }
+                for (uint32_t n = 0; n < 256; n++)
+                {
+                    for (int t = 1; t < 8; t++)
+                    {
+                        uint32_t c = entries[t - 1][n];
+                        entries[t][n] = entries[0][c & 0xFF] ^ (c >> 8);
+                    }
+                }
+            }
+        };
+
+        uint32_t crc32(uint32_t crc, const unsigned char *data, size_t size)
+        {
+            static const CRCTable table;
+            const uint32_t(&t)[8][256] = table.entries;
+            crc = ~crc;
+            for (; size >= 8; size -= 8, data += 8)
+            {
+                uint32_t lo = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 |
+                                     (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+                crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                      t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+            }
+            for (; size > 0; size--)
+            {
+                crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+
+        const uint32_t ADLER_BASE = 65521;
+
+        uint32_t adler32(uint32_t adler, const unsigned char *data, size_t size)
+        {
+            uint32_t a = adler & 0xFFFF;
+            uint32_t b = adler >> 16;
+            while (size > 0)
+            {
+                // Largest run that cannot overflow b before the modulo.
+                size_t n = std::min<size_t>(size, 5552);
+                size -= n;
+                while (n-- > 0)
+                {
+                    a += *data++;
+                    b += a;
+                }
+                a %= ADLER_BASE;
+                b %= ADLER_BASE;
+            }
+            return (b << 16) | a;
+        }
+
+        // Checksum of the concatenation of two blocks, from their checksums
+        // and the length of the second one (as zlib's adler32_combine()).
+        uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t size2)
+        {
+            uint32_t rem = size2 % ADLER_BASE;
+            uint32_t sum1 = adler1 & 0xFFFF;
+            uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % ADLER_BASE);
+            sum1 += (adler2 & 0xFFFF) + ADLER_BASE - 1;
+            sum2 += (adler1 >> 16) + (adler2 >> 16) + ADLER_BASE - rem;
+            sum1 %= ADLER_BASE;
+            sum2 %= ADLER_BASE;
+            return (sum2 << 16) | sum1;
+        }
+
+        template <typename Function>
+        void parallel_for(size_t count, unsigned threads, const Function &f)
+        {
+            if (threads == 0)
+            {
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            threads = std::min<size_t>(threads, count);
+            std::atomic<size_t> next(0);
+            auto worker = [&]()
+            {
+                size_t i;
+                while ((i = next++) < count)
+                {
+                    f(i);
+                }
+            };
+            std::vector<std::thread> pool;
+            for (unsigned t = 1; t < threads; t++)
+            {
+                pool.push_back(std::thread(worker));
+            }
+            // The calling thread also takes part in the work.
+            worker();
+            for (std::thread &t : pool)
+            {
+                t.join();
+            }
+        }
+
+        int paeth(int a, int b, int c)
+        {
+            int pa = std::abs(b - c);
+            int pb = std::abs(a - c);
+            int pc = std::abs(a + b - 2 * c);
+            return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        }
+
+        // Subtract a predictor from bytes [i, to[ of a row. Works on
+        // fixed-size blocks, which the compiler vectorizes.
+        template <typename Predictor>
+        void subtract(const unsigned char *row, size_t i, size_t to, unsigned char *out,
+                      const Predictor &predictor)
+        {
+            for (; i + 16 <= to; i += 16)
+            {
+                unsigned char block[16];
+                for (size_t k = 0; k < 16; k++)
+                {
+                    block[k] = (unsigned char)(row[i + k] - predictor(i + k));
+                }
+                std::memcpy(out + i, block, 16);
+            }
+            for (; i < to; i++)
+            {
+                out[i] = (unsigned char)(row[i] - predictor(i));
+            }
+        }
+
+        // Adaptive filtering scores rows in chunks of this many bytes,
+        // and drops a filter as soon as it cannot beat the best one.
+        const size_t COST_CHUNK = 4096;
+
+        // Filter bytes [from, to[ of a row of bpp bytes per pixel with one
+        // filter type (the type byte is not written). prior is nullptr for
+        // the first row.
+        void filter_row(int type, const unsigned char *row, const unsigned char *prior,
+                        size_t bpp, size_t from, size_t to, unsigned char *out)
+        {
+            if (prior == nullptr && type != FILTER_NONE && type != FILTER_SUB)
+            {
+                // Without a prior row, up is none, and paeth is sub.
+                type = type == FILTER_UP ? FILTER_NONE : type == FILTER_PAETH ? FILTER_SUB : type;
+            }
+            // The first pixel has no left neighbor.
+            size_t i = from;
+            for (; i < std::min(to, bpp); i++)
+            {
+                int b = prior != nullptr ? prior[i] : 0;
+                int predictor = type == FILTER_UP || type == FILTER_PAETH ? b : type == FILTER_AVERAGE ? b / 2 : 0;
+                out[i] = (unsigned char)(row[i] - predictor);
+            }
+            switch (type)
+            {
+            case FILTER_NONE:
+                std::copy(row + i, row + to, out + i);
+                break;
+            case FILTER_SUB:
+                subtract(row, i, to, out, [=](size_t j)
+                         { return row[j - bpp]; });
+                break;
+            case FILTER_UP:
+                subtract(row, i, to, out, [=](size_t j)
+                         { return prior[j]; });
+                break;
+            case FILTER_AVERAGE:
+                if (prior == nullptr)
+                {
+                    subtract(row, i, to, out, [=](size_t j)
+                             { return row[j - bpp] / 2; });
+                }
+                else
+                {
+                    subtract(row, i, to, out, [=](size_t j)
+                             { return (row[j - bpp] + prior[j]) / 2; });
+                }
+                break;
+            case FILTER_PAETH:
+                subtract(row, i, to, out, [=](size_t j)
+                         { return paeth(row[j - bpp], prior[j], prior[j - bpp]); });
+                break;
+            }
+        }
+
+        // Sum of the filtered bytes taken as signed values, the usual
+        // estimate of how well a filtered row will compress.
+        uint32_t filter_cost(const unsigned char *data, size_t size)
+        {
+            uint32_t sum = 0;
+            size_t i = 0;
+            // Fixed-size blocks, which the compiler vectorizes.
+            for (; i + 16 <= size; i += 16)
+            {
+                for (size_t k = 0; k < 16; k++)
+                {
+                    sum += std::abs((int)(signed char)data[i + k]);
+                }
+            }
+            for (; i < size; i++)
+            {
+                sum += std::abs((int)(signed char)data[i]);
+            }
+            return sum;
+        }
+
+        // Filter rows [y0, y1[ into filtered rows (type byte + row).
+        // first_prior is the row above row 0 (nullptr at the top of the image).
+        void filter_rows(const unsigned char *pixels, const unsigned char *first_prior, size_t row_size,
+                         size_t bpp, size_t y0, size_t y1, PNGFilter filter, unsigned char *filtered)
+        {
+            std::vector<unsigned char> scratch(filter == FILTER_ADAPTIVE ? row_size : 0);
+            for (size_t y = y0; y < y1; y++)
+            {
+                const unsigned char *row = pixels + y * row_size;
+                const unsigned char *prior = y > 0 ? row - row_size : first_prior;
+                unsigned char *out = filtered + y * (row_size + 1);
+                if (filter != FILTER_ADAPTIVE)
+                {
+                    out[0] = (unsigned char)filter;
+                    filter_row(filter, row, prior, bpp, 0, row_size, out + 1);
+                    continue;
+                }
+                out[0] = FILTER_NONE;
+                filter_row(FILTER_NONE, row, prior, bpp, 0, row_size, out + 1);
+                uint64_t best = filter_cost(out + 1, row_size);
+                // A row that filters to zeros cannot be improved upon.
+                for (int type = FILTER_SUB; type <= FILTER_PAETH && best > 0; type++)
+                {
+                    uint64_t cost = 0;
+                    for (size_t from = 0; from < row_size && cost < best; from += COST_CHUNK)
+                    {
+                        size_t to = std::min(row_size, from + COST_CHUNK);
+                        filter_row(type, row, prior, bpp, from, to, scratch.data());
+                        cost += filter_cost(scratch.data() + from, to - from);
+                    }
+                    if (cost < best)
+                    {
+                        best = cost;
+                        out[0] = (unsigned char)type;
+                        std::copy(scratch.begin(), scratch.end(), out + 1);
+                    }
+                }
+            }
+        }
+
+        class BitWriter
+        {
+        public:
+            BitWriter(std::vector<unsigned char> &out) : out_(out), bits_(0), count_(0)
+            {
+            }
+            //! Append the n low bits of value, least significant first.
+            void put(uint32_t value, int n)
+            {
+                bits_ |= (uint64_t)value << count_;
+                count_ += n;
+                while (count_ >= 8)
+                {
+                    out_.push_back((unsigned char)bits_);
+                    bits_ >>= 8;
+                    count_ -= 8;
+                }
+            }
+            //! Pad with zero bits up to a byte boundary.
+            void align()
+            {
+                if (count_ > 0)
+                {
+                    put(0, 8 - count_);
+                }
+            }
+            void put_bytes(const unsigned char *data, size_t size)
+            {
+                out_.insert(out_.end(), data, data + size);
+            }
+
+        private:
+            std::vector<unsigned char> &out_;
+            uint64_t bits_;
+            int count_;
+        };
+
+        // Compute Huffman code lengths no longer than limit.
+        // If the optimal code is too long, the frequencies are flattened
+        // and the code rebuilt, which converges quickly in practice.
+        void build_lengths(const uint32_t *freq, int n, int limit, uint8_t *lengths)
+        {
+            std::fill(lengths, lengths + n, 0);
+            std::vector<int> used;
+            for (int i = 0; i < n; i++)
+            {
+                if (freq[i] > 0)
+                {
+                    used.push_back(i);
+                }
+            }
+            if (used.size() == 1)
+            {
+                lengths[used[0]] = 1;
+            }
+            if (used.size() <= 1)
+            {
+                return;
+            }
+            std::vector<uint64_t> weights(used.size());
+            for (size_t i = 0; i < used.size(); i++)
+            {
+                weights[i] = freq[used[i]];
+            }
+            while (true)
+            {
+                // Nodes 0..m-1 are leaves, the others internal.
+                const size_t m = used.size();
+                std::vector<int> parent(2 * m - 1, -1);
+                typedef std::pair<uint64_t, int> Node;
+                std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+                for (size_t i = 0; i < m; i++)
+                {
+                    queue.push({weights[i], (int)i});
+                }
+                int next = (int)m;
+                while (queue.size() > 1)
+                {
+                    Node a = queue.top();
+                    queue.pop();
+                    Node b = queue.top();
+                    queue.pop();
+                    parent[a.second] = parent[b.second] = next;
+                    queue.push({a.first + b.first, next++});
+                }
+                // Parents are created after their children, so depths can be
+                // computed from the root down.
+                std::vector<int> depth(2 * m - 1, 0);
+                int longest = 0;
+                for (int i = (int)(2 * m - 3); i >= 0; i--)
+                {
+                    depth[i] = depth[parent[i]] + 1;
+                    longest = std::max(longest, depth[i]);
+                }
+                if (longest <= limit)
+                {
+                    for (size_t i = 0; i < m; i++)
+                    {
+                        lengths[used[i]] = (uint8_t)depth[i];
+                    }
+                    return;
+                }
+                for (uint64_t &w : weights)
+                {
+                    w = (w + 1) / 2;
+                }
+            }
+        }
+
+        // Canonical codes from code lengths, bit-reversed for output.
+        void build_codes(const uint8_t *lengths, int n, uint16_t *codes)
+        {
+            int count[16] = {0};
+            for (int i = 0; i < n; i++)
+            {
+                count[lengths[i]]++;
+            }
+            count[0] = 0;
+            int next[16] = {0};
+            int code = 0;
+            for (int bits = 1; bits < 16; bits++)
+            {
+                code = (code + count[bits - 1]) << 1;
+                next[bits] = code;
+            }
+            for (int i = 0; i < n; i++)
+            {
+                int length = lengths[i];
+                codes[i] = 0;
+                if (length == 0)
+                {
+                    continue;
+                }
+                int c = next[length]++;
+                int reversed = 0;
+                for (int k = 0; k < length; k++)
+                {
+                    reversed = (reversed << 1) | ((c >> k) & 1);
+                }
+                codes[i] = (uint16_t)reversed;
+            }
+        }
+
+        // Literal (distance 0) or match.
+        struct Token
+        {
+            uint16_t length;
+            uint16_t distance;
+        };
+
+        int length_code(int length)
+        {
+            return (int)(std::upper_bound(LENGTH_BASE, LENGTH_BASE + 29, length) - LENGTH_BASE) - 1;
+        }
+
+        int distance_code(int distance)
+        {
+            return (int)(std::upper_bound(DIST_BASE, DIST_BASE + 30, distance) - DIST_BASE) - 1;
+        }
+
+        struct Codes
+        {
+            uint8_t literal_lengths[LITERAL_CODES];
+            uint16_t literal_codes[LITERAL_CODES];
+            uint8_t distance_lengths[DISTANCES];
+            uint16_t distance_codes[DISTANCES];
+
+            void build()
+            {
+                build_codes(literal_lengths, LITERAL_CODES, literal_codes);
+                build_codes(distance_lengths, DISTANCES, distance_codes);
+            }
+        };
+
+        const Codes &fixed_codes()
+        {
+            struct Fixed : Codes
+            {
+                Fixed()
+                {
+                    std::fill(literal_lengths, literal_lengths + 144, 8);
+                    std::fill(literal_lengths + 144, literal_lengths + 256, 9);
+                    std::fill(literal_lengths + 256, literal_lengths + 280, 7);
+                    std::fill(literal_lengths + 280, literal_lengths + LITERAL_CODES, 8);
+                    std::fill(distance_lengths, distance_lengths + DISTANCES, 5);
+                    build();
+                }
+            };
+            static const Fixed codes;
+            return codes;
+        }
+
+        // Run-length encoded code lengths of a dynamic block header:
+        // symbol (0-18) and value of its extra bits.
+        typedef std::pair<uint8_t, uint8_t> LengthToken;
+
+        // Number of extra bits of a code length symbol.
+        int length_token_extra(int symbol)
+        {
+            return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+        }
+
+        std::vector<LengthToken> encode_lengths(const uint8_t *lengths, int n)
+        {
+            std::vector<LengthToken> out;
+            int i = 0;
+            while (i < n)
+            {
+                const uint8_t length = lengths[i];
+                int run = 1;
+                while (i + run < n && lengths[i + run] == length)
+                {
+                    run++;
+                }
+                i += run;
+                if (length == 0)
+                {
+                    for (; run >= 11; run -= std::min(run, 138))
+                    {
+                        out.push_back({18, (uint8_t)(std::min(run, 138) - 11)});
+                    }
+                    if (run >= 3)
+                    {
+                        out.push_back({17, (uint8_t)(run - 3)});
+                        run = 0;
+                    }
+                }
+                else
+                {
+                    out.push_back({length, 0});
+                    run--;
+                    for (; run >= 3; run -= std::min(run, 6))
+                    {
+                        out.push_back({16, (uint8_t)(std::min(run, 6) - 3)});
+                    }
+                }
+                for (; run > 0; run--)
+                {
+                    out.push_back({length, 0});
+                }
+            }
+            return out;
+        }
+
+        // Size of the tokens in bits with the given codes (end of block included).
+        uint64_t tokens_cost(const uint32_t *literal_freq, const uint32_t *distance_freq, const Codes &codes)
+        {
+            uint64_t bits = 0;
+            for (int i = 0; i < LITERALS; i++)
+            {
+                bits += (uint64_t)literal_freq[i] *
+                        (codes.literal_lengths[i] + (i > END_OF_BLOCK ? LENGTH_EXTRA[i - 257] : 0));
+            }
+            for (int i = 0; i < DISTANCES; i++)
+            {
+                bits += (uint64_t)distance_freq[i] * (codes.distance_lengths[i] + DIST_EXTRA[i]);
+            }
+            return bits;
+        }
+
+        void write_tokens(BitWriter &bits, const std::vector<Token> &tokens, const Codes &codes)
+        {
+            for (const Token &t : tokens)
+            {
+                if (t.distance == 0)
+                {
+                    bits.put(codes.literal_codes[t.length], codes.literal_lengths[t.length]);
+                    continue;
+                }
+                int lc = length_code(t.length);
+                bits.put(codes.literal_codes[257 + lc], codes.literal_lengths[257 + lc]);
+                bits.put(t.length - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+                int dc = distance_code(t.distance);
+                bits.put(codes.distance_codes[dc], codes.distance_lengths[dc]);
+                bits.put(t.distance - DIST_BASE[dc], DIST_EXTRA[dc]);
+            }
+            bits.put(codes.literal_codes[END_OF_BLOCK], codes.literal_lengths[END_OF_BLOCK]);
+        }
+
+        void write_stored(BitWriter &bits, const unsigned char *data, size_t size, bool last)
+        {
+            do
+            {
+                size_t n = std::min(size, MAX_STORED);
+                size -= n;
+                bits.put(last && size == 0 ? 1 : 0, 1);
+                bits.put(0, 2);
+                bits.align();
+                const unsigned char header[4] = {(unsigned char)n, (unsigned char)(n >> 8),
+                                                 (unsigned char)~n, (unsigned char)(~n >> 8)};
+                bits.put_bytes(header, 4);
+                bits.put_bytes(data, n);
+                data += n;
+            } while (size > 0);
+        }
+
+        // Write the tokens covering data[0, size[ as a block with dynamic
+        // codes, fixed codes or stored, whichever is smallest.
+        void write_block(BitWriter &bits, const std::vector<Token> &tokens,
+                         const unsigned char *data, size_t size, bool last)
+        {
+            uint32_t literal_freq[LITERAL_CODES] = {0};
+            uint32_t distance_freq[DISTANCES] = {0};
+            for (const Token &t : tokens)
+            {
+                if (t.distance == 0)
+                {
+                    literal_freq[t.length]++;
+                }
+                else
+                {
+                    literal_freq[257 + length_code(t.length)]++;
+                    distance_freq[distance_code(t.distance)]++;
+                }
+            }
+            literal_freq[END_OF_BLOCK] = 1;
+
+            Codes dynamic;
+            build_lengths(literal_freq, LITERAL_CODES, 15, dynamic.literal_lengths);
+            build_lengths(distance_freq, DISTANCES, 15, dynamic.distance_lengths);
+            if (std::count(dynamic.distance_lengths, dynamic.distance_lengths + DISTANCES, 0) == DISTANCES)
+            {
+                // No matches: one unused distance code keeps decoders happy.
+                dynamic.distance_lengths[0] = 1;
+            }
+            dynamic.build();
+            int literal_count = LITERALS;
+            while (dynamic.literal_lengths[literal_count - 1] == 0)
+            {
+                literal_count--;
+            }
+            int distance_count = DISTANCES;
+            while (dynamic.distance_lengths[distance_count - 1] == 0)
+            {
+                distance_count--;
+            }
+            uint8_t all_lengths[LITERALS + DISTANCES];
+            std::copy(dynamic.literal_lengths, dynamic.literal_lengths + literal_count, all_lengths);
+            std::copy(dynamic.distance_lengths, dynamic.distance_lengths + distance_count, all_lengths + literal_count);
+            std::vector<LengthToken> header = encode_lengths(all_lengths, literal_count + distance_count);
+            uint32_t header_freq[19] = {0};
+            for (const LengthToken &t : header)
+            {
+                header_freq[t.first]++;
+            }
+            uint8_t header_lengths[19];
+            uint16_t header_codes[19];
+            build_lengths(header_freq, 19, 7, header_lengths);
+            build_codes(header_lengths, 19, header_codes);
+            int header_count = 19;
+            while (header_count > 4 && header_lengths[CODE_LENGTH_ORDER[header_count - 1]] == 0)
+            {
+                header_count--;
+            }
+
+            uint64_t dynamic_bits = 14 + 3 * header_count + tokens_cost(literal_freq, distance_freq, dynamic);
+            for (const LengthToken &t : header)
+            {
+                dynamic_bits += header_lengths[t.first] + length_token_extra(t.first);
+            }
+            const uint64_t fixed_bits = tokens_cost(literal_freq, distance_freq, fixed_codes());
+            const uint64_t stored_bits = size * 8 + (size / MAX_STORED + 1) * 40;
+
+            if (stored_bits <= dynamic_bits && stored_bits <= fixed_bits)
+            {
+                write_stored(bits, data, size, last);
+            }
+            else if (fixed_bits <= dynamic_bits)
+            {
+                bits.put(last ? 1 : 0, 1);
+                bits.put(1, 2);
+                write_tokens(bits, tokens, fixed_codes());
+            }
+            else
+            {
+                bits.put(last ? 1 : 0, 1);
+                bits.put(2, 2);
+                bits.put(literal_count - 257, 5);
+                bits.put(distance_count - 1, 5);
+                bits.put(header_count - 4, 4);
+                for (int i = 0; i < header_count; i++)
+                {
+                    bits.put(header_lengths[CODE_LENGTH_ORDER[i]], 3);
+                }
+                for (const LengthToken &t : header)
+                {
+                    bits.put(header_codes[t.first], header_lengths[t.first]);
+                    bits.put(t.second, length_token_extra(t.first));
+                }
+                write_tokens(bits, tokens, dynamic);
+            }
+        }
+
+        // LZ77 match finder over data[base, end[, with hash chains.
+        class MatchFinder
+        {
+        public:
+            MatchFinder(const unsigned char *data, size_t base, size_t end, const Level &level)
+                : data_(data), base_(base), end_(end), level_(level),
+                  head_(1 << HASH_BITS, -1), prev_(end - base), inserted_(base)
+            {
+            }
+            //! Find the longest match for the data at p, among the
+            //! positions before p (all of which are indexed first).
+            //! @return Match length (0 if shorter than MIN_MATCH).
+            int find(size_t p, int &distance)
+            {
+                insert(p);
+                const int limit = (int)std::min<size_t>(MAX_MATCH, end_ - p);
+                if (limit < MIN_MATCH)
+                {
+                    return 0;
+                }
+                const unsigned char *s = data_ + p;
+                int best = MIN_MATCH - 1;
+                int chain = level_.chain;
+                for (int32_t c = head_[hash(p)]; c >= 0 && chain-- > 0; c = prev_[c])
+                {
+                    size_t d = p - (base_ + c);
+                    if (d > WINDOW)
+                    {
+                        break;
+                    }
+                    const unsigned char *m = s - d;
+                    if (m[best] != s[best] || m[0] != s[0] || m[1] != s[1])
+                    {
+                        continue;
+                    }
+                    int n = 2;
+                    while (n < limit && m[n] == s[n])
+                    {
+                        n++;
+                    }
+                    if (n > best)
+                    {
+                        best = n;
+                        distance = (int)d;
+                        if (n >= level_.nice || n == limit)
+                        {
+                            break;
+                        }
+                    }
+                }
+                return best >= MIN_MATCH ? best : 0;
+            }
+            //! Index only the start and the last few positions of a
+            //! match found at p (the latter keep the distances of the
+            //! next matches short in runs of one pixel value).
+            //! @param p Match position.
+            //! @param length Match length.
+            void skip(size_t p, int length)
+            {
+                insert(p + 1);
+                inserted_ = std::max(inserted_, p + length - 2 * MIN_MATCH);
+            }
+
+        private:
+            // Index the positions before p.
+            void insert(size_t p)
+            {
+                for (; inserted_ < p; inserted_++)
+                {
+                    if (inserted_ + MIN_MATCH <= end_)
+                    {
+                        uint32_t h = hash(inserted_);
+                        prev_[inserted_ - base_] = head_[h];
+                        head_[h] = (int32_t)(inserted_ - base_);
+                    }
+                }
+            }
+            uint32_t hash(size_t p) const
+            {
+                uint32_t v = (uint32_t)data_[p] << 16 | (uint32_t)data_[p + 1] << 8 | data_[p + 2];
+                return (v * 2654435761u) >> (32 - HASH_BITS);
+            }
+
+            const unsigned char *data_;
+            size_t base_;
+            size_t end_;
+            const Level &level_;
+            //! Most recent position (relative to base_) of each hash.
+            std::vector<int32_t> head_;
+            //! Previous position with the same hash, for each position.
+            std::vector<int32_t> prev_;
+            //! Positions before this one are indexed.
+            size_t inserted_;
+        };
+
+        // Deflate data[start, end[. Matches may refer to the WINDOW bytes
+        // before start, which precede it in the stream. Unless it is the
+        // last band, the output ends on a byte boundary without a final
+        // block, so that the next band can be appended.
+        void deflate_band(const unsigned char *data, size_t start, size_t end,
+                          int level, bool last, std::vector<unsigned char> &out)
+        {
+            BitWriter bits(out);
+            if (level == 0)
+            {
+                // Stored blocks end on byte boundaries.
+                out.reserve(out.size() + (end - start) + ((end - start) / MAX_STORED + 1) * 5 + 4);
+                write_stored(bits, data + start, end - start, last);
+                return;
+            }
+            const Level &config = LEVELS[level];
+            MatchFinder finder(data, start > WINDOW ? start - WINDOW : 0, end, config);
+            std::vector<Token> tokens;
+            tokens.reserve(BLOCK_TOKENS + 1);
+            size_t block_start = start;
+            size_t p = start;
+            int length = 0;
+            int distance = 0;
+            bool found = false;
+            while (p < end)
+            {
+                if (!found)
+                {
+                    length = finder.find(p, distance);
+                }
+                found = false;
+                if (length > 0 && config.lazy && length < config.nice && p + 1 < end)
+                {
+                    int next_distance = 0;
+                    int next_length = finder.find(p + 1, next_distance);
+                    if (next_length > length)
+                    {
+                        // Defer: emit a literal and take the longer match.
+                        tokens.push_back({data[p], 0});
+                        p++;
+                        length = next_length;
+                        distance = next_distance;
+                        found = true;
+                        continue;
+                    }
+                }
+                if (length > 0)
+                {
+                    tokens.push_back({(uint16_t)length, (uint16_t)distance});
+                    if (length > config.max_insert)
+                    {
+                        finder.skip(p, length);
+                    }
+                    p += length;
+                }
+                else
+                {
+                    tokens.push_back({data[p], 0});
+                    p++;
+                }
+                if (tokens.size() >= BLOCK_TOKENS)
+                {
+                    write_block(bits, tokens, data + block_start, p - block_start, last && p == end);
+                    tokens.clear();
+                    block_start = p;
+                }
+            }
+            if (!tokens.empty())
+            {
+                write_block(bits, tokens, data + block_start, end - block_start, last);
+            }
+            if (!last)
+            {
+                // Sync flush: an empty stored block.
+                bits.put(0, 3);
+                bits.align();
+                const unsigned char marker[4] = {0, 0, 0xFF, 0xFF};
+                bits.put_bytes(marker, 4);
+            }
+            bits.align();
+        }
+
+        void put_u32(std::vector<unsigned char> &out, uint32_t v)
+        {
+            out.push_back((unsigned char)(v >> 24));
+            out.push_back((unsigned char)(v >> 16));
+            out.push_back((unsigned char)(v >> 8));
+            out.push_back((unsigned char)v);
+        }
+
+        void write_chunk(std::ostream &out, const char *type,
+                         const unsigned char *data, size_t size)
+        {
+            std::vector<unsigned char> length;
+            put_u32(length, (uint32_t)size);
+            out.write(reinterpret_cast<const char *>(length.data()), 4);
+            out.write(type, 4);
+            out.write(reinterpret_cast<const char *>(data), size);
+            uint32_t crc = crc32(0, reinterpret_cast<const unsigned char *>(type), 4);
+            std::vector<unsigned char> check;
+            put_u32(check, crc32(crc, data, size));
+            out.write(reinterpret_cast<const char *>(check.data()), 4);
+        }
+    }
+
+    std::string to_string(const PNGOptions &options)
+    {
+        return "level=" + std::to_string(options.level) + ",filter=" + FILTER_NAMES[options.filter] +
+               (options.antialias ? ",antialias" : "");
+    }
+
+    bool parse_filter(const std::string &name, PNGFilter &filter)
+    {
+        for (int f = FILTER_NONE; f <= FILTER_ADAPTIVE; f++)
+        {
+            if (name == FILTER_NAMES[f])
+            {
+                filter = (PNGFilter)f;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool parse_level(const std::string &text, int &level)
+    {
+        if (text.size() != 1 || text[0] < '0' || text[0] > '9')
+        {
+            return false;
+        }
+        level = text[0] - '0';
+        return true;
+    }
+
+    PNGWriter::PNGWriter(const std::string &png_file, int width, int height, const PNGOptions &options)
+        : out_(file_)
+    {
+        open(png_file);
+        start(width, height, nullptr, options);
+    }
+
+    PNGWriter::PNGWriter(std::ostream &out, int width, int height, const PNGOptions &options)
+        : out_(out)
+    {
+        start(width, height, nullptr, options);
+    }
+
+    PNGWriter::PNGWriter(const std::string &png_file, int width, int height,
+                         const std::vector<Color> &palette, const PNGOptions &options)
+        : out_(file_)
+    {
+        open(png_file);
+        start(width, height, &palette, options);
+    }
+
+    PNGWriter::PNGWriter(std::ostream &out, int width, int height,
+                         const std::vector<Color> &palette, const PNGOptions &options)
+        : out_(out)
+    {
+        start(width, height, &palette, options);
+    }
+
+    void PNGWriter::open(const std::string &png_file)
+    {
+        // Replace the file instead of writing over it: it may be
+        // a hard link to another one (e.g. a RenderCache entry).
+        std::remove(png_file.c_str());
+        file_.open(png_file, std::ios::binary);
+        if (!file_)
+        {
+            throw std::runtime_error("Unable to write " + png_file);
+        }
+    }
+
+    void PNGWriter::start(int width, int height, const std::vector<Color> *palette, const PNGOptions &options)
+    {
+        if (width <= 0 || height <= 0)
+        {
+            throw std::runtime_error("Unable to encode an empty image");
+        }
+        if (palette != nullptr && (palette->empty() || palette->size() > 256))
+        {
+            throw std::runtime_error("Invalid PNG palette size " + std::to_string(palette->size()));
+        }
+        width_ = width;
+        height_ = height;
+        bpp_ = palette != nullptr ? 1 : 3;
+        rows_ = 0;
+        options_ = options;
+        options_.level = std::max(0, std::min(options.level, 9));
+        if (options_.filter == FILTER_ADAPTIVE && (options_.level == 0 || palette != nullptr))
+        {
+            // Stored data does not get any smaller with filtering, and
+            // palette indices are not numbers that filters predict well
+            // (the PNG specification recommends no filter for them).
+            options_.filter = FILTER_NONE;
+        }
+        adler_ = 1;
+
+        static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+        out_.write(reinterpret_cast<const char *>(signature), 8);
+        std::vector<unsigned char> header;
+        put_u32(header, (uint32_t)width);
+        put_u32(header, (uint32_t)height);
+        // 8 bits per sample (or index), RGB or indexed color, deflate,
+        // adaptive filtering, no interlace.
+        const unsigned char format[5] = {8, (unsigned char)(palette != nullptr ? 3 : 2), 0, 0, 0};
+        header.insert(header.end(), format, format + 5);
+        write_chunk(out_, "IHDR", header.data(), header.size());
+        if (palette != nullptr)
+        {
+            write_chunk(out_, "PLTE", reinterpret_cast<const unsigned char *>(palette->data()),
+                        palette->size() * sizeof(Color));
+        }
+        check();
+    }
+
+    void PNGWriter::write_rows(const unsigned char *pixels, int rows)
+    {
+        if (rows <= 0)
+        {
+            return;
+        }
+        if (rows > height_ - rows_)
+        {
+            throw std::runtime_error("Too many rows written to a PNG image");
+        }
+        const bool last = rows_ + rows == height_;
+        const int level = options_.level;
+        const size_t row_size = (size_t)width_ * bpp_;
+        const size_t band_rows = std::max<size_t>(1, BAND_BYTES / (row_size + 1));
+        const size_t band_size = band_rows * (row_size + 1);
+        const size_t bands = (rows + band_rows - 1) / band_rows;
+
+        // The filtered rows follow the end of the previously written ones,
+        // the dictionary of the first band. All the bands are filtered
+        // first, as each one is the dictionary of the next.
+        const size_t dictionary = window_.size();
+        std::vector<unsigned char> filtered(window_);
+        filtered.resize(dictionary + (row_size + 1) * rows);
+        const unsigned char *prior = rows_ > 0 ? prior_.data() : nullptr;
+        parallel_for(bands, options_.threads, [&](size_t b)
+                     {
+                         size_t y0 = b * band_rows;
+                         size_t y1 = std::min<size_t>(rows, y0 + band_rows);
+                         filter_rows(pixels, prior, row_size, bpp_, y0, y1, options_.filter, filtered.data() + dictionary);
+                     });
+
+        std::vector<std::vector<unsigned char>> streams(bands);
+        std::vector<uint32_t> checksums(bands);
+        if (rows_ == 0)
+        {
+            // zlib header: deflate with a 32K window, level hint and check bits.
+            const unsigned cmf = 0x78;
+            unsigned flg = (level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3) << 6;
+            flg += (31 - (cmf * 256 + flg) % 31) % 31;
+            streams[0].push_back((unsigned char)cmf);
+            streams[0].push_back((unsigned char)flg);
+        }
+        parallel_for(bands, options_.threads, [&](size_t b)
+                     {
+                         size_t start = dictionary + b * band_size;
+                         size_t end = std::min(filtered.size(), start + band_size);
+                         deflate_band(filtered.data(), start, end, level, last && b + 1 == bands, streams[b]);
+                         checksums[b] = adler32(1, filtered.data() + start, end - start);
+                     });
+        for (size_t b = 0; b < bands; b++)
+        {
+            size_t start = dictionary + b * band_size;
+            adler_ = adler32_combine(adler_, checksums[b], std::min(band_size, filtered.size() - start));
+        }
+        if (last)
+        {
+            put_u32(streams.back(), adler_);
+        }
+        for (const std::vector<unsigned char> &stream : streams)
+        {
+            write_chunk(out_, "IDAT", stream.data(), stream.size());
+        }
+        if (last)
+        {
+            write_chunk(out_, "IEND", nullptr, 0);
+            out_.flush();
+        }
+        check();
+
+        rows_ += rows;
+        prior_.assign(pixels + (rows - 1) * row_size, pixels + rows * row_size);
+        window_.assign(filtered.end() - std::min(filtered.size(), WINDOW), filtered.end());
+    }
+
+    int PNGWriter::rows() const
+    {
+        return rows_;
+    }
+
+    void PNGWriter::check()
+    {
+        if (!out_)
+        {
+            throw std::runtime_error("Unable to write PNG data");
+        }
+    }
+
+    std::vector<unsigned char> encode_png(const unsigned char *rgb, int width, int height,
+                                          const PNGOptions &options)
+    {
+        std::ostringstream out;
+        PNGWriter writer(out, width, height, options);
+        writer.write_rows(rgb, height);
+        const std::string png = out.str();
+        return std::vector<unsigned char>(png.begin(), png.end());
+    }
+
+    std::vector<unsigned char> encode_png(const unsigned char *indices, int width, int height,
+                                          const std::vector<Color> &palette, const PNGOptions &options)
+    {
+        std::ostringstream out;
+        PNGWriter writer(out, width, height, palette, options);
+        writer.write_rows(indices, height);
+        const std::string png = out.str();
+        return std::vector<unsigned char>(png.begin(), png.end());
+    }
+
+    void write_png(const std::string &png_file, const unsigned char *rgb, int width, int height,
+                   const PNGOptions &options)
+    {
+        PNGWriter writer(png_file, width, height, options);
+        writer.write_rows(rgb, height);
+    }
+
+    void write_png(const std::string &png_file, const unsigned char *indices, int width, int height,
+                   const std::vector<Color> &palette, const PNGOptions &options)
+    {
+        PNGWriter writer(png_file, width, height, palette, options);
+        writer.write_rows(indices, height);
+    }
+}
@@ -0,0 +1,187 @@
+//! @file encode.hpp
+#ifndef __svg_encode_hpp__
+#define __svg_encode_hpp__
+
+#include "Color.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace svg
+{
+    //! PNG row filter (see the PNG specification, section 9).
+    enum PNGFilter
+    {
+        FILTER_NONE = 0,
+        FILTER_SUB = 1,
+        FILTER_UP = 2,
+        FILTER_AVERAGE = 3,
+        FILTER_PAETH = 4,
+        //! Choose the filter of each row that minimizes the sum of the
+        //! absolute (signed) filtered bytes.
+        FILTER_ADAPTIVE = 5
+    };
+
+    //! PNG encoder settings.
+    struct PNGOptions
+    {
+        //! Compression level: 0 stores the data uncompressed (fastest,
+        //! largest), 1 to 9 trade speed for size as in zlib.
+        int level = 6;
+        //! Row filter. At level 0, adaptive filtering means no filtering,
+        //! since stored data does not get any smaller.
+        PNGFilter filter = FILTER_ADAPTIVE;
+        //! Encoder threads (0 means one per core).
+        //! The output does not depend on the number of threads.
+        unsigned threads = 0;
+        //! Draw anti-aliased (see render_tiled()). Not an encoder setting,
+        //! but one of the output, for convert() and its callers.
+        bool antialias = false;
+    };
+
+    //! Get a description of the settings that affect the encoded bytes.
+    //! @param options Settings.
+    //! @return Description (e.g. "level=6,filter=adaptive", followed
+    //! by ",antialias" if set).
+    std::string to_string(const PNGOptions &options);
+    //! Parse a filter name ("none", "sub", "up", "average", "paeth"
+    //! or "adaptive").
+    //! @param name Filter name.
+    //! @param filter Parsed filter.
+    //! @return false if the name is unknown.
+    bool parse_filter(const std::string &name, PNGFilter &filter);
+    //! Parse a compression level (a single digit, "0" to "9").
+    //! @param text Level.
+    //! @param level Parsed level.
+    //! @return false if the text is not a level.
+    bool parse_level(const std::string &text, int &level);
+
+    //! Incremental PNG encoder: the image is written a few rows at a
+    //! time, so that it never has to be in memory as a whole.
+    //! Each call of write_rows() is split into bands of rows that are
+    //! filtered and deflated in parallel. Each band ends on a byte
+    //! boundary (with an empty stored block, as a zlib sync flush) and
+    //! goes into its own IDAT chunk, so the chunks join into a single
+    //! zlib stream. Matches may reach into the previous band (or the
+    //! previous call), so splitting costs almost nothing in size.
+    class PNGWriter
+    {
+    public:
+        //! Start writing a PNG file.
+        //! Throws std::runtime_error if the file cannot be written.
+        //! @param png_file Output file (replaced, not written over).
+        //! @param width Image width.
+        //! @param height Image height.
+        //! @param options Settings.
+        PNGWriter(const std::string &png_file, int width, int height,
+                  const PNGOptions &options = PNGOptions());
+        //! Start writing a PNG image to a stream.
+        //! @param out Output stream.
+        //! @param width Image width.
+        //! @param height Image height.
+        //! @param options Settings.
+        PNGWriter(std::ostream &out, int width, int height,
+                  const PNGOptions &options = PNGOptions());
+        //! Start writing an indexed-color PNG file (color type 3),
+        //! whose pixels are indices in a palette.
+        //! Throws std::runtime_error if the file cannot be written.
+        //! @param png_file Output file (replaced, not written over).
+        //! @param width Image width.
+        //! @param height Image height.
+        //! @param palette Colors (1 to 256).
+        //! @param options Settings.
+        PNGWriter(const std::string &png_file, int width, int height,
+                  const std::vector<Color> &palette, const PNGOptions &options = PNGOptions());
+        //! Start writing an indexed-color PNG image to a stream.
+        //! @param out Output stream.
+        //! @param width Image width.
+        //! @param height Image height.
+        //! @param palette Colors (1 to 256).
+        //! @param options Settings.
+        PNGWriter(std::ostream &out, int width, int height,
+                  const std::vector<Color> &palette, const PNGOptions &options = PNGOptions());
+        //! Append rows to the image. The image is complete once the
+        //! last row is written.
+        //! Throws std::runtime_error on write errors, or if there are
+        //! more rows than the image height.
+        //! @param pixels Pixels, row by row: 3 bytes (RGB) each, or
+        //! 1 byte (palette index) each for indexed-color images.
+        //! @param rows Number of rows.
+        void write_rows(const unsigned char *pixels, int rows);
+        //! Get the number of rows written so far.
+        //! @return Number of rows.
+        int rows() const;
+
+    private:
+        PNGWriter(const PNGWriter &) = delete;
+        PNGWriter &operator=(const PNGWriter &) = delete;
+
+        //! Open the output file.
+        void open(const std::string &png_file);
+        //! Write the signature, header and palette (if not nullptr).
+        void start(int width, int height, const std::vector<Color> *palette, const PNGOptions &options);
+        //! Throw if the output stream failed.
+        void check();
+
+        //! Output file (unused when writing to a stream).
+        std::ofstream file_;
+        //! Output stream.
+        std::ostream &out_;
+        int width_;
+        int height_;
+        //! Bytes per pixel (3, or 1 for indexed-color images).
+        size_t bpp_;
+        //! Rows written so far.
+        int rows_;
+        PNGOptions options_;
+        //! Last row written (unfiltered), the prior row of the next one.
+        std::vector<unsigned char> prior_;
+        //! Last 32 KB of filtered data written, the dictionary of the next rows.
+        std::vector<unsigned char> window_;
+        //! Adler-32 checksum of the filtered data written.
+        uint32_t adler_;
+    };
+
+    //! Encode an RGB image in PNG format (see PNGWriter).
+    //! @param rgb Pixels, 3 bytes each, row by row.
+    //! @param width Image width.
+    //! @param height Image height.
+    //! @param options Settings.
+    //! @return PNG file contents.
+    std::vector<unsigned char> encode_png(const unsigned char *rgb, int width, int height,
+                                          const PNGOptions &options = PNGOptions());
+    //! Encode an indexed-color image in PNG format (see PNGWriter).
+    //! @param indices Pixels, 1 palette index each, row by row.
+    //! @param width Image width.
+    //! @param height Image height.
+    //! @param palette Colors (1 to 256).
+    //! @param options Settings.
+    //! @return PNG file contents.
+    std::vector<unsigned char> encode_png(const unsigned char *indices, int width, int height,
+                                          const std::vector<Color> &palette,
+                                          const PNGOptions &options = PNGOptions());
+    //! Encode an RGB image and write it to a PNG file.
+    //! Throws std::runtime_error if the file cannot be written.
+    //! @param png_file Output file.
+    //! @param rgb Pixels, 3 bytes each, row by row.
+    //! @param width Image width.
+    //! @param height Image height.
+    //! @param options Settings.
+    void write_png(const std::string &png_file, const unsigned char *rgb, int width, int height,
+                   const PNGOptions &options = PNGOptions());
+    //! Encode an indexed-color image and write it to a PNG file.
+    //! Throws std::runtime_error if the file cannot be written.
+    //! @param png_file Output file.
+    //! @param indices Pixels, 1 palette index each, row by row.
+    //! @param width Image width.
+    //! @param height Image height.
+    //! @param palette Colors (1 to 256).
+    //! @param options Settings.
+    void write_png(const std::string &png_file, const unsigned char *indices, int width, int height,
+                   const std::vector<Color> &palette, const PNGOptions &options = PNGOptions());
+}
+#endif
@@ -0,0 +1,134 @@
+//! @file fill.cpp
+#include "fill.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+// SSE2 is part of the x86-64 baseline; AVX2 is detected at run time.
+#define SVG_FILL_X86 1
+#include <immintrin.h>
+#endif
+
+namespace svg
+{
+    namespace
+    {
+        // Below this many pixels, building the vector pattern does not pay off.
+        const size_t MIN_VECTOR_PIXELS = 32;
+        // The wider AVX2 pattern only pays off on longer runs.
+        const size_t MIN_AVX2_PIXELS = 512;
+
+        typedef void (*FillKernel)(Color *, size_t, const Color &);
+
+        FillKernel select_kernel()
+        {
+#ifdef SVG_FILL_X86
+            return avx2_supported() ? fill_pixels_avx2 : fill_pixels_sse2;
+#else
+            return fill_pixels_scalar;
+#endif
+        }
+
+        FillKernel select_short_kernel()
+        {
+#ifdef SVG_FILL_X86
+            return fill_pixels_sse2;
+#else
+            return fill_pixels_scalar;
+#endif
+        }
+
+        // Repeat a color in a byte pattern of 'pixels' pixels.
+        void make_pattern(unsigned char *pattern, size_t pixels, const Color &c)
+        {
+            for (size_t i = 0; i < pixels; i++)
+            {
+                ::memcpy(pattern + 3 * i, &c, 3);
+            }
+        }
+    }
+
+    void fill_pixels(Color *dst, size_t n, const Color &c)
+    {
+        static const FillKernel long_kernel = select_kernel();
+        if (n < MIN_VECTOR_PIXELS)
+        {
+            fill_pixels_scalar(dst, n, c);
+        }
+        else if (n < MIN_AVX2_PIXELS)
+        {
+            select_short_kernel()(dst, n, c);
+        }
+        else
+        {
+            long_kernel(dst, n, c);
+        }
+    }
+
+    void fill_pixels_scalar(Color *dst, size_t n, const Color &c)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            dst[i] = c;
+        }
+    }
+
+#ifdef SVG_FILL_X86
+    bool avx2_supported()
+    {
+        static const bool supported = __builtin_cpu_supports("avx2");
+        return supported;
+    }
+
+    void fill_pixels_sse2(Color *dst, size_t n, const Color &c)
+    {
+        unsigned char pattern[48];
+        make_pattern(pattern, 16, c);
+        __m128i v0 = _mm_loadu_si128((const __m128i *)pattern);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(pattern + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(pattern + 32));
+        unsigned char *out = (unsigned char *)dst;
+        size_t blocks = n / 16;
+        for (size_t i = 0; i < blocks; i++, out += 48)
+        {
+            _mm_storeu_si128((__m128i *)out, v0);
+            _mm_storeu_si128((__m128i *)(out + 16), v1);
+            _mm_storeu_si128((__m128i *)(out + 32), v2);
+        }
+        ::memcpy(out, pattern, (n % 16) * 3);
+    }
+
+    __attribute__((target("avx2"))) void fill_pixels_avx2(Color *dst, size_t n, const Color &c)
+    {
+        unsigned char pattern[96];
+        make_pattern(pattern, 32, c);
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)pattern);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(pattern + 32));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)(pattern + 64));
+        unsigned char *out = (unsigned char *)dst;
+        size_t blocks = n / 32;
+        for (size_t i = 0; i < blocks; i++, out += 96)
+        {
+            _mm256_storeu_si256((__m256i *)out, v0);
+            _mm256_storeu_si256((__m256i *)(out + 32), v1);
+            _mm256_storeu_si256((__m256i *)(out + 64), v2);
+        }
+        ::memcpy(out, pattern, (n % 32) * 3);
+    }
+#else
+    bool avx2_supported()
+    {
+        return false;
+    }
+
+    void fill_pixels_sse2(Color *dst, size_t n, const Color &c)
+    {
+        fill_pixels_scalar(dst, n, c);
+    }
+
+    void fill_pixels_avx2(Color *dst, size_t n, const Color &c)
+    {
+        fill_pixels_scalar(dst, n, c);
+    }
+#endif
+}
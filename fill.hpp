@@ -0,0 +1,30 @@
+//! @file fill.hpp
+#ifndef __svg_fill_hpp__
+#define __svg_fill_hpp__
+
+#include "Color.hpp"
+
+#include <cstddef>
+
+namespace svg
+{
+    //! Fill a run of packed RGB pixels with one color.
+    //! Uses the fastest kernel supported by the CPU
+    //! (AVX2, SSE2 or plain C++), selected at run time.
+    //! @param dst First pixel.
+    //! @param n Number of pixels.
+    //! @param c Color.
+    void fill_pixels(Color *dst, size_t n, const Color &c);
+
+    //! Portable fill kernel, one pixel at a time.
+    void fill_pixels_scalar(Color *dst, size_t n, const Color &c);
+    //! SSE2 fill kernel (repeats a 48-byte / 16-pixel pattern).
+    //! Falls back to fill_pixels_scalar() on other architectures.
+    void fill_pixels_sse2(Color *dst, size_t n, const Color &c);
+    //! AVX2 fill kernel (repeats a 96-byte / 32-pixel pattern).
+    //! Must only be called if avx2_supported() is true.
+    void fill_pixels_avx2(Color *dst, size_t n, const Color &c);
+    //! Whether the CPU supports the AVX2 kernel.
+    bool avx2_supported();
+}
+#endif
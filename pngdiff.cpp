@@ -0,0 +1,46 @@
+#include "diff.hpp"
+#include <exception>
+#include <iostream>
+
+int main(int argc, char **argv)
+{
+    if (argc != 3 && argc != 4)
+    {
+        std::cout << "Usage: pngdiff expected.png actual.png [diff.png]" << std::endl
+                  << "  Exits with 0 if the images are identical, 1 if they differ, 2 on errors." << std::endl
+                  << "  diff.png shows the pixels that differ in red." << std::endl;
+        return 2;
+    }
+    try
+    {
+        svg::PNGImage expected(argv[1]), actual(argv[2]);
+        svg::ImageDiff diff = svg::diff_images(expected, actual);
+        if (!diff.same_size)
+        {
+            std::cout << "Images have different dimensions: "
+                      << expected.width() << "x" << expected.height() << " != "
+                      << actual.width() << "x" << actual.height() << std::endl;
+            return 1;
+        }
+        if (diff.mismatched == 0)
+        {
+            std::cout << "Images are identical" << std::endl;
+            return 0;
+        }
+        double percent = 100.0 * diff.mismatched / ((double)expected.width() * expected.height());
+        std::cout << diff.mismatched << " pixels differ (" << percent << "%), max channel error "
+                  << diff.max_error << ", first at (" << diff.first.x << ' ' << diff.first.y << ")" << std::endl;
+        if (argc == 4)
+        {
+            svg::PNGImage highlighted(1, 1);
+            svg::draw_diff(expected, actual, highlighted);
+            highlighted.save(argv[3]);
+        }
+        return 1;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+}
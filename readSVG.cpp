@@ -1,135 +1,488 @@
 #include <iostream>
 #include "SVGElements.hpp"
-#include "external/tinyxml2/tinyxml2.h"
+#include "Transform.hpp"
+#include "MappedFile.hpp"
+#include "XMLReader.hpp"
+#include <algorithm>
+#include <climits>
 #include <cstring>
-#include <sstream>
+#include <cstdlib>
+#include <stdexcept>
+#include <memory>
+#include <unordered_map>
+#include <utility>
 
 
 using namespace std;
-using namespace tinyxml2;
 
 namespace svg
 {
-    void readSVG(const string& svg_file, Point& dimensions, vector<SVGElement *>& svg_elements)
+    namespace
+    {
+        bool is_svg_space(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+        }
+
+        // Parse one SVG number, truncated to int as for other attributes
+        // (and saturated to the int range).
+        // Returns nullptr if str does not start with a number.
+        const char *parse_coordinate(const char *str, int &value)
+        {
+            const char *p = str;
+            bool negative = false;
+            if (*p == '+' || *p == '-')
+            {
+                negative = *p == '-';
+                p++;
+            }
+            // Past INT_MAX + 1, more digits cannot change the saturated
+            // value (and would overflow v).
+            const long long limit = (long long)INT_MAX + 1;
+            long long v = 0;
+            bool digits = false;
+            for (; *p >= '0' && *p <= '9'; p++)
+            {
+                v = std::min(v * 10 + (*p - '0'), limit);
+                digits = true;
+            }
+            if (*p == '.')
+            {
+                // Fractional digits do not affect the truncated value.
+                for (p++; *p >= '0' && *p <= '9'; p++)
+                {
+                    digits = true;
+                }
+            }
+            if (!digits)
+            {
+                return nullptr;
+            }
+            if (*p == 'e' || *p == 'E')
+            {
+                // Rare: let the C library deal with exponents.
+                char *end;
+                double d = ::strtod(str, &end);
+                value = static_cast<int>(std::max<double>(INT_MIN, std::min<double>(INT_MAX, d)));
+                return end;
+            }
+            value = static_cast<int>(std::max<long long>(INT_MIN, std::min<long long>(INT_MAX, negative ? -v : v)));
+            return p;
+        }
+    }
+
+    void parse_points(const char *str, vector<Point> &points)
+    {
+        if (str == nullptr)
+        {
+            return;
+        }
+        // Every pair takes at least 4 characters ("x,y "), bar the last one.
+        points.reserve(points.size() + (::strlen(str) + 1) / 4);
+        const char *p = str;
+        int coords[2];
+        int n = 0;
+        while (true)
+        {
+            while (is_svg_space(*p))
+            {
+                p++;
+            }
+            if (*p == '\0')
+            {
+                break;
+            }
+            const char *end = parse_coordinate(p, coords[n]);
+            if (end == nullptr)
+            {
+                throw runtime_error(string("Invalid points attribute: ") + str);
+            }
+            if (++n == 2)
+            {
+                points.push_back({coords[0], coords[1]});
+                n = 0;
+            }
+            // Separator: whitespace, optionally with one comma.
+            for (p = end; is_svg_space(*p); p++)
+            {
+            }
+            if (*p == ',')
+            {
+                p++;
+            }
+        }
+        // A coordinate without its pair.
+        if (n != 0)
+        {
+            throw runtime_error(string("Invalid points attribute: ") + str);
+        }
+    }
+
+    namespace
     {
-        XMLDocument doc;
-        XMLError r = doc.LoadFile(svg_file.c_str());
-        if (r != XML_SUCCESS)
+        // Create an element in the arena, or on the heap if there is none.
+        template <typename T, typename... Args>
+        T *make_element(Arena *arena, Args &&...args)
+        {
+            if (arena != nullptr)
+            {
+                return arena->make<T>(std::forward<Args>(args)...);
+            }
+            return new T(std::forward<Args>(args)...);
+        }
+
+        // Destination of the elements read.
+        struct ElementSink
+        {
+            // Elements are appended to this vector...
+            vector<SVGElement *> *elements;
+            // ...unless there is a scene, to which they are added one at a time.
+            Scene *scene;
+            // Arena for the elements (nullptr for the heap). With a scene,
+            // it is reset after adding each element.
+            Arena *arena;
+            // Where to add the time spent loading and building (optional).
+            ConvertStats *stats;
+        };
+
+        // State shared while reading a document.
+        struct ReadContext
+        {
+            // Document (memory-mapped).
+            const char *data;
+            size_t size;
+            // Arena for the elements of symbols (nullptr for the heap).
+            Arena *symbol_arena;
+            // Scratch buffer for point lists (copied into each element).
+            vector<Point> points;
+            // Offsets of the elements with an 'id' attribute (first one wins).
+            unordered_map<string, size_t> ids;
+            // Whether ids covers the whole document (and not just
+            // the part read so far).
+            bool all_ids;
+            // Symbols read for <use> references, by offset (nullptr while being read).
+            unordered_map<size_t, shared_ptr<Symbol>> symbols;
+        };
+
+        void record_id(const XMLReader &r, ReadContext &ctx)
+        {
+            const char *id = r.attribute("id");
+            if (id != nullptr)
+            {
+                ctx.ids.emplace(id, r.offset());
+            }
+        }
+
+        // Skip the rest of the current element, recording the ids of those
+        // inside it (e.g. in <defs>, which are otherwise not drawn).
+        void skip_element(XMLReader &r, ReadContext &ctx)
+        {
+            for (int depth = 1; depth > 0;)
+            {
+                if (r.next() == XMLReader::START_TAG)
+                {
+                    record_id(r, ctx);
+                    depth++;
+                }
+                else
+                {
+                    depth--;
+                }
+            }
+        }
+
+        // Index the ids of the whole document (for forward references).
+        void index_ids(ReadContext &ctx)
+        {
+            XMLReader r(ctx.data, ctx.size);
+            while (r.next() != XMLReader::END_OF_DOCUMENT)
+            {
+                record_id(r, ctx);
+            }
+            ctx.all_ids = true;
+        }
+
+        void read_element(XMLReader &r, const Transform &transform, const ElementSink &sink, ReadContext &ctx);
+
+        // Read the children of the current element, up to its end tag.
+        void read_children(XMLReader &r, const Transform &parent_transform, const ElementSink &sink, ReadContext &ctx)
+        {
+            while (r.next() == XMLReader::START_TAG)
+            {
+                // Compose this element's transform with the inherited one
+                Transform transform = parent_transform *
+                                      parse_transform(r.attribute("transform"),
+                                                      r.attribute("transform-origin"));
+                read_element(r, transform, sink, ctx);
+            }
+        }
+
+        // Get the shared geometry of a referenced element, reading it
+        // (with its own transform only) the first time it is used.
+        shared_ptr<const Symbol> symbol_for(const char *href, ReadContext &ctx)
         {
-            throw runtime_error("Unable to load " + svg_file);
+            if (href == nullptr || href[0] != '#')
+            {
+                throw runtime_error(string("Invalid reference: ") + (href != nullptr ? href : ""));
+            }
+            string id(href + 1);
+            auto it = ctx.ids.find(id);
+            if (it == ctx.ids.end() && !ctx.all_ids)
+            {
+                index_ids(ctx);
+                it = ctx.ids.find(id);
+            }
+            if (it == ctx.ids.end())
+            {
+                throw runtime_error("Unknown reference: #" + id);
+            }
+            size_t offset = it->second;
+            auto cached = ctx.symbols.find(offset);
+            if (cached != ctx.symbols.end())
+            {
+                if (cached->second == nullptr)
+                {
+                    throw runtime_error("Circular reference: #" + id);
+                }
+                return cached->second;
+            }
+            ctx.symbols[offset] = nullptr;
+            shared_ptr<Symbol> symbol = make_shared<Symbol>(ctx.symbol_arena == nullptr);
+            // Read the referenced element again, straight from the document.
+            XMLReader r(ctx.data, ctx.size, offset);
+            r.next();
+            ElementSink sink = {&symbol->elements, nullptr, ctx.symbol_arena, nullptr};
+            read_element(r,
+                         parse_transform(r.attribute("transform"),
+                                         r.attribute("transform-origin")),
+                         sink, ctx);
+            ctx.symbols[offset] = symbol;
+            return symbol;
         }
-        XMLElement *xml_elem = doc.RootElement();
 
-        dimensions.x = xml_elem->IntAttribute("width");
-        dimensions.y = xml_elem->IntAttribute("height");
+        // Hand over a new element to the sink, with its final transformation.
+        void emit(SVGElement *e, const Transform &placement, const char *id, const ElementSink &sink)
+        {
+            StageTimer timer(sink.stats != nullptr ? &sink.stats->build_ns : nullptr);
+            if (sink.scene == nullptr)
+            {
+                sink.elements->push_back(e);
+                if (id != nullptr)
+                {
+                    e->id = id;
+                }
+            }
+            // Geometry is transformed once, with the final matrix
+            if (!placement.is_identity())
+            {
+                e->applyTransform(placement);
+            }
+            if (sink.scene != nullptr)
+            {
+                e->add_to(*sink.scene);
+                if (sink.arena != nullptr)
+                {
+                    sink.arena->reset();
+                }
+                else
+                {
+                    delete e;
+                }
+            }
+        }
 
-        // Loop through each child element of the root
-        XMLElement *child = xml_elem->FirstChildElement();
-        while (child != nullptr)
+        // Read the current element (and its contents, up to its end tag),
+        // with its transform composed with the inherited one.
+        void read_element(XMLReader &r, const Transform &transform, const ElementSink &sink, ReadContext &ctx)
         {
+            record_id(r, ctx);
+            Arena *arena = sink.arena;
+            vector<Point> &points = ctx.points;
+            Transform placement = transform;
+            SVGElement *e = nullptr;
             // Check if the element is a circle
-            if (strcmp(child->Name(), "circle") == 0)
+            if (r.is("circle"))
             {
                 // Read circle attributes
-                float cx = child->FloatAttribute("cx");
-                float cy = child->FloatAttribute("cy");
-                float r = child->FloatAttribute("r");
-                const char *fill_color = child->Attribute("fill");
-                // Create Circle object and add to vector
-                svg_elements.push_back(new Circle(parse_color(fill_color), {static_cast<int>(cx), static_cast<int>(cy)}, static_cast<int>(r)));
+                float cx = r.float_attribute("cx");
+                float cy = r.float_attribute("cy");
+                float radius = r.float_attribute("r");
+                const char *fill_color = r.attribute("fill");
+                // Create Circle object
+                e = make_element<Circle>(arena, parse_color(fill_color), Point{static_cast<int>(cx), static_cast<int>(cy)}, static_cast<int>(radius));
             }
             // Check if the element is an ellipse
-            else if (strcmp(child->Name(), "ellipse") == 0)
+            else if (r.is("ellipse"))
             {
                 // Read ellipse attributes
-                float cx = child->FloatAttribute("cx");
-                float cy = child->FloatAttribute("cy");
-                float rx = child->FloatAttribute("rx");
-                float ry = child->FloatAttribute("ry");
-                const char *fill_color = child->Attribute("fill");
-                // Create Ellipse object and add to vector
-                svg_elements.push_back(new Ellipse(parse_color(fill_color), {static_cast<int>(cx), static_cast<int>(cy)}, {static_cast<int>(rx), static_cast<int>(ry)}));
+                float cx = r.float_attribute("cx");
+                float cy = r.float_attribute("cy");
+                float rx = r.float_attribute("rx");
+                float ry = r.float_attribute("ry");
+                const char *fill_color = r.attribute("fill");
+                // Create Ellipse object
+                e = make_element<Ellipse>(arena, parse_color(fill_color), Point{static_cast<int>(cx), static_cast<int>(cy)}, Point{static_cast<int>(rx), static_cast<int>(ry)});
             }
 
             // Check if the element is a polyline
-            else if (strcmp(child->Name(), "polyline") == 0)
+            else if (r.is("polyline"))
             {
                 // Read polyline attributes
-                const char *points_str = child->Attribute("points");
-                const char *stroke_color = child->Attribute("stroke");
+                const char *points_str = r.attribute("points");
+                const char *stroke_color = r.attribute("stroke");
                 // Parse points string
-                vector<Point> points;
-                stringstream ss(points_str);
-                string point;
-                while (getline(ss, point, ' '))
-                {
-                    // Split each point into x and y coordinates
-                    stringstream ss_point(point);
-                    string x_str, y_str;
-                    getline(ss_point, x_str, ',');
-                    getline(ss_point, y_str, ',');
-                    int x = stoi(x_str);
-                    int y = stoi(y_str);
-                    points.push_back({x, y});
-                }
-                // Create Polyline object and add to vector
-                svg_elements.push_back(new Polyline(parse_color(stroke_color), points));
+                points.clear();
+                parse_points(points_str, points);
+                // Create Polyline object
+                e = make_element<Polyline>(arena, parse_color(stroke_color), points, PointAllocator(arena));
             }
 
             // Check if the element is a line
-            else if (strcmp(child->Name(), "line") == 0)
+            else if (r.is("line"))
             {
                 // Read line attributes
-                float x1 = child->FloatAttribute("x1");
-                float y1 = child->FloatAttribute("y1");
-                float x2 = child->FloatAttribute("x2");
-                float y2 = child->FloatAttribute("y2");
-                const char *stroke_color = child->Attribute("stroke");
-                // Create Line object and add to vector
-                svg_elements.push_back(new Line(parse_color(stroke_color), {static_cast<int>(x1), static_cast<int>(y1)}, {static_cast<int>(x2), static_cast<int>(y2)}));
+                float x1 = r.float_attribute("x1");
+                float y1 = r.float_attribute("y1");
+                float x2 = r.float_attribute("x2");
+                float y2 = r.float_attribute("y2");
+                const char *stroke_color = r.attribute("stroke");
+                // Create Line object
+                e = make_element<Line>(arena, parse_color(stroke_color), Point{static_cast<int>(x1), static_cast<int>(y1)}, Point{static_cast<int>(x2), static_cast<int>(y2)});
             }
 
             // Check if the element is a polygon
-            else if (strcmp(child->Name(), "polygon") == 0)
+            else if (r.is("polygon"))
             {
                 // Read polygon attributes
-                const char *points_str = child->Attribute("points");
-                const char *fill_color = child->Attribute("fill");
+                const char *points_str = r.attribute("points");
+                const char *fill_color = r.attribute("fill");
                 // Parse points string
-                vector<Point> points;
-                stringstream ss(points_str);
-                string point;
-                while (getline(ss, point, ' '))
+                points.clear();
+                parse_points(points_str, points);
+                // Create Polygon object
+                e = make_element<Polygon>(arena, parse_color(fill_color), points, PointAllocator(arena));
+            }
+
+            else if (r.is("rect"))
+            {
+                // Read rectangle attributes
+                float x = r.float_attribute("x");
+                float y = r.float_attribute("y");
+                float width = r.float_attribute("width");
+                float height = r.float_attribute("height");
+                const char *fill_color = r.attribute("fill");
+                // Create Rectangle object
+                e = make_element<Rect>(arena, parse_color(fill_color), Point{static_cast<int>(x), static_cast<int>(y)}, static_cast<int>(width), static_cast<int>(height), PointAllocator(arena));
+            }
+
+            // Check if the element is a group
+            else if (r.is("g"))
+            {
+                read_children(r, transform, sink, ctx);
+                return;
+            }
+
+            // Check if the element is a reference to another element
+            else if (r.is("use"))
+            {
+                const char *href = r.attribute("href");
+                if (href == nullptr)
                 {
-                    // Split each point into x and y coordinates
-                    stringstream ss_point(point);
-                    string x_str, y_str;
-                    getline(ss_point, x_str, ',');
-                    getline(ss_point, y_str, ',');
-                    int x = stoi(x_str);
-                    int y = stoi(y_str);
-                    points.push_back({x, y});
+                    href = r.attribute("xlink:href");
                 }
-                // Create Polygon object and add to vector
-                svg_elements.push_back(new Polygon(parse_color(fill_color), points));
+                e = make_element<Use>(arena, symbol_for(href, ctx));
+                // x and y are an extra translation of the instance
+                placement = transform * Transform::translation(r.int_attribute("x"),
+                                                               r.int_attribute("y"));
             }
 
-            else if (strcmp(child->Name(), "rect") == 0)
+            if (e != nullptr)
             {
-                // Read rectangle attributes
-                float x = child->FloatAttribute("x");
-                float y = child->FloatAttribute("y");
-                float width = child->FloatAttribute("width");
-                float height = child->FloatAttribute("height");
-                const char *fill_color = child->Attribute("fill");
-                // Create Rectangle object and add to vector
-                svg_elements.push_back(new Rect(parse_color(fill_color), {static_cast<int>(x), static_cast<int>(y)}, static_cast<int>(width), static_cast<int>(height)));
+                emit(e, placement, r.attribute("id"), sink);
+            }
+            // Contents of shapes and unknown elements are not drawn
+            skip_element(r, ctx);
+        }
+
+        // Stream the elements of a document into a sink. The document is
+        // memory-mapped and parsed in one pass, without building a DOM.
+        void read_elements(const string& svg_file, Point& dimensions, const ElementSink &sink, Arena *symbol_arena)
+        {
+            StageTimer load(sink.stats != nullptr ? &sink.stats->load_ns : nullptr);
+            MappedFile file(svg_file);
+            load.stop();
+            XMLReader r(file.data(), file.size());
+            if (r.next() != XMLReader::START_TAG)
+            {
+                throw runtime_error("Unable to load " + svg_file);
             }
 
+            dimensions.x = r.int_attribute("width");
+            dimensions.y = r.int_attribute("height");
 
-            // Move to next child element
-            child = child->NextSiblingElement();
+            ReadContext ctx;
+            ctx.data = file.data();
+            ctx.size = file.size();
+            ctx.symbol_arena = symbol_arena;
+            ctx.all_ids = false;
+            record_id(r, ctx);
+            read_children(r, Transform::identity(), sink, ctx);
+        }
+    }
+
+    void readSVG(const string& svg_file, Point& dimensions, vector<SVGElement *>& svg_elements)
+    {
+        size_t first = svg_elements.size();
+        try
+        {
+            read_elements(svg_file, dimensions, {&svg_elements, nullptr, nullptr, nullptr}, nullptr);
+        }
+        catch (...)
+        {
+            // Do not leak the elements read before the error.
+            for (size_t i = first; i < svg_elements.size(); i++)
+            {
+                delete svg_elements[i];
+            }
+            svg_elements.resize(first);
+            throw;
+        }
+    }
+
+    void readSVG(const string& svg_file, Point& dimensions, vector<SVGElement *>& svg_elements, Arena& arena)
+    {
+        read_elements(svg_file, dimensions, {&svg_elements, nullptr, &arena, nullptr}, &arena);
+    }
+
+    void readSVG(const string& svg_file, Point& dimensions, Scene& scene, Arena& arena, ConvertStats *stats)
+    {
+        // Elements only live until they are added to the scene, so the
+        // arena is reset after each one. Referenced (shared) elements
+        // must outlive that, so they are kept on the heap.
+        // Parsing and building are interleaved: parsing is what is left
+        // of the whole read after loading and building.
+        const uint64_t before = stats != nullptr ? stats->load_ns + stats->build_ns : 0;
+        uint64_t read_ns = 0;
+        try
+        {
+            StageTimer timer(stats != nullptr ? &read_ns : nullptr);
+            read_elements(svg_file, dimensions, {nullptr, &scene, &arena, stats}, nullptr);
+        }
+        catch (...)
+        {
+            arena.reset();
+            throw;
+        }
+        arena.reset();
+        if (stats != nullptr)
+        {
+            stats->parse_ns += read_ns - (stats->load_ns + stats->build_ns - before);
         }
     }
-}
 
+    void readSVG(const string& svg_file, Point& dimensions, Scene& scene)
+    {
+        Arena arena;
+        readSVG(svg_file, dimensions, scene, arena);
+    }
+}
@@ -0,0 +1,73 @@
+//! @file stats.cpp
+#include "stats.hpp"
+
+#include <sstream>
+#include <string>
+
+namespace svg
+{
+    namespace
+    {
+        double milliseconds(uint64_t ns)
+        {
+            return ns / 1e6;
+        }
+    }
+
+    double ConvertStats::overdraw() const
+    {
+        const uint64_t canvas = (uint64_t)width * height;
+        return canvas == 0 ? 0 : (double)render.draw.pixels / canvas;
+    }
+
+    std::string to_json(const ConvertStats &stats)
+    {
+        std::ostringstream out;
+        out << "{\"width\":" << stats.width
+            << ",\"height\":" << stats.height
+            << ",\"time_ns\":{\"load\":" << stats.load_ns
+            << ",\"parse\":" << stats.parse_ns
+            << ",\"build\":" << stats.build_ns
+            << ",\"raster\":" << stats.raster_ns
+            << ",\"encode\":" << stats.encode_ns
+            << ",\"total\":" << stats.total_ns
+            << "},\"elements\":{\"ellipse\":" << stats.ellipses
+            << ",\"line\":" << stats.lines
+            << ",\"polyline\":" << stats.polylines
+            << ",\"polygon\":" << stats.polygons
+            << ",\"sprite\":" << stats.sprites
+            << "},\"spans\":" << stats.render.draw.spans
+            << ",\"pixels\":" << stats.render.draw.pixels
+            << ",\"overdraw\":" << stats.overdraw()
+            << ",\"occlusion\":{\"shapes\":" << stats.render.occlusion.shapes
+            << ",\"pixels\":" << stats.render.occlusion.pixels
+            << "},\"peak_framebuffer_bytes\":" << stats.peak_framebuffer_bytes
+            << ",\"palette_colors\":" << stats.palette_colors
+            << "}";
+        return out.str();
+    }
+
+    std::string to_string(const ConvertStats &stats)
+    {
+        std::ostringstream out;
+        out << "Canvas: " << stats.width << "x" << stats.height << std::endl
+            << "Time (ms): load " << milliseconds(stats.load_ns)
+            << ", parse " << milliseconds(stats.parse_ns)
+            << ", build " << milliseconds(stats.build_ns)
+            << ", raster " << milliseconds(stats.raster_ns)
+            << ", encode " << milliseconds(stats.encode_ns)
+            << ", total " << milliseconds(stats.total_ns) << std::endl
+            << "Elements: " << stats.ellipses << " ellipses, " << stats.lines << " lines, "
+            << stats.polylines << " polylines, " << stats.polygons << " polygons, "
+            << stats.sprites << " sprites" << std::endl
+            << "Drawing: " << stats.render.draw.spans << " spans, " << stats.render.draw.pixels
+            << " pixels written (overdraw " << stats.overdraw() << ")" << std::endl
+            << "Occlusion culling: " << stats.render.occlusion.shapes << " hidden shape tiles, "
+            << stats.render.occlusion.pixels << " pixels not drawn" << std::endl
+            << "Peak framebuffer: " << stats.peak_framebuffer_bytes << " bytes ("
+            << (stats.palette_colors != 0 ? std::to_string(stats.palette_colors) + " colors, indexed)"
+                                          : std::string("RGB)"))
+            << std::endl;
+        return out.str();
+    }
+}
@@ -0,0 +1,153 @@
+//! @file stats.hpp
+#ifndef __svg_stats_hpp__
+#define __svg_stats_hpp__
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace svg
+{
+    //! Pixels written by draw calls.
+    //! Counting is compiled out if SVG_NO_STATS is defined.
+    struct DrawStats
+    {
+        //! Runs of pixels written (single plotted pixels count as one).
+        uint64_t spans = 0;
+        //! Pixels written.
+        uint64_t pixels = 0;
+    };
+
+    //! Drawing work skipped by occlusion culling.
+    struct OcclusionStats
+    {
+        //! Shapes not drawn in a tile at all, being hidden there
+        //! (a shape counts once per tile).
+        uint64_t shapes = 0;
+        //! Pixel writes saved: the hidden pixels of the shapes drawn, and
+        //! the bounding boxes (within the tile) of the shapes not drawn.
+        uint64_t pixels = 0;
+    };
+
+    //! Counters of render_tiled() and render_banded().
+    struct RenderStats
+    {
+        DrawStats draw;
+        OcclusionStats occlusion;
+        //! Wall time spent writing finished bands (render_banded() only),
+        //! in nanoseconds.
+        uint64_t write_ns = 0;
+    };
+
+    //! Counters of a conversion (see convert()).
+    //! Times are wall-clock nanoseconds.
+    struct ConvertStats
+    {
+        //! Canvas size.
+        int width = 0;
+        int height = 0;
+        //! Opening (mapping) the input file.
+        uint64_t load_ns = 0;
+        //! Parsing the XML and the attributes, and creating the elements.
+        uint64_t parse_ns = 0;
+        //! Transforming the elements and adding them to the scene.
+        uint64_t build_ns = 0;
+        //! Drawing.
+        uint64_t raster_ns = 0;
+        //! Encoding and writing the PNG file.
+        uint64_t encode_ns = 0;
+        //! Whole conversion.
+        uint64_t total_ns = 0;
+        //! Shapes in the scene, by type.
+        uint64_t ellipses = 0;
+        uint64_t lines = 0;
+        uint64_t polylines = 0;
+        uint64_t polygons = 0;
+        uint64_t sprites = 0;
+        RenderStats render;
+        //! Largest amount of memory held by images (PNGImage pixel
+        //! buffers) at once during the conversion. The count is per
+        //! process, so it includes concurrent conversions, if any.
+        uint64_t peak_framebuffer_bytes = 0;
+        //! Colors of the indexed-color framebuffer (0 if RGB: the scene
+        //! has more than 256 colors).
+        uint64_t palette_colors = 0;
+
+        //! Get the overdraw ratio.
+        //! @return Pixels written per canvas pixel.
+        double overdraw() const;
+    };
+
+    //! Format conversion counters as a JSON object (on one line).
+    //! @param stats Counters.
+    //! @return JSON text.
+    std::string to_json(const ConvertStats &stats);
+    //! Format conversion counters for people (several lines).
+    //! @param stats Counters.
+    //! @return Text.
+    std::string to_string(const ConvertStats &stats);
+
+    //! Count a span of pixels written.
+    //! @param stats Counters (nothing is counted if nullptr).
+    //! @param pixels Pixels in the span.
+    inline void count_span(DrawStats *stats, uint64_t pixels)
+    {
+#ifndef SVG_NO_STATS
+        if (stats != nullptr)
+        {
+            stats->spans++;
+            stats->pixels += pixels;
+        }
+#else
+        (void)stats;
+        (void)pixels;
+#endif
+    }
+
+    //! Adds the wall time of its scope to a counter.
+    //! Compiled out if SVG_NO_STATS is defined.
+    class StageTimer
+    {
+    public:
+        //! Start timing.
+        //! @param ns Counter of nanoseconds (nothing is timed if nullptr).
+        explicit StageTimer(uint64_t *ns)
+#ifndef SVG_NO_STATS
+            : ns_(ns), start_(ns != nullptr ? std::chrono::steady_clock::now()
+                                            : std::chrono::steady_clock::time_point())
+#endif
+        {
+#ifdef SVG_NO_STATS
+            (void)ns;
+#endif
+        }
+        //! Add the time elapsed since construction (unless stopped).
+        ~StageTimer()
+        {
+            stop();
+        }
+        //! Add the time elapsed since construction now, and stop timing.
+        void stop()
+        {
+#ifndef SVG_NO_STATS
+            if (ns_ != nullptr)
+            {
+                *ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start_)
+                            .count();
+                ns_ = nullptr;
+            }
+#endif
+        }
+
+    private:
+        StageTimer(const StageTimer &) = delete;
+        StageTimer &operator=(const StageTimer &) = delete;
+
+#ifndef SVG_NO_STATS
+        uint64_t *ns_;
+        std::chrono::steady_clock::time_point start_;
+#endif
+    };
+}
+#endif
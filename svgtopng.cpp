@@ -1,17 +1,256 @@
 #include "SVGElements.hpp"
+#include "batch.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// POSIX headers
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace
+{
+    void usage()
+    {
+        std::cout << "Usage: svgtopng in_file.svg|in_file.svgb out_file.png" << std::endl
+                  << "       svgtopng --compile in_file.svg out_file.svgb" << std::endl
+                  << "       svgtopng [-j N] --batch list_file" << std::endl
+                  << "       svgtopng [-j N] --dir in_dir out_dir" << std::endl
+                  << "  list_file has one 'in_file.svg out_file.png' pair per line." << std::endl
+                  << "  Conversions may be preceded by --cache dir [--cache-size MB]" << std::endl
+                  << "  to reuse the PNG of inputs rendered before, and by" << std::endl
+                  << "  --png-level 0-9 (0: uncompressed, default 6) and" << std::endl
+                  << "  --png-filter none|sub|up|average|paeth|adaptive (default)," << std::endl
+                  << "  and by --antialias to draw smooth edges." << std::endl
+                  << "  Single conversions (without --cache) may also be preceded by" << std::endl
+                  << "  --stats or --stats=json to print per-stage times and counters" << std::endl
+                  << "  (with --stats=json, only the JSON document is printed)." << std::endl;
+    }
+
+    bool read_list(const std::string &list_file, std::vector<svg::BatchJob> &jobs)
+    {
+        std::ifstream in(list_file);
+        if (!in)
+        {
+            std::cerr << "Unable to open " << list_file << std::endl;
+            return false;
+        }
+        svg::BatchJob job;
+        while (in >> job.svg_file >> job.png_file)
+        {
+            jobs.push_back(job);
+        }
+        return true;
+    }
+
+    bool read_dir(const std::string &in_dir, const std::string &out_dir, std::vector<svg::BatchJob> &jobs)
+    {
+        ::DIR *directory = ::opendir(in_dir.c_str());
+        if (directory == nullptr)
+        {
+            std::cerr << "Unable to open input directory " << in_dir << std::endl;
+            return false;
+        }
+        ::dirent *entry;
+        while ((entry = ::readdir(directory)) != nullptr)
+        {
+            std::string fname = entry->d_name;
+            size_t dot = fname.find_last_of('.');
+            bool regular = entry->d_type == DT_REG;
+            if (entry->d_type == DT_UNKNOWN)
+            {
+                // Some file systems do not report types in directory
+                // entries: ask for the file's.
+                struct ::stat info;
+                regular = ::stat((in_dir + "/" + fname).c_str(), &info) == 0 && S_ISREG(info.st_mode);
+            }
+            if (regular && dot != std::string::npos &&
+                (fname.substr(dot) == ".svg" || fname.substr(dot) == ".svgb"))
+            {
+                svg::BatchJob job;
+                job.svg_file = in_dir + "/" + fname;
+                job.png_file = out_dir + "/" + fname.substr(0, dot) + ".png";
+                jobs.push_back(job);
+            }
+        }
+        ::closedir(directory);
+        // readdir() order depends on the file system: the summary is
+        // listed by file name.
+        std::sort(jobs.begin(), jobs.end(), [](const svg::BatchJob &a, const svg::BatchJob &b)
+                  { return a.svg_file < b.svg_file; });
+        return true;
+    }
+
+    int run_batch(std::vector<svg::BatchJob> &jobs, unsigned workers, svg::RenderCache *cache,
+                  const svg::PNGOptions &png)
+    {
+        std::cout << "Performing batch conversion of " << jobs.size() << " files ..." << std::endl;
+        svg::convert_batch(jobs, workers, cache, png);
+        int failed = 0;
+        for (const svg::BatchJob &job : jobs)
+        {
+            if (job.success)
+            {
+                std::cout << "ok   " << job.svg_file << " --> " << job.png_file << std::endl;
+            }
+            else
+            {
+                std::cout << "FAIL " << job.svg_file << ": " << job.error << std::endl;
+                failed++;
+            }
+        }
+        std::cout << "Done! " << jobs.size() - failed << " converted, "
+                  << failed << " failed." << std::endl;
+        return failed == 0 ? 0 : 1;
+    }
+}
 
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    unsigned workers = 0;
+    std::string cache_dir;
+    uint64_t cache_size = svg::DEFAULT_CACHE_SIZE;
+    svg::PNGOptions png;
+    enum
+    {
+        NO_STATS,
+        TEXT_STATS,
+        JSON_STATS
+    } stats_format = NO_STATS;
+    int arg = 1;
+    while (arg + 1 < argc)
     {
-        std::cout << "Usage: svgtopng in_file.svg out_file.png" << std::endl;
+        if (::strcmp(argv[arg], "--stats") == 0 || ::strcmp(argv[arg], "--stats=json") == 0)
+        {
+            stats_format = argv[arg][7] == '=' ? JSON_STATS : TEXT_STATS;
+            arg++;
+            continue;
+        }
+        if (::strcmp(argv[arg], "--antialias") == 0)
+        {
+            png.antialias = true;
+            arg++;
+            continue;
+        }
+        if (::strcmp(argv[arg], "-j") == 0)
+        {
+            if (!svg::parse_workers(argv[arg + 1], workers))
+            {
+                std::cerr << "Invalid number of workers " << argv[arg + 1] << std::endl;
+                usage();
+                return 1;
+            }
+        }
+        else if (::strcmp(argv[arg], "--cache") == 0)
+        {
+            cache_dir = argv[arg + 1];
+        }
+        else if (::strcmp(argv[arg], "--cache-size") == 0)
+        {
+            cache_size = ::strtoull(argv[arg + 1], nullptr, 10) << 20;
+        }
+        else if (::strcmp(argv[arg], "--png-level") == 0)
+        {
+            if (!svg::parse_level(argv[arg + 1], png.level))
+            {
+                std::cerr << "Invalid PNG level " << argv[arg + 1] << " (0-9)" << std::endl;
+                usage();
+                return 1;
+            }
+        }
+        else if (::strcmp(argv[arg], "--png-filter") == 0)
+        {
+            if (!svg::parse_filter(argv[arg + 1], png.filter))
+            {
+                std::cerr << "Unknown PNG filter " << argv[arg + 1] << std::endl;
+                usage();
+                return 1;
+            }
+        }
+        else
+        {
+            break;
+        }
+        arg += 2;
     }
-    else
+    // Stats are only gathered by single conversions, without a cache.
+    const bool single = argc - arg == 2 && ::strcmp(argv[arg], "--batch") != 0;
+    if (stats_format != NO_STATS && (!single || !cache_dir.empty()))
+    {
+        std::cerr << "--stats only applies to a single conversion without --cache" << std::endl;
+        usage();
+        return 1;
+    }
+    std::unique_ptr<svg::RenderCache> cache;
+    if (!cache_dir.empty())
+    {
+        cache.reset(new svg::RenderCache(cache_dir, cache_size));
+    }
+    std::vector<svg::BatchJob> jobs;
+    int status = 0;
+    if (argc - arg == 2 && ::strcmp(argv[arg], "--batch") == 0)
+    {
+        if (!read_list(argv[arg + 1], jobs))
+        {
+            return 1;
+        }
+        status = run_batch(jobs, workers, cache.get(), png);
+    }
+    else if (argc - arg == 3 && ::strcmp(argv[arg], "--dir") == 0)
     {
-        std::cout << "Performing conversion ... " << argv[1] << " --> " << argv[2] << std::endl;
-        svg::convert(argv[1], argv[2]);
+        if (!read_dir(argv[arg + 1], argv[arg + 2], jobs))
+        {
+            return 1;
+        }
+        status = run_batch(jobs, workers, cache.get(), png);
+    }
+    else if (argc - arg == 3 && ::strcmp(argv[arg], "--compile") == 0)
+    {
+        std::cout << "Compiling ... " << argv[arg + 1] << " --> " << argv[arg + 2] << std::endl;
+        svg::compile(argv[arg + 1], argv[arg + 2]);
         std::cout << "Done!" << std::endl;
     }
-    return 0;
-}
\ No newline at end of file
+    else if (single && stats_format == JSON_STATS)
+    {
+        // Nothing but the JSON document, for the tools that parse it.
+        svg::ConvertStats stats;
+        svg::convert(argv[arg], argv[arg + 1], png, &stats);
+        std::cout << svg::to_json(stats) << std::endl;
+    }
+    else if (single)
+    {
+        std::cout << "Performing conversion ... " << argv[arg] << " --> " << argv[arg + 1] << std::endl;
+        if (cache)
+        {
+            svg::PNGImage img(1, 1);
+            svg::Arena arena;
+            svg::convert(argv[arg], argv[arg + 1], img, arena, *cache, png);
+        }
+        else if (stats_format == TEXT_STATS)
+        {
+            svg::ConvertStats stats;
+            svg::convert(argv[arg], argv[arg + 1], png, &stats);
+            std::cout << svg::to_string(stats);
+        }
+        else
+        {
+            svg::convert(argv[arg], argv[arg + 1], png);
+        }
+        std::cout << "Done!" << std::endl;
+    }
+    else
+    {
+        usage();
+    }
+    if (cache)
+    {
+        std::cout << "Cache: " << cache->hits() << " hits, " << cache->misses() << " misses, "
+                  << (cache->size() >> 20) << " MB in " << cache_dir << std::endl;
+    }
+    return status;
+}
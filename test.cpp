@@ -1,10 +1,14 @@
 
 // Project file headers
 #include "SVGElements.hpp"
+#include "batch.hpp"
+#include "diff.hpp"
 
 // C++ library headers
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
 #include <iostream>
 #include <iomanip>
@@ -12,6 +16,7 @@
 #include <vector>
 #include <iterator>
 #include <fstream>
+#include <thread>
 using namespace std;
 
 // POSIX headers
@@ -33,6 +38,18 @@ namespace svg
         int failed_tests = 0;
         FILE *log_stream;
 
+        // A test, run by a child process whose output goes to a
+        // temporary file, read back when the child exits.
+        struct Test
+        {
+            string id;
+            ::pid_t pid;
+            FILE *output;
+            string log;
+            bool done;
+            bool success;
+        };
+
         bool run_conversion_test(const string &id)
         {
             string svg_file = root_path + "/input/" + id + ".svg";
@@ -40,29 +57,23 @@ namespace svg
             string out_file = root_path + "/output/" + id + ".png";
             convert(svg_file, out_file);
             PNGImage img1(exp_file), img2(out_file);
-            int w1 = img1.width(), h1 = img1.height(),
-                w2 = img2.width(), h2 = img2.height();
-            if (w1 != w2 || h1 != h2)
+            ImageDiff diff = diff_images(img1, img2);
+            if (!diff.same_size)
             {
                 std::cout << "Images have different dimensions: "
-                          << w1 << "x" << h1 << " != "
-                          << w2 << "x" << h2 << endl;
+                          << img1.width() << "x" << img1.height() << " != "
+                          << img2.width() << "x" << img2.height() << endl;
                 return false;
             }
-            for (int i = 0; i < w1; i++)
+            if (diff.mismatched != 0)
             {
-                for (int j = 0; j < h1; j++)
-                {
-                    Color c1 = img1.at(i, j), c2 = img2.at(i, j);
-                    if (c1.red != c2.red || c1.green != c2.green || c1.blue != c2.blue)
-                    {
-                        cout << "pixel (" << i << ' ' << j << "): expected "
-                             << (int)c1.red << ' ' << (int)c1.green << ' ' << (int)c1.blue
-                             << " got "
-                             << (int)c2.red << ' ' << (int)c2.green << ' ' << (int)c2.blue << std::endl;
-                        return false;
-                    }
-                }
+                Color c1 = img1.at(diff.first.x, diff.first.y), c2 = img2.at(diff.first.x, diff.first.y);
+                cout << "pixel (" << diff.first.x << ' ' << diff.first.y << "): expected "
+                     << (int)c1.red << ' ' << (int)c1.green << ' ' << (int)c1.blue
+                     << " got "
+                     << (int)c2.red << ' ' << (int)c2.green << ' ' << (int)c2.blue << std::endl
+                     << diff.mismatched << " pixels differ, max channel error " << diff.max_error << std::endl;
+                return false;
             }
             return true;
         }
@@ -88,29 +99,32 @@ namespace svg
             }
         }
 
-        void run_test(const string& id)
+        // Start a test in a child process.
+        void run_test(Test &test)
         {
-            int log_fd = ::fileno(log_stream);
-            onTestBegin(id);
+            test.output = ::tmpfile();
+            if (test.output == nullptr)
+            {
+                perror("Unable to run tests! Temporary file creation failed!");
+                ::exit(1);
+            }
+            // The child inherits the stdio buffers, which must not be
+            // written out twice.
+            cout.flush();
+            fflush(nullptr);
             ::pid_t pid = ::fork();
 
             if (pid == 0)
             {
-            
-                ::dup2(log_fd, 1);
-                ::dup2(log_fd, 2);
-                bool success = run_conversion_test(id);
+                ::dup2(::fileno(test.output), 1);
+                ::dup2(::fileno(test.output), 2);
+                bool success = run_conversion_test(test.id);
                 ::exit(success ? 0 : 1);
             }
             else if (pid > 0)
             {
-                // parent process waits
-                int child_status = -1;
-                ::waitpid(pid, &child_status, 0);
-
-                bool success = WIFEXITED(child_status) &&
-                               WEXITSTATUS(child_status) == 0;
-                onTestCompletion(success);
+                test.pid = pid;
+                test.done = false;
             }
             else
             {
@@ -120,6 +134,33 @@ namespace svg
             }
         }
 
+        // Record the end of a test, and read back its output.
+        void finish_test(Test &test, int child_status)
+        {
+            test.done = true;
+            test.success = WIFEXITED(child_status) &&
+                           WEXITSTATUS(child_status) == 0;
+            ::rewind(test.output);
+            char buffer[4096];
+            size_t n;
+            while ((n = ::fread(buffer, 1, sizeof(buffer), test.output)) > 0)
+            {
+                test.log.append(buffer, n);
+            }
+            ::fclose(test.output);
+            test.output = nullptr;
+        }
+
+        // Report a finished test, with its output as its log section.
+        void report_test(Test &test)
+        {
+            onTestBegin(test.id);
+            ::fwrite(test.log.data(), 1, test.log.size(), log_stream);
+            fflush(log_stream);
+            string().swap(test.log);
+            onTestCompletion(test.success);
+        }
+
     public:
         TestDriver(const string &root_path)
             : root_path(root_path),
@@ -127,7 +168,10 @@ namespace svg
         {
         }
 
-        void run_tests(const string &spec)
+        // Run the tests whose name starts with spec, with up to jobs
+        // of them at once (0 means one per core). Results are reported
+        // in name order, whatever the order the tests finish in.
+        void run_tests(const string &spec, unsigned jobs)
         {
             string dir_path = root_path + "/input";
             ::DIR *directory = ::opendir(dir_path.c_str());
@@ -157,16 +201,56 @@ namespace svg
             }
             sort(scripts_to_execute.begin(), scripts_to_execute.end());
 
+            if (jobs == 0)
+            {
+                jobs = max(1u, thread::hardware_concurrency());
+            }
+
             cout << "== " << scripts_to_execute.size() << " tests to execute  ==" << endl;
-            for (string id : scripts_to_execute)
+            auto start = chrono::steady_clock::now();
+            vector<Test> tests;
+            for (const string &id : scripts_to_execute)
+            {
+                tests.push_back({id, -1, nullptr, string(), false, false});
+            }
+            size_t next_to_start = 0, next_to_report = 0;
+            unsigned running = 0;
+            while (next_to_report < tests.size())
             {
-                run_test(id);
+                while (running < jobs && next_to_start < tests.size())
+                {
+                    run_test(tests[next_to_start++]);
+                    running++;
+                }
+                int child_status = -1;
+                ::pid_t pid = ::waitpid(-1, &child_status, 0);
+                if (pid < 0)
+                {
+                    perror("Unable to run tests! Waiting for a test failed!");
+                    ::exit(1);
+                }
+                for (Test &test : tests)
+                {
+                    if (test.pid == pid && !test.done)
+                    {
+                        finish_test(test, child_status);
+                        running--;
+                        break;
+                    }
+                }
+                while (next_to_report < next_to_start && tests[next_to_report].done)
+                {
+                    report_test(tests[next_to_report++]);
+                }
             }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
             cout << "== TEST EXECUTION SUMMARY ==" << endl
                  << "Total tests: " << total_tests << endl
                  << "Passed tests: " << passed_tests << endl
                  << "Failed tests: " << failed_tests << endl
+                 << "Wall time: " << fixed << setprecision(2) << seconds << " s ("
+                 << jobs << (jobs == 1 ? " job" : " jobs") << ")" << endl
                  << "See " << LOG_FILE_NAME << " for details." << endl;
         }
     };
@@ -174,11 +258,24 @@ namespace svg
 
 int main(int argc, char **argv)
 {
+    // test [-j N] [spec [root_path]]
     --argc;
     ++argv;
+    unsigned jobs = 1;
+    if (argc >= 1 && ::strcmp(argv[0], "-j") == 0)
+    {
+        if (argc < 2 || !svg::parse_workers(argv[1], jobs))
+        {
+            cerr << "Invalid number of jobs" << (argc < 2 ? string() : string(" ") + argv[1]) << endl
+                 << "Usage: test [-j N] [spec [root_path]]" << endl;
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
     svg::TestDriver driver(argc == 2 ? argv[1] : ".");
     string spec = argc >= 1 ? argv[0] : "";
-    driver.run_tests(spec);
+    driver.run_tests(spec, jobs);
 
     return 0;
 }
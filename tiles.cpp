@@ -0,0 +1,244 @@
+//! @file tiles.cpp
+#include "tiles.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace svg
+{
+    namespace
+    {
+        struct TileGrid
+        {
+            int tile_size;
+            int cols;
+            int rows;
+            // Indices of the shapes overlapping each tile, in document order.
+            std::vector<std::vector<size_t>> bins;
+        };
+
+        // Draw the shapes of a tile front to back, with a coverage mask:
+        // each pixel is painted once, by the last shape covering it, which
+        // is what drawing them in document order leaves there. A shape
+        // whose bounding box is already covered is not drawn at all, nor
+        // are the shapes behind a fully covered tile.
+        void draw_front_to_back(const Scene &scene,
+                                const std::vector<size_t> &bin,
+                                PNGImage &tile,
+                                int x0, int y0, int x1, int y1,
+                                CoverageMask &coverage,
+                                OcclusionStats &stats)
+        {
+            coverage.reset(x0, y0, x1, y1);
+            tile.set_coverage(&coverage);
+            for (size_t k = bin.size(); k-- > 0;)
+            {
+                Point top_left, bottom_right;
+                scene.bounds(bin[k], top_left, bottom_right);
+                if (coverage.full() ||
+                    coverage.covered(top_left.x, top_left.y, bottom_right.x, bottom_right.y))
+                {
+                    int w = std::min(bottom_right.x, x1 - 1) - std::max(top_left.x, x0) + 1;
+                    int h = std::min(bottom_right.y, y1 - 1) - std::max(top_left.y, y0) + 1;
+                    stats.shapes++;
+                    stats.pixels += (uint64_t)std::max(w, 0) * std::max(h, 0);
+                    continue;
+                }
+                scene.draw(tile, bin[k]);
+            }
+            tile.set_coverage(nullptr);
+            stats.pixels += coverage.skipped();
+        }
+
+        // Check whether the shapes of a tile [x0, x1[ x [y0, y1[ may paint
+        // well over its area, i.e. whether the coverage mask may pay off.
+        // Filled shapes count as their bounding box, lines as its length.
+        bool may_overdraw(const Scene &scene, const std::vector<size_t> &bin,
+                          int x0, int y0, int x1, int y1)
+        {
+            const uint64_t limit = 2 * (uint64_t)(x1 - x0) * (y1 - y0);
+            uint64_t pixels = 0;
+            for (size_t i : bin)
+            {
+                Point top_left, bottom_right;
+                scene.bounds(i, top_left, bottom_right);
+                uint64_t w = std::min(bottom_right.x, x1 - 1) - std::max(top_left.x, x0) + 1;
+                uint64_t h = std::min(bottom_right.y, y1 - 1) - std::max(top_left.y, y0) + 1;
+                Scene::ShapeType type = scene.type(i);
+                pixels += type == Scene::LINE || type == Scene::POLYLINE ? std::max(w, h) : w * h;
+                if (pixels > limit)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void tile_worker(const Scene &scene,
+                         PNGImage &img,
+                         int top,
+                         const TileGrid &grid,
+                         std::atomic<size_t> &next,
+                         RenderStats &stats,
+                         bool antialias)
+        {
+            CoverageMask coverage;
+            AreaRasterizer rasterizer;
+            size_t t;
+            while ((t = next++) < grid.bins.size())
+            {
+                int x0 = (int)(t % grid.cols) * grid.tile_size;
+                int y0 = top + (int)(t / grid.cols) * grid.tile_size;
+                PNGImage tile(img, x0, y0, x0 + grid.tile_size, y0 + grid.tile_size);
+                tile.set_stats(&stats.draw);
+                const std::vector<size_t> &bin = grid.bins[t];
+                const int x1 = std::min(x0 + grid.tile_size, img.width());
+                const int y1 = std::min(y0 + grid.tile_size, img.band_bottom());
+                if (antialias)
+                {
+                    tile.set_antialias(&rasterizer);
+                }
+                else if (may_overdraw(scene, bin, x0, y0, x1, y1))
+                {
+                    draw_front_to_back(scene, bin, tile, x0, y0, x1, y1, coverage, stats.occlusion);
+                    continue;
+                }
+                for (size_t i : bin)
+                {
+                    scene.draw(tile, i);
+                }
+            }
+        }
+
+        // Draw some shapes of a scene (all of them if shapes is nullptr)
+        // on the rows of an image (or band) in parallel tiles.
+        void draw_tiled(const Scene &scene,
+                        const std::vector<size_t> *shapes,
+                        PNGImage &img,
+                        int tile_size,
+                        unsigned workers,
+                        RenderStats *render_stats,
+                        bool antialias)
+        {
+            const int top = img.band_top();
+            TileGrid grid;
+            grid.tile_size = tile_size;
+            grid.cols = (img.width() + tile_size - 1) / tile_size;
+            grid.rows = (img.band_bottom() - top + tile_size - 1) / tile_size;
+            grid.bins.resize(grid.cols * grid.rows);
+            const size_t count = shapes != nullptr ? shapes->size() : scene.size();
+            for (size_t k = 0; k < count; k++)
+            {
+                size_t i = shapes != nullptr ? (*shapes)[k] : k;
+                Point top_left, bottom_right;
+                scene.bounds(i, top_left, bottom_right);
+                if (bottom_right.x < 0 || bottom_right.y < top || top_left.y >= img.band_bottom())
+                {
+                    // Entirely off the canvas (or band).
+                    continue;
+                }
+                int c0 = std::max(top_left.x, 0) / tile_size;
+                int r0 = (std::max(top_left.y, top) - top) / tile_size;
+                int c1 = std::min(bottom_right.x, img.width() - 1) / tile_size;
+                int r1 = (std::min(bottom_right.y, img.band_bottom() - 1) - top) / tile_size;
+                for (int r = r0; r <= r1; r++)
+                {
+                    for (int c = c0; c <= c1; c++)
+                    {
+                        grid.bins[r * grid.cols + c].push_back(i);
+                    }
+                }
+            }
+
+            if (workers == 0)
+            {
+                workers = std::max(1u, std::thread::hardware_concurrency());
+            }
+            workers = std::min<size_t>(workers, grid.bins.size());
+            workers = std::max(workers, 1u);
+            std::atomic<size_t> next(0);
+            std::vector<RenderStats> stats(workers);
+            std::vector<std::thread> pool;
+            for (unsigned t = 1; t < workers; t++)
+            {
+                pool.push_back(std::thread(tile_worker, std::cref(scene), std::ref(img),
+                                           top, std::cref(grid), std::ref(next), std::ref(stats[t]), antialias));
+            }
+            tile_worker(scene, img, top, grid, next, stats[0], antialias);
+            for (std::thread &t : pool)
+            {
+                t.join();
+            }
+            if (render_stats != nullptr)
+            {
+                for (const RenderStats &s : stats)
+                {
+                    render_stats->draw.spans += s.draw.spans;
+                    render_stats->draw.pixels += s.draw.pixels;
+                    render_stats->occlusion.shapes += s.occlusion.shapes;
+                    render_stats->occlusion.pixels += s.occlusion.pixels;
+                }
+            }
+        }
+    }
+
+    void render_tiled(const Scene &scene,
+                      PNGImage &img,
+                      int tile_size,
+                      unsigned workers,
+                      RenderStats *stats,
+                      bool antialias)
+    {
+        draw_tiled(scene, nullptr, img, tile_size, workers, stats, antialias);
+    }
+
+    void render_banded(const Scene &scene,
+                       PNGWriter &writer,
+                       int width,
+                       int height,
+                       int band_height,
+                       unsigned workers,
+                       RenderStats *stats,
+                       std::shared_ptr<const Palette> palette,
+                       bool antialias)
+    {
+        // Bin the shapes into the bands their bounding box overlaps,
+        // in document order.
+        std::vector<std::vector<size_t>> bins((height + band_height - 1) / band_height);
+        for (size_t i = 0; i < scene.size(); i++)
+        {
+            Point top_left, bottom_right;
+            scene.bounds(i, top_left, bottom_right);
+            if (bottom_right.x < 0 || bottom_right.y < 0 || top_left.x >= width || top_left.y >= height)
+            {
+                continue;
+            }
+            int b0 = std::max(top_left.y, 0) / band_height;
+            int b1 = std::min(bottom_right.y, height - 1) / band_height;
+            for (int b = b0; b <= b1; b++)
+            {
+                bins[b].push_back(i);
+            }
+        }
+        const int rows = std::min(band_height, height);
+        std::unique_ptr<PNGImage> buffer(palette != nullptr ? new PNGImage(width, height, 0, rows, palette)
+                                                            : new PNGImage(width, height, 0, rows));
+        PNGImage &band = *buffer;
+        for (size_t b = 0; b < bins.size(); b++)
+        {
+            if (b > 0)
+            {
+                band.move_band((int)b * band_height);
+            }
+            draw_tiled(scene, &bins[b], band, DEFAULT_TILE_SIZE, workers, stats, antialias);
+            StageTimer timer(stats != nullptr ? &stats->write_ns : nullptr);
+            band.write_rows(writer);
+            // The shapes of this band are no longer needed.
+            std::vector<size_t>().swap(bins[b]);
+        }
+    }
+}
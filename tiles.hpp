@@ -0,0 +1,66 @@
+//! @file tiles.hpp
+#ifndef __svg_tiles_hpp__
+#define __svg_tiles_hpp__
+
+#include "Scene.hpp"
+#include "encode.hpp"
+
+#include <cstdint>
+#include <memory>
+
+namespace svg
+{
+    //! Default tile size (in pixels) for render_tiled().
+    const int DEFAULT_TILE_SIZE = 64;
+    //! Default band height (in rows) for render_banded().
+    const int DEFAULT_BAND_HEIGHT = 64;
+
+    //! Draw a scene on an image, split into square tiles that are
+    //! rendered in parallel. Shapes are binned into the tiles their
+    //! bounding box overlaps, and drawn in document order within each
+    //! tile, so the result is identical to drawing them one by one.
+    //! Every shape is opaque, so each tile is drawn front to back with
+    //! a coverage mask (see PNGImage::set_coverage()), painting each
+    //! pixel only once; shapes hidden in a tile are not drawn there.
+    //! @param scene Scene to draw.
+    //! @param img Image to draw on.
+    //! @param tile_size Tile width and height.
+    //! @param workers Number of threads (0 means one per core).
+    //! @param stats Where to add the pixels written and the work skipped
+    //! by culling (optional).
+    //! @param antialias Draw anti-aliased (see PNGImage::set_antialias()).
+    //! Shapes then blend with the ones behind them, so tiles are drawn
+    //! back to front, without occlusion culling.
+    void render_tiled(const Scene &scene,
+                      PNGImage &img,
+                      int tile_size = DEFAULT_TILE_SIZE,
+                      unsigned workers = 0,
+                      RenderStats *stats = nullptr,
+                      bool antialias = false);
+    //! Draw a scene one horizontal band at a time, passing each finished
+    //! band straight to a PNG writer, so that only width x band_height
+    //! pixels are ever in memory. Shapes are binned into the bands their
+    //! bounding box overlaps and clipped to each band, which is drawn
+    //! in parallel tiles as by render_tiled().
+    //! @param scene Scene to draw.
+    //! @param writer PNG writer (no rows written yet).
+    //! @param width Image width.
+    //! @param height Image height.
+    //! @param band_height Rows per band.
+    //! @param workers Number of threads (0 means one per core).
+    //! @param stats Where to add the pixels written, the work skipped by
+    //! culling and the time spent writing bands (optional).
+    //! @param palette Palette of the bands, for an indexed-color writer
+    //! created with the same colors (nullptr for RGB).
+    //! @param antialias Draw anti-aliased, as by render_tiled() (RGB only).
+    void render_banded(const Scene &scene,
+                       PNGWriter &writer,
+                       int width,
+                       int height,
+                       int band_height = DEFAULT_BAND_HEIGHT,
+                       unsigned workers = 0,
+                       RenderStats *stats = nullptr,
+                       std::shared_ptr<const Palette> palette = nullptr,
+                       bool antialias = false);
+}
+#endif